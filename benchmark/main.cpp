@@ -0,0 +1,261 @@
+#include "config.hpp"
+#include "Application.hpp"
+#include "Utility.hpp"
+#include "Timer.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+// runs a scene for a fixed number of frames and writes per phase timings as json
+// usage: FrameBenchmark [scene.txt] [--warmup N] [--frames N] [--width W] [--height H] [--windowed] [--output file.json] [--trace trace.json]
+
+struct BenchmarkSettings
+{
+    std::string scene_name = "../scene.txt";
+    std::string output_file = "benchmark.json";
+    std::string trace_file;
+    u32 warmup_frames = 100;
+    u32 measured_frames = 1000;
+    u32 width = 1300;
+    u32 height = 1000;
+    bool headless = true;
+};
+
+struct PhaseSamples
+{
+    const char* name;
+    std::vector<f32> samples;
+};
+
+BenchmarkSettings parse_arguments(int argc, char** argv)
+{
+    BenchmarkSettings settings;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if(arg == "--warmup" && has_value)          settings.warmup_frames = std::stoul(argv[++i]);
+        else if(arg == "--frames" && has_value)     settings.measured_frames = std::stoul(argv[++i]);
+        else if(arg == "--width" && has_value)      settings.width = std::stoul(argv[++i]);
+        else if(arg == "--height" && has_value)     settings.height = std::stoul(argv[++i]);
+        else if(arg == "--output" && has_value)     settings.output_file = argv[++i];
+        else if(arg == "--trace" && has_value)      settings.trace_file = argv[++i];
+        else if(arg == "--windowed")                settings.headless = false;
+        else                                        settings.scene_name = arg;
+    }
+
+    if(settings.measured_frames == 0)
+    {
+        throw std::invalid_argument("need to measure at least one frame!");
+    }
+
+    return settings;
+}
+
+// nearest rank percentile, samples must already be sorted
+f32 percentile(const std::vector<f32>& sorted_samples, f32 p)
+{
+    size_t rank = (size_t)std::ceil(p * (f32)sorted_samples.size());
+    rank = std::clamp<size_t>(rank, 1, sorted_samples.size());
+    return sorted_samples[rank - 1];
+}
+
+// the scene path is user input and may contain quotes, backslashes or control characters
+std::string escape_json(const std::string& text)
+{
+    std::string escaped;
+    escaped.reserve(text.size());
+
+    for(char c : text)
+    {
+        switch(c)
+        {
+            case '"':   escaped += "\\\""; break;
+            case '\\':  escaped += "\\\\"; break;
+            case '\n':  escaped += "\\n"; break;
+            case '\r':  escaped += "\\r"; break;
+            case '\t':  escaped += "\\t"; break;
+            default:
+                if(static_cast<unsigned char>(c) < 0x20)
+                {
+                    char buffer[8];
+                    snprintf(buffer, sizeof(buffer), "\\u%04x", static_cast<unsigned char>(c));
+                    escaped += buffer;
+                }
+                else
+                {
+                    escaped += c;
+                }
+        }
+    }
+
+    return escaped;
+}
+
+void write_phase(std::ostream& out, PhaseSamples& phase)
+{
+    std::sort(phase.samples.begin(), phase.samples.end());
+
+    f64 total = 0.0;
+    for(f32 sample : phase.samples)
+    {
+        total += sample;
+    }
+
+    out << "    \"" << phase.name << "\": { "
+        << "\"mean\": " << total / (f64)phase.samples.size() << ", "
+        << "\"p50\": " << percentile(phase.samples, 0.50f) << ", "
+        << "\"p95\": " << percentile(phase.samples, 0.95f) << ", "
+        << "\"p99\": " << percentile(phase.samples, 0.99f) << ", "
+        << "\"max\": " << phase.samples.back() << " }";
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        BenchmarkSettings settings = parse_arguments(argc, argv);
+        std::vector<std::string> scene = util::read_file_to_vector(settings.scene_name);
+
+        Application app((int)settings.width, (int)settings.height, settings.headless);
+
+        Timer load_timer;
+        app.load_scene(scene);
+        f32 load_time = load_timer.stop();
+
+        // windowed runs still have to handle events every frame or the window stops responding
+        for(u32 i = 0; i < settings.warmup_frames; ++i)
+        {
+            app.poll_events();
+            app.draw_frame();
+        }
+
+        // all times are in ms
+        std::vector<PhaseSamples> phases =
+        {
+            { "frame", {} },
+            { "scene_update", {} },
+            { "render", {} },
+            { "fence_wait", {} },
+            { "acquire", {} },
+            { "record", {} },
+            { "submit", {} },
+            { "present", {} }
+        };
+
+        // GPU timings come from queries and only exist for frames the device could time
+        std::vector<PhaseSamples> gpu_phases =
+        {
+            { "render_pass", {} },
+            { "scene_draws", {} },
+            { "imgui", {} }
+        };
+
+        for(PhaseSamples& phase : phases)
+        {
+            phase.samples.reserve(settings.measured_frames);
+        }
+
+        for(PhaseSamples& phase : gpu_phases)
+        {
+            phase.samples.reserve(settings.measured_frames);
+        }
+
+        u64 vertex_invocations = 0, clipping_primitives = 0, fragment_invocations = 0;
+
+        for(u32 i = 0; i < settings.measured_frames; ++i)
+        {
+            app.poll_events();
+
+            Timer frame_timer;
+            app.draw_frame();
+            f32 frame_time = frame_timer.stop();
+
+            const FrameTimings& timings = app.get_frame_timings();
+            f32 values[] = { frame_time, app.get_update_time(), app.get_render_time(), timings.fence_wait, timings.acquire, timings.record, timings.submit, timings.present };
+
+            for(size_t p = 0; p < phases.size(); ++p)
+            {
+                phases[p].samples.push_back(values[p]);
+            }
+
+            const GPUFrameStats& gpu_stats = app.get_gpu_stats();
+            if(gpu_stats.valid)
+            {
+                f32 gpu_values[] = { gpu_stats.render_pass, gpu_stats.scene_draws, gpu_stats.imgui };
+                for(size_t p = 0; p < gpu_phases.size(); ++p)
+                {
+                    gpu_phases[p].samples.push_back(gpu_values[p]);
+                }
+
+                vertex_invocations += gpu_stats.vertex_invocations;
+                clipping_primitives += gpu_stats.clipping_primitives;
+                fragment_invocations += gpu_stats.fragment_invocations;
+            }
+        }
+
+        std::stringstream out;
+        out << "{\n";
+        out << "  \"scene\": \"" << escape_json(settings.scene_name) << "\",\n";
+        out << "  \"width\": " << settings.width << ",\n";
+        out << "  \"height\": " << settings.height << ",\n";
+        out << "  \"headless\": " << (settings.headless ? "true" : "false") << ",\n";
+        out << "  \"warmup_frames\": " << settings.warmup_frames << ",\n";
+        out << "  \"measured_frames\": " << settings.measured_frames << ",\n";
+        out << "  \"load_ms\": " << load_time << ",\n";
+        out << "  \"phases_ms\": {\n";
+
+        for(size_t p = 0; p < phases.size(); ++p)
+        {
+            write_phase(out, phases[p]);
+            out << ((p + 1 < phases.size()) ? ",\n" : "\n");
+        }
+
+        out << "  }";
+
+        // the stats are per frame averages over the frames that had valid queries
+        size_t gpu_frames = gpu_phases[0].samples.size();
+        if(gpu_frames > 0)
+        {
+            out << ",\n  \"gpu_frames\": " << gpu_frames << ",\n";
+            out << "  \"gpu_phases_ms\": {\n";
+
+            for(size_t p = 0; p < gpu_phases.size(); ++p)
+            {
+                write_phase(out, gpu_phases[p]);
+                out << ((p + 1 < gpu_phases.size()) ? ",\n" : "\n");
+            }
+
+            out << "  },\n";
+            out << "  \"pipeline_statistics\": { "
+                << "\"vertex_invocations\": " << vertex_invocations / gpu_frames << ", "
+                << "\"clipping_primitives\": " << clipping_primitives / gpu_frames << ", "
+                << "\"fragment_invocations\": " << fragment_invocations / gpu_frames << " }";
+        }
+
+        out << "\n}\n";
+
+        // written to a file since the loaders also log to stdout
+        std::string json = out.str();
+        util::write_binary_file(json.data(), json.size(), settings.output_file.c_str());
+        std::cout << "Benchmark results written to " << settings.output_file << "\n";
+
+        // zones of the last measured frames, the profiler ring buffers only keep the most recent ones
+        if(!settings.trace_file.empty())
+        {
+            Profiler::dump_trace(settings.trace_file.c_str());
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
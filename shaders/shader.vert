@@ -8,10 +8,11 @@ layout(location = 0) out vec3 v_position;
 layout(location = 1) out vec3 v_normal;
 layout(location = 2) out vec2 v_tex_coord;
 
-layout(push_constant) uniform constants
+// one transform per instance, the draw's first instance points at its batch
+layout(std430, set=0, binding=2) readonly buffer InstanceBuffer
 {
-    mat4 model;
-} object_transform;
+    mat4 transforms[];
+} instances;
 
 layout(set=0, binding=0) uniform CameraDataBuffer
 {
@@ -22,9 +23,9 @@ layout(set=0, binding=0) uniform CameraDataBuffer
 
 void main()
 {
-    vec4 world_pos = object_transform.model * vec4(in_position, 1.0);
+    vec4 world_pos = instances.transforms[gl_InstanceIndex] * vec4(in_position, 1.0);
     gl_Position = camera_data.proj * camera_data.view * world_pos;
     v_position = vec3(world_pos);
-    v_normal = transpose(inverse(mat3(object_transform.model))) * in_normal;
+    v_normal = transpose(inverse(mat3(instances.transforms[gl_InstanceIndex]))) * in_normal;
     v_tex_coord = in_uv;
 }
\ No newline at end of file
@@ -1,7 +1,9 @@
 #include "Application.hpp"
 #include "Input.hpp"
 #include "ModelLoader.hpp"
+#include "ModelCache.hpp"
 #include "Timer.hpp"
+#include "Profiler.hpp"
 
 #include <imgui.h>
 #include <imgui_internal.h>
@@ -20,39 +22,51 @@ void coloured_label(const char *label, ImVec4 colour, ImVec2 size)
 
 struct LoadModelTask : enki::ITaskSet
 {
-    void init(Renderer* _renderer, Scene* _scene, const char* _model_path, const glm::mat4& _transform)
+    void init(ModelCache* _model_cache, Scene* _scene, const char* _model_path, const glm::mat4& _transform)
     {
-        renderer = _renderer;
+        model_cache = _model_cache;
         scene = _scene;
         model_path = _model_path;
         transform = _transform;
+
+        // loaders wait on texture decodes by running other tasks, this keeps them from picking up another whole model
+        m_Priority = enki::TASK_PRIORITY_LOW;
     }
 
     void ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum) override
     {
+        PROFILE_SCOPE("LoadModelTask");
         Timer timer;
-        ModelLoader loader(renderer, model_path);
 
-        Model loaded_model = loader.load();
-        loaded_model.transform = transform;
-        scene->add_model(loaded_model);
+        // models placed several times in a scene share one import and one set of buffers
+        Model model;
+        model.asset = model_cache->load(model_path);
+        model.transform = transform;
+        scene->add_model(std::move(model));
 
         std::cout << "Model loaded in " << timer.stop() << "ms\n";
     }
 
-    Renderer* renderer;
+    ModelCache* model_cache;
     Scene* scene;
     const char* model_path;
     glm::mat4 transform;
 };
 
-Application::Application(int width, int height)
+Application::Application(int width, int height, bool headless) :
+	m_window(nullptr),
+	m_prev_time(0.f)
 {
 	Timer timer;
-	glfwInit();
+	Profiler::set_thread_name("Main thread");
+
+	if (!headless)
+	{
+		glfwInit();
 
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	m_window = glfwCreateWindow(width, height, "Vulkan Triangle Engine", nullptr, nullptr);
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+		m_window = glfwCreateWindow(width, height, "Vulkan Triangle Engine", nullptr, nullptr);
+	}
 
 	// GLFW can't create a callback with a member function, so we have to make it outside,
 	// but we can store an arbitrary pointer inside the window
@@ -62,56 +76,53 @@ Application::Application(int width, int height)
 	// create a task scheduler with 4 threads
 	enki::TaskSchedulerConfig scheduler_config;
 	scheduler_config.numTaskThreadsToCreate = 4;
+	Profiler::register_scheduler_callbacks(scheduler_config);
 
 	m_scheduler = new enki::TaskScheduler();
 	m_scheduler->Initialize(scheduler_config);
 
-	m_scene = new Scene();
+	m_scene = new Scene(m_scheduler);
 	Input::m_window_handle = m_window;
 	m_scene->camera.resize(width, height);
-	m_renderer = new Renderer(m_window, m_scheduler);
+
+	if (headless)
+	{
+		m_renderer = new Renderer(width, height, m_scheduler);
+	}
+	else
+	{
+		m_renderer = new Renderer(m_window, m_scheduler);
+	}
+
+	m_model_cache = new ModelCache(m_renderer);
 
 	std::cout << "Startup time: " << timer.stop() << "ms\n";
 }
 
 Application::~Application()
 {
-	// TODO: remove later
-	for (const Model& model : m_scene->models)
-	{
-        for(const Mesh& mesh : model.meshes)
-        {
-            m_renderer->destroy_buffer(mesh.vertex_buffer);
-            m_renderer->destroy_buffer(mesh.index_buffer);
-        }
-
-        for(const Material& material : model.materials)
-        {
-            for (u32 texture : material.textures)
-            {
-                if (texture != m_renderer->get_null_texture_handle())
-                {
-                    m_renderer->destroy_texture(texture);
-                }
-            }
-            //m_renderer->destroy_sampler(material.sampler);
-        }
-	}
+	// nothing below can be released while the last frames are still drawing it
+	m_renderer->wait_for_device_idle();
 
+	// the last references to the shared assets go with the scene, which returns their meshes to the renderer
+	// their textures stay in the renderer's texture cache and go with it
 	delete m_scene;
+	delete m_model_cache;
 	delete m_renderer;
 
-	glfwDestroyWindow(m_window);
-	glfwTerminate();
+	if (m_window)
+	{
+		glfwDestroyWindow(m_window);
+		glfwTerminate();
+	}
 }
 
 void Application::run()
 {
 	m_running = true;
-	static float render_time = 0.f;
 	while (!glfwWindowShouldClose(m_window) && m_running)
 	{
-		glfwPollEvents();
+		poll_events();
 
 		if (Input::is_key_pressed(GLFW_KEY_ESCAPE))
 		{
@@ -119,74 +130,151 @@ void Application::run()
 			continue;
 		}
 
-		ImGui_ImplVulkan_NewFrame();
-		ImGui_ImplGlfw_NewFrame();
+		draw_frame();
+	}
 
-		ImGui::NewFrame();
+	m_renderer->wait_for_device_idle();
+}
 
-		// imgui commands
-		// ImGui::ShowDemoWindow();
-		ImGui::Begin("Settings");
-		if (ImGui::CollapsingHeader("Diagnostics"))
-		{
-			ImGui::Text("Avg. %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
-			ImGui::Text("Render: %.1fms", render_time);
-		}
+void Application::poll_events()
+{
+	if (!m_window)
+	{
+		return;
+	}
 
-		if (ImGui::CollapsingHeader("Lighting"))
-		{
-			bool update_data = false;
+	glfwPollEvents();
+	ImGui_ImplGlfw_NewFrame();
+}
+
+void Application::run_headless(u32 num_frames)
+{
+	for (u32 i = 0; i < num_frames; ++i)
+	{
+		draw_frame();
+	}
+
+	m_renderer->wait_for_device_idle();
+}
 
-			LightingData data = m_renderer->get_light_data();
+void Application::draw_frame()
+{
+	PROFILE_SCOPE("Frame");
 
-			glm::vec3 direct_light_colour = data.direct_light_colour;
-			float colour2[3] = {
-				direct_light_colour.x,
-				direct_light_colour.y,
-				direct_light_colour.z
-			};
+	PROFILE_BEGIN("ImGui");
+	ImGui_ImplVulkan_NewFrame();
+	ImGui::NewFrame();
 
-			if (ImGui::ColorEdit3("Direct Light Colour", colour2))
-			{
-				direct_light_colour.x = colour2[0];
-				direct_light_colour.y = colour2[1];
-				direct_light_colour.z = colour2[2];
+	// imgui commands
+	// ImGui::ShowDemoWindow();
+	ImGui::Begin("Settings");
+	if (ImGui::CollapsingHeader("Diagnostics"))
+	{
+		ImGui::Text("Avg. %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+		ImGui::Text("Render: %.1fms", m_render_time);
+		ImGui::Text("Resizable BAR: %s", m_renderer->has_resizable_bar() ? "yes" : "no");
+		const DrawStats& draw_stats = m_renderer->get_draw_stats();
+		ImGui::Text("Draws: %u for %u instances", draw_stats.draws, draw_stats.instances);
+		ImGui::Text("Culled: %u models, %u meshes", draw_stats.culled_models, draw_stats.culled_instances);
+		ImGui::Text("Recorded: %u draws", draw_stats.recorded_draws);
+
+		bool culling = m_renderer->is_culling_enabled();
+		if (ImGui::Checkbox("Frustum culling", &culling))
+		{
+			m_renderer->set_culling_enabled(culling);
+		}
 
-				update_data = true;
+		// the cull shader's counts are read back a few frames late, so the numbers above lag behind when this is on
+		if (m_renderer->is_gpu_culling_supported())
+		{
+			bool gpu_culling = m_renderer->is_gpu_culling_enabled();
+			if (ImGui::Checkbox("GPU culling", &gpu_culling))
+			{
+				m_renderer->set_gpu_culling_enabled(gpu_culling);
 			}
+		}
 
-			float line_height = GImGui->Font->FontSize + GImGui->Style.FramePadding.y * 2.0f;
-			ImVec2 button_size = {line_height + 3.0f, line_height};
-
-			ImGui::Text("\nDirect Light Position: ");
-			coloured_label("x", ImVec4{0.8f, 0.1f, 0.15f, 1.0f}, button_size);
-			ImGui::SameLine();
-			update_data |= ImGui::DragFloat("##x", &data.direct_light_position.x);
-			coloured_label("y", ImVec4{0.2f, 0.7f, 0.2f, 1.0f}, button_size);
-			ImGui::SameLine();
-			update_data |= ImGui::DragFloat("##y", &data.direct_light_position.y);
-			coloured_label("z", ImVec4{0.1f, 0.25f, 0.8f, 1.0f}, button_size);
-			ImGui::SameLine();
-			update_data |= ImGui::DragFloat("##z", &data.direct_light_position.z);
-
-			if (update_data)
+		const GPUFrameStats& gpu_stats = m_renderer->get_gpu_stats();
+		if (gpu_stats.valid)
+		{
+			ImGui::Separator();
+			ImGui::Text("GPU render pass: %.3fms", gpu_stats.render_pass);
+			ImGui::Text("GPU scene draws: %.3fms", gpu_stats.scene_draws);
+			for (size_t i = 0; i < gpu_stats.draw_command_buffers.size(); ++i)
 			{
-				m_renderer->configure_lighting({
-												   .direct_light_colour = direct_light_colour,
-												   .direct_light_position = data.direct_light_position
-											   });
+				ImGui::BulletText("Command buffer %zu: %.3fms", i, gpu_stats.draw_command_buffers[i]);
 			}
+			ImGui::Text("GPU ImGui: %.3fms", gpu_stats.imgui);
+
+			ImGui::Text("Vertex invocations: %llu", (unsigned long long)gpu_stats.vertex_invocations);
+			ImGui::Text("Clipping primitives: %llu", (unsigned long long)gpu_stats.clipping_primitives);
+			ImGui::Text("Fragment invocations: %llu", (unsigned long long)gpu_stats.fragment_invocations);
+			ImGui::Separator();
 		}
-		ImGui::End();
-		ImGui::Render();
 
-		m_scene->update(get_delta_time());
-		Timer timer;
-		m_renderer->render(m_scene);
-		render_time = timer.stop();
+		if (ImGui::Button("Dump CPU trace"))
+		{
+			Profiler::dump_trace("trace.json");
+		}
 	}
 
-	m_renderer->wait_for_device_idle();
+	if (ImGui::CollapsingHeader("Lighting"))
+	{
+		bool update_data = false;
+
+		LightingData data = m_renderer->get_light_data();
+
+		glm::vec3 direct_light_colour = data.direct_light_colour;
+		float colour2[3] = {
+			direct_light_colour.x,
+			direct_light_colour.y,
+			direct_light_colour.z
+		};
+
+		if (ImGui::ColorEdit3("Direct Light Colour", colour2))
+		{
+			direct_light_colour.x = colour2[0];
+			direct_light_colour.y = colour2[1];
+			direct_light_colour.z = colour2[2];
+
+			update_data = true;
+		}
+
+		float line_height = GImGui->Font->FontSize + GImGui->Style.FramePadding.y * 2.0f;
+		ImVec2 button_size = {line_height + 3.0f, line_height};
+
+		ImGui::Text("\nDirect Light Position: ");
+		coloured_label("x", ImVec4{0.8f, 0.1f, 0.15f, 1.0f}, button_size);
+		ImGui::SameLine();
+		update_data |= ImGui::DragFloat("##x", &data.direct_light_position.x);
+		coloured_label("y", ImVec4{0.2f, 0.7f, 0.2f, 1.0f}, button_size);
+		ImGui::SameLine();
+		update_data |= ImGui::DragFloat("##y", &data.direct_light_position.y);
+		coloured_label("z", ImVec4{0.1f, 0.25f, 0.8f, 1.0f}, button_size);
+		ImGui::SameLine();
+		update_data |= ImGui::DragFloat("##z", &data.direct_light_position.z);
+
+		if (update_data)
+		{
+			m_renderer->configure_lighting({
+											   .direct_light_colour = direct_light_colour,
+											   .direct_light_position = data.direct_light_position
+										   });
+		}
+	}
+	ImGui::End();
+	ImGui::Render();
+	PROFILE_END();
+
+	Timer update_timer;
+	PROFILE_BEGIN("Scene update");
+	m_scene->update(get_delta_time());
+	PROFILE_END();
+	m_update_time = update_timer.stop();
+
+	Timer timer;
+	m_renderer->render(m_scene);
+	m_render_time = timer.stop();
 }
 
 void Application::load_scene(const std::vector<std::string>& scene)
@@ -210,12 +298,15 @@ void Application::load_scene(const std::vector<std::string>& scene)
 		std::vector<float> scale_values = get_floats_from_string(scene[i + 3]);
 		transform = glm::scale(transform, {scale_values[0], scale_values[1], scale_values[2]});
 
-        tasks[task_index].init(m_renderer, m_scene, path, transform);
+        tasks[task_index].init(m_model_cache, m_scene, path, transform);
         m_scheduler->AddTaskSetToPipe(&tasks[task_index]);
         ++task_index;
 	}
 
     m_scheduler->WaitforAll();
+
+    // build the BVH over everything that was just loaded instead of waiting for the first update
+    m_scene->update_bvh();
 }
 
 void Application::load_primitive(const char *primitive_name)
@@ -230,7 +321,8 @@ void Application::load_primitive(const char *primitive_name)
 
 float Application::get_delta_time()
 {
-	double time = glfwGetTime() * 1000.0;
+	// glfw isn't initialised when running headless so glfwGetTime can't be used
+	double time = m_clock.stop();
 
 	auto delta_time = (float)(time - m_prev_time);
 
@@ -5,24 +5,42 @@
 
 #include "Renderer.hpp"
 #include "Scene.hpp"
+#include "Timer.hpp"
+
+class ModelCache;
 
 class Application
 {
 public:
-    Application(int width, int height);
+    // headless skips creating a window and renders offscreen, see Renderer
+    Application(int width, int height, bool headless = false);
     ~Application();
 
     void run();
+    void run_headless(u32 num_frames);
+
+    // handles window events and starts the GLFW side of the ImGui frame, does nothing without a window
+    void poll_events();
+    void draw_frame();
     void load_scene(const std::vector<std::string>& scene);
     void load_primitive(const char* primitive_name);
 
+    [[nodiscard]] float get_update_time() const { return m_update_time; }
+    [[nodiscard]] float get_render_time() const { return m_render_time; }
+    [[nodiscard]] const FrameTimings& get_frame_timings() const { return m_renderer->get_frame_timings(); }
+    [[nodiscard]] const GPUFrameStats& get_gpu_stats() const { return m_renderer->get_gpu_stats(); }
+
 private:
     Renderer* m_renderer;
     GLFWwindow* m_window;
     Scene* m_scene;
+    ModelCache* m_model_cache;
     enki::TaskScheduler* m_scheduler;
     bool m_running;
     float m_prev_time;
+    Timer m_clock;
+    float m_render_time = 0.f;
+    float m_update_time = 0.f;
 
     float get_delta_time();
     static std::vector<float> get_floats_from_string(std::string line);
@@ -0,0 +1,611 @@
+#include "BVH.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+
+namespace
+{
+    AABB empty_box()
+    {
+        return { glm::vec3(std::numeric_limits<f32>::max()), glm::vec3(std::numeric_limits<f32>::lowest()) };
+    }
+
+    void grow(AABB& box, const AABB& other)
+    {
+        box.min = glm::min(box.min, other.min);
+        box.max = glm::max(box.max, other.max);
+    }
+
+    void grow(AABB& box, const glm::vec3& point)
+    {
+        box.min = glm::min(box.min, point);
+        box.max = glm::max(box.max, point);
+    }
+
+    f32 surface_area(const AABB& box)
+    {
+        glm::vec3 size = glm::max(box.max - box.min, glm::vec3(0.f));
+        return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    bool overlaps(const AABB& box, const BoundingSphere& sphere)
+    {
+        glm::vec3 closest = glm::clamp(sphere.center, box.min, box.max);
+        glm::vec3 offset = closest - sphere.center;
+        return glm::dot(offset, offset) <= sphere.radius * sphere.radius;
+    }
+
+    // slab test, the distance along the ray where it enters the box or a negative value on a miss
+    f32 intersect(const AABB& box, const glm::vec3& origin, const glm::vec3& inverse_direction, f32 max_distance)
+    {
+        glm::vec3 t0 = (box.min - origin) * inverse_direction;
+        glm::vec3 t1 = (box.max - origin) * inverse_direction;
+        glm::vec3 t_near = glm::min(t0, t1);
+        glm::vec3 t_far = glm::max(t0, t1);
+
+        f32 enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, 0.f));
+        f32 exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, max_distance));
+
+        return enter <= exit ? enter : -1.f;
+    }
+
+    // runs function(i) for every i in [0, count) on the scheduler's threads
+    template<typename Function>
+    struct ParallelForTask : enki::ITaskSet
+    {
+        ParallelForTask(u32 count, Function&& _function) :
+            enki::ITaskSet(count),
+            function(std::move(_function))
+        {
+        }
+
+        void ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum) override
+        {
+            PROFILE_SCOPE("BVH query task");
+
+            for(u32 i = range.start; i < range.end; ++i)
+            {
+                function(i);
+            }
+        }
+
+        Function function;
+    };
+
+    template<typename Function>
+    void parallel_for(enki::TaskScheduler* scheduler, u32 count, Function&& function)
+    {
+        ParallelForTask<Function> task(count, std::forward<Function>(function));
+        scheduler->AddTaskSetToPipe(&task);
+        scheduler->WaitforTask(&task);
+    }
+}
+
+void BVH::build(const AABB* bounds, u32 count)
+{
+    PROFILE_FUNCTION();
+
+    m_item_bounds.assign(bounds, bounds + count);
+    m_item_leaves.assign(count, k_invalid);
+    m_items.resize(count);
+    for(u32 i = 0; i < count; ++i)
+    {
+        m_items[i] = i;
+    }
+
+    m_nodes.clear();
+    m_parents.clear();
+    m_needs_refit = false;
+    m_node_areas = 0.0;
+    m_build_cost = 0.0;
+
+    if(count == 0)
+    {
+        m_dirty.clear();
+        return;
+    }
+
+    std::vector<glm::vec3> centroids(count);
+    for(u32 i = 0; i < count; ++i)
+    {
+        centroids[i] = (bounds[i].min + bounds[i].max) * 0.5f;
+    }
+
+    // a binary tree with at least one item per leaf never has more than this
+    m_nodes.reserve(2 * count - 1);
+    m_parents.reserve(2 * count - 1);
+
+    Node& root = m_nodes.emplace_back();
+    root.first = 0;
+    root.count = count;
+    m_parents.push_back(k_invalid);
+
+    subdivide(0, centroids, 0);
+
+    m_dirty.assign(m_nodes.size(), 0);
+
+    for(const Node& node : m_nodes)
+    {
+        m_node_areas += get_node_area(node);
+    }
+    m_build_cost = get_cost();
+}
+
+f64 BVH::get_node_area(const Node& node) const
+{
+    return static_cast<f64>(surface_area(node.bounds)) * std::max(node.count, 1u);
+}
+
+f64 BVH::get_cost() const
+{
+    // a tree of flat or point sized items has nothing to lose
+    f64 root_area = m_nodes.empty() ? 0.0 : surface_area(m_nodes[0].bounds);
+    return root_area > 0.0 ? m_node_areas / root_area : 0.0;
+}
+
+f32 BVH::get_degradation() const
+{
+    if(m_build_cost <= 0.0)
+    {
+        return get_cost() > 0.0 ? std::numeric_limits<f32>::max() : 1.f;
+    }
+
+    return static_cast<f32>(get_cost() / m_build_cost);
+}
+
+void BVH::subdivide(u32 node_index, const std::vector<glm::vec3>& centroids, u32 depth)
+{
+    // nodes is appended to while recursing, so nodes are only ever referred to by index
+    u32 first = m_nodes[node_index].first;
+    u32 count = m_nodes[node_index].count;
+
+    AABB bounds = empty_box();
+    AABB centroid_bounds = empty_box();
+    for(u32 i = first; i < first + count; ++i)
+    {
+        grow(bounds, m_item_bounds[m_items[i]]);
+        grow(centroid_bounds, centroids[m_items[i]]);
+    }
+    m_nodes[node_index].bounds = bounds;
+
+    auto make_leaf = [&]()
+    {
+        for(u32 i = first; i < first + count; ++i)
+        {
+            m_item_leaves[m_items[i]] = node_index;
+        }
+    };
+
+    // the traversal stacks are sized for the depth limit
+    if(count <= k_max_leaf_items || depth + 1 >= k_max_depth)
+    {
+        make_leaf();
+        return;
+    }
+
+    // bin the centroids along each axis and sweep the bins for the cheapest split
+    // cost is the children's surface areas weighted by how many items they hold
+    f32 best_cost = std::numeric_limits<f32>::max();
+    u32 best_axis = 0;
+    u32 best_split = 0;
+
+    glm::vec3 centroid_extent = centroid_bounds.max - centroid_bounds.min;
+    for(u32 axis = 0; axis < 3; ++axis)
+    {
+        if(centroid_extent[axis] <= 0.f)
+        {
+            continue;
+        }
+
+        AABB bin_bounds[k_num_bins];
+        u32 bin_counts[k_num_bins] = {};
+        for(AABB& bin : bin_bounds)
+        {
+            bin = empty_box();
+        }
+
+        f32 scale = k_num_bins / centroid_extent[axis];
+        for(u32 i = first; i < first + count; ++i)
+        {
+            u32 item = m_items[i];
+            u32 bin = std::min(static_cast<u32>((centroids[item][axis] - centroid_bounds.min[axis]) * scale), k_num_bins - 1);
+            ++bin_counts[bin];
+            grow(bin_bounds[bin], m_item_bounds[item]);
+        }
+
+        // right to left sweep first, then the left to right sweep can cost every split directly
+        f32 right_areas[k_num_bins];
+        u32 right_counts[k_num_bins];
+        AABB right_bounds = empty_box();
+        u32 right_count = 0;
+        for(u32 bin = k_num_bins - 1; bin > 0; --bin)
+        {
+            grow(right_bounds, bin_bounds[bin]);
+            right_count += bin_counts[bin];
+            right_areas[bin] = surface_area(right_bounds);
+            right_counts[bin] = right_count;
+        }
+
+        AABB left_bounds = empty_box();
+        u32 left_count = 0;
+        for(u32 split = 1; split < k_num_bins; ++split)
+        {
+            grow(left_bounds, bin_bounds[split - 1]);
+            left_count += bin_counts[split - 1];
+
+            if(left_count == 0 || right_counts[split] == 0)
+            {
+                continue;
+            }
+
+            f32 cost = surface_area(left_bounds) * left_count + right_areas[split] * right_counts[split];
+            if(cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = split;
+            }
+        }
+    }
+
+    // splitting isn't worth it, unless the leaf would get unreasonably big
+    f32 leaf_cost = surface_area(bounds) * count;
+    if(best_split == 0 || (best_cost >= leaf_cost && count <= 4 * k_max_leaf_items))
+    {
+        make_leaf();
+        return;
+    }
+
+    f32 scale = k_num_bins / centroid_extent[best_axis];
+    f32 axis_min = centroid_bounds.min[best_axis];
+    u32* middle = std::partition(m_items.data() + first, m_items.data() + first + count, [&](u32 item)
+    {
+        return std::min(static_cast<u32>((centroids[item][best_axis] - axis_min) * scale), k_num_bins - 1) < best_split;
+    });
+    u32 left_count = static_cast<u32>(middle - (m_items.data() + first));
+
+    u32 left = static_cast<u32>(m_nodes.size());
+    m_nodes.emplace_back();
+    m_nodes.emplace_back();
+    m_parents.push_back(node_index);
+    m_parents.push_back(node_index);
+
+    m_nodes[left].first = first;
+    m_nodes[left].count = left_count;
+    m_nodes[left + 1].first = first + left_count;
+    m_nodes[left + 1].count = count - left_count;
+
+    m_nodes[node_index].first = left;
+    m_nodes[node_index].count = 0;
+
+    subdivide(left, centroids, depth + 1);
+    subdivide(left + 1, centroids, depth + 1);
+}
+
+void BVH::update(u32 item, const AABB& bounds)
+{
+    m_item_bounds[item] = bounds;
+
+    // mark up to the first ancestor that is already marked, everything above it is too
+    for(u32 node = m_item_leaves[item]; node != k_invalid && !m_dirty[node]; node = m_parents[node])
+    {
+        m_dirty[node] = 1;
+    }
+    m_needs_refit = true;
+}
+
+void BVH::refit()
+{
+    if(!m_needs_refit)
+    {
+        return;
+    }
+
+    PROFILE_FUNCTION();
+
+    for(u32 i = static_cast<u32>(m_nodes.size()); i-- > 0;)
+    {
+        if(!m_dirty[i])
+        {
+            continue;
+        }
+
+        Node& node = m_nodes[i];
+        m_node_areas -= get_node_area(node);
+
+        if(node.count > 0)
+        {
+            node.bounds = empty_box();
+            for(u32 j = node.first; j < node.first + node.count; ++j)
+            {
+                grow(node.bounds, m_item_bounds[m_items[j]]);
+            }
+        }
+        else
+        {
+            node.bounds = m_nodes[node.first].bounds;
+            grow(node.bounds, m_nodes[node.first + 1].bounds);
+        }
+
+        m_node_areas += get_node_area(node);
+        m_dirty[i] = 0;
+    }
+
+    m_needs_refit = false;
+}
+
+void BVH::collect(u32 node_index, std::vector<u32>& items) const
+{
+    u32 stack[k_max_depth + 1];
+    u32 stack_size = 0;
+    stack[stack_size++] = node_index;
+
+    while(stack_size > 0)
+    {
+        const Node& node = m_nodes[stack[--stack_size]];
+        if(node.count > 0)
+        {
+            items.insert(items.end(), m_items.begin() + node.first, m_items.begin() + node.first + node.count);
+        }
+        else
+        {
+            stack[stack_size++] = node.first;
+            stack[stack_size++] = node.first + 1;
+        }
+    }
+}
+
+void BVH::query_frustum(u32 node_index, u32 plane_mask, const culling::Frustum& frustum, std::vector<u32>& items) const
+{
+    struct Entry
+    {
+        u32 node;
+        u32 plane_mask;
+    };
+
+    Entry stack[k_max_depth + 1];
+    u32 stack_size = 0;
+    stack[stack_size++] = { node_index, plane_mask };
+
+    while(stack_size > 0)
+    {
+        Entry entry = stack[--stack_size];
+        const Node& node = m_nodes[entry.node];
+
+        culling::Containment containment = culling::test_box(frustum, node.bounds, entry.plane_mask);
+        if(containment == culling::Containment::Outside)
+        {
+            continue;
+        }
+
+        // nothing under a box that is completely inside needs testing
+        if(containment == culling::Containment::Inside)
+        {
+            collect(entry.node, items);
+            continue;
+        }
+
+        if(node.count > 0)
+        {
+            for(u32 i = node.first; i < node.first + node.count; ++i)
+            {
+                u32 item_mask = entry.plane_mask;
+                if(culling::test_box(frustum, m_item_bounds[m_items[i]], item_mask) != culling::Containment::Outside)
+                {
+                    items.push_back(m_items[i]);
+                }
+            }
+        }
+        else
+        {
+            stack[stack_size++] = { node.first, entry.plane_mask };
+            stack[stack_size++] = { node.first + 1, entry.plane_mask };
+        }
+    }
+}
+
+void BVH::query_frustum(const culling::Frustum& frustum, std::vector<u32>& items) const
+{
+    if(!m_nodes.empty())
+    {
+        query_frustum(0, 0x3F, frustum, items);
+    }
+}
+
+void BVH::query_frustum(const culling::Frustum& frustum, enki::TaskScheduler* scheduler, std::vector<u32>& items) const
+{
+    PROFILE_FUNCTION();
+
+    if(m_nodes.empty())
+    {
+        return;
+    }
+
+    // open up the tree breadth first until there are a few subtrees per thread to hand out
+    // nodes culled or fully inside on the way down are dealt with right here
+    struct Subtree
+    {
+        u32 node;
+        u32 plane_mask;
+    };
+
+    u32 target = 4 * scheduler->GetNumTaskThreads();
+    std::vector<Subtree> frontier = { { 0, 0x3F } };
+    std::vector<Subtree> next;
+    while(frontier.size() < target)
+    {
+        next.clear();
+        bool opened = false;
+        for(const Subtree& subtree : frontier)
+        {
+            const Node& node = m_nodes[subtree.node];
+            u32 plane_mask = subtree.plane_mask;
+
+            culling::Containment containment = culling::test_box(frustum, node.bounds, plane_mask);
+            if(containment == culling::Containment::Outside)
+            {
+                opened = true;
+                continue;
+            }
+
+            if(containment == culling::Containment::Inside)
+            {
+                collect(subtree.node, items);
+                opened = true;
+                continue;
+            }
+
+            if(node.count > 0)
+            {
+                next.push_back({ subtree.node, plane_mask });
+            }
+            else
+            {
+                next.push_back({ node.first, plane_mask });
+                next.push_back({ node.first + 1, plane_mask });
+                opened = true;
+            }
+        }
+
+        frontier.swap(next);
+        if(!opened || frontier.empty())
+        {
+            break;
+        }
+    }
+
+    std::vector<std::vector<u32>> results(frontier.size());
+    parallel_for(scheduler, static_cast<u32>(frontier.size()), [&](u32 i)
+    {
+        query_frustum(frontier[i].node, frontier[i].plane_mask, frustum, results[i]);
+    });
+
+    for(const std::vector<u32>& result : results)
+    {
+        items.insert(items.end(), result.begin(), result.end());
+    }
+}
+
+void BVH::query_sphere(const BoundingSphere& sphere, std::vector<u32>& items) const
+{
+    if(m_nodes.empty())
+    {
+        return;
+    }
+
+    u32 stack[k_max_depth + 1];
+    u32 stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while(stack_size > 0)
+    {
+        const Node& node = m_nodes[stack[--stack_size]];
+        if(!overlaps(node.bounds, sphere))
+        {
+            continue;
+        }
+
+        if(node.count > 0)
+        {
+            for(u32 i = node.first; i < node.first + node.count; ++i)
+            {
+                if(overlaps(m_item_bounds[m_items[i]], sphere))
+                {
+                    items.push_back(m_items[i]);
+                }
+            }
+        }
+        else
+        {
+            stack[stack_size++] = node.first;
+            stack[stack_size++] = node.first + 1;
+        }
+    }
+}
+
+void BVH::query_spheres(const BoundingSphere* spheres, u32 count, std::vector<u32>* items, enki::TaskScheduler* scheduler) const
+{
+    PROFILE_FUNCTION();
+
+    parallel_for(scheduler, count, [&](u32 i)
+    {
+        query_sphere(spheres[i], items[i]);
+    });
+}
+
+bool BVH::raycast(const Ray& ray, RayHit& hit) const
+{
+    hit = {};
+    if(m_nodes.empty())
+    {
+        return false;
+    }
+
+    // divisions by zero give infinities, which the slab test handles
+    glm::vec3 inverse_direction = 1.f / ray.direction;
+    f32 max_distance = ray.max_distance;
+
+    u32 stack[k_max_depth + 1];
+    u32 stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while(stack_size > 0)
+    {
+        const Node& node = m_nodes[stack[--stack_size]];
+        if(intersect(node.bounds, ray.origin, inverse_direction, max_distance) < 0.f)
+        {
+            continue;
+        }
+
+        if(node.count > 0)
+        {
+            for(u32 i = node.first; i < node.first + node.count; ++i)
+            {
+                f32 distance = intersect(m_item_bounds[m_items[i]], ray.origin, inverse_direction, max_distance);
+                if(distance >= 0.f)
+                {
+                    hit.item = m_items[i];
+                    hit.distance = distance;
+                    max_distance = distance;
+                }
+            }
+            continue;
+        }
+
+        // the nearer child goes on top so it can shorten the ray before the other one is tested
+        f32 left = intersect(m_nodes[node.first].bounds, ray.origin, inverse_direction, max_distance);
+        f32 right = intersect(m_nodes[node.first + 1].bounds, ray.origin, inverse_direction, max_distance);
+        bool left_first = left >= 0.f && (right < 0.f || left <= right);
+        if(left_first)
+        {
+            if(right >= 0.f)
+            {
+                stack[stack_size++] = node.first + 1;
+            }
+            stack[stack_size++] = node.first;
+        }
+        else
+        {
+            if(left >= 0.f)
+            {
+                stack[stack_size++] = node.first;
+            }
+            if(right >= 0.f)
+            {
+                stack[stack_size++] = node.first + 1;
+            }
+        }
+    }
+
+    return hit.item != UINT32_MAX;
+}
+
+void BVH::raycast(const Ray* rays, u32 count, RayHit* hits, enki::TaskScheduler* scheduler) const
+{
+    PROFILE_FUNCTION();
+
+    parallel_for(scheduler, count, [&](u32 i)
+    {
+        raycast(rays[i], hits[i]);
+    });
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "config.hpp"
+#include "Components.hpp"
+#include "Culling.hpp"
+
+#include <TaskScheduler.h>
+
+struct Ray
+{
+    glm::vec3 origin{0.f};
+    glm::vec3 direction{0.f, 0.f, -1.f};
+    f32 max_distance = std::numeric_limits<f32>::max();
+};
+
+struct RayHit
+{
+    // UINT32_MAX when nothing was hit
+    u32 item = UINT32_MAX;
+    f32 distance = 0.f;
+};
+
+// bounding volume hierarchy over axis aligned boxes, an item is whatever index the caller's bounds had in build
+// built top down with a binned surface area heuristic
+// moving items are refitted in place, which keeps every query correct but lets the tree's quality drift,
+// so callers rebuild once enough has moved or been added
+class BVH
+{
+public:
+    void build(const AABB* bounds, u32 count);
+
+    // only marks the path to the root, refit() has to run before the next query
+    void update(u32 item, const AABB& bounds);
+    void refit();
+
+    // the tree's surface area heuristic cost relative to when it was built, 1 right after a build and growing as refits loosen it
+    // the cost is relative to the root's area, so everything moving together doesn't count
+    [[nodiscard]] f32 get_degradation() const;
+
+    [[nodiscard]] u32 get_num_items() const { return static_cast<u32>(m_item_bounds.size()); }
+    [[nodiscard]] u32 get_num_nodes() const { return static_cast<u32>(m_nodes.size()); }
+
+    // queries append the matching items and never modify the tree, any number of threads can run them at once
+    // items are only tested by their boxes, so results are conservative
+    void query_frustum(const culling::Frustum& frustum, std::vector<u32>& items) const;
+    void query_sphere(const BoundingSphere& sphere, std::vector<u32>& items) const;
+    bool raycast(const Ray& ray, RayHit& hit) const;
+
+    // the same queries spread over the scheduler's threads, the calling thread helps while it waits
+    // a single frustum query is split across the subtrees near the root
+    void query_frustum(const culling::Frustum& frustum, enki::TaskScheduler* scheduler, std::vector<u32>& items) const;
+    void query_spheres(const BoundingSphere* spheres, u32 count, std::vector<u32>* items, enki::TaskScheduler* scheduler) const;
+    void raycast(const Ray* rays, u32 count, RayHit* hits, enki::TaskScheduler* scheduler) const;
+
+private:
+    struct Node
+    {
+        AABB bounds;
+
+        // internal nodes: index of the left child, the right child always follows it
+        // leaves: index of the leaf's first entry in m_items
+        u32 first = 0;
+
+        // zero for internal nodes
+        u32 count = 0;
+    };
+
+    static constexpr u32 k_max_leaf_items = 4;
+    static constexpr u32 k_num_bins = 16;
+    static constexpr u32 k_max_depth = 64;
+    static constexpr u32 k_invalid = UINT32_MAX;
+
+    // children are always created after their parent, so walking the nodes backwards visits children first
+    std::vector<Node> m_nodes;
+    std::vector<u32> m_parents;
+    std::vector<u8> m_dirty;
+    bool m_needs_refit = false;
+
+    // sum of the surface areas of every node, leaves weighted by their item count, kept up to date by refit
+    f64 m_node_areas = 0.0;
+    f64 m_build_cost = 0.0;
+
+    // item indices, each leaf owns a contiguous range
+    std::vector<u32> m_items;
+    std::vector<AABB> m_item_bounds;
+    std::vector<u32> m_item_leaves;
+
+    [[nodiscard]] f64 get_node_area(const Node& node) const;
+    [[nodiscard]] f64 get_cost() const;
+    void subdivide(u32 node_index, const std::vector<glm::vec3>& centroids, u32 depth);
+    void query_frustum(u32 node_index, u32 plane_mask, const culling::Frustum& frustum, std::vector<u32>& items) const;
+    void collect(u32 node_index, std::vector<u32>& items) const;
+};
@@ -1,8 +1,8 @@
 #include "CommandBuffer.hpp"
 
+// buffers come from pools that are reset as a whole, so there is no reset of the buffer itself here
 void CommandBuffer::begin()
 {
-	vk_command_buffer.reset();
 	vk::CommandBufferBeginInfo begin_info{};
 	begin_info.sType = vk::StructureType::eCommandBufferBeginInfo;
 	begin_info.pInheritanceInfo = nullptr; // only relevant to secondary command buffers
@@ -14,12 +14,14 @@ void CommandBuffer::begin()
 	m_is_recording = true;
 }
 
-void CommandBuffer::begin(vk::CommandBufferInheritanceInfo inheritance_info)
+void CommandBuffer::begin(vk::CommandBufferInheritanceInfo inheritance_info, bool one_time_submit)
 {
-	vk_command_buffer.reset();
-
 	vk::CommandBufferBeginInfo secondary_begin_info{};
-	secondary_begin_info.flags = vk::CommandBufferUsageFlagBits::eRenderPassContinue | vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+	secondary_begin_info.flags = vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+	if(one_time_submit)
+	{
+		secondary_begin_info.flags |= vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+	}
 	secondary_begin_info.pInheritanceInfo = &inheritance_info;
 
 	vk_command_buffer.begin(secondary_begin_info);
@@ -6,7 +6,8 @@
 struct CommandBuffer
 {
 	void begin();
-	void begin(vk::CommandBufferInheritanceInfo inheritance_info);
+	// secondaries that are executed again in later frames have to be begun without one time submit
+	void begin(vk::CommandBufferInheritanceInfo inheritance_info, bool one_time_submit = true);
     void begin_renderpass(const vk::RenderPass& renderpass, const vk::Framebuffer& framebuffer, vk::Extent2D swapchain_extent, vk::SubpassContents subpass_contents) const;
 	void bind_pipeline(const vk::Pipeline& pipeline) const;
 	void set_viewport(u32 width, u32 height) const;
@@ -0,0 +1,73 @@
+#include "CommandPoolRing.hpp"
+#include "Profiler.hpp"
+
+void CommandPoolRing::init(vk::Device device, u32 queue_family, u32 num_frames, u32 num_threads)
+{
+    m_device = device;
+    m_num_threads = num_threads;
+
+    // nothing recorded in these outlives its frame, and without the reset buffer flag the driver
+    // doesn't have to track every buffer separately
+    vk::CommandPoolCreateInfo pool_info{};
+    pool_info.sType = vk::StructureType::eCommandPoolCreateInfo;
+    pool_info.flags = vk::CommandPoolCreateFlagBits::eTransient;
+    pool_info.queueFamilyIndex = queue_family;
+
+    m_pools.resize(num_frames * num_threads);
+    for(auto& pool : m_pools)
+    {
+        if(m_device.createCommandPool(&pool_info, nullptr, &pool.vk_command_pool) != vk::Result::eSuccess)
+        {
+            throw std::runtime_error("failed to create frame command pool!");
+        }
+    }
+}
+
+void CommandPoolRing::destroy()
+{
+    // destroying a pool frees everything allocated from it
+    for(auto& pool : m_pools)
+    {
+        m_device.destroyCommandPool(pool.vk_command_pool, nullptr);
+    }
+    m_pools.clear();
+}
+
+void CommandPoolRing::reset(u32 frame)
+{
+    PROFILE_FUNCTION();
+
+    for(u32 thread = 0; thread < m_num_threads; ++thread)
+    {
+        Pool& pool = m_pools[frame * m_num_threads + thread];
+        m_device.resetCommandPool(pool.vk_command_pool);
+        pool.num_primaries = 0;
+        pool.num_secondaries = 0;
+    }
+}
+
+CommandBuffer& CommandPoolRing::get_command_buffer(u32 frame, u32 thread, vk::CommandBufferLevel level)
+{
+    Pool& pool = m_pools[frame * m_num_threads + thread];
+
+    bool primary = level == vk::CommandBufferLevel::ePrimary;
+    std::deque<CommandBuffer>& buffers = primary ? pool.primaries : pool.secondaries;
+    u32& num_used = primary ? pool.num_primaries : pool.num_secondaries;
+
+    if(num_used == buffers.size())
+    {
+        vk::CommandBufferAllocateInfo alloc_info{};
+        alloc_info.sType = vk::StructureType::eCommandBufferAllocateInfo;
+        alloc_info.commandPool = pool.vk_command_pool;
+        alloc_info.level = level;
+        alloc_info.commandBufferCount = 1;
+
+        CommandBuffer& command_buffer = buffers.emplace_back();
+        if(m_device.allocateCommandBuffers(&alloc_info, &command_buffer.vk_command_buffer) != vk::Result::eSuccess)
+        {
+            throw std::runtime_error("failed to allocate frame command buffer!");
+        }
+    }
+
+    return buffers[num_used++];
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "config.hpp"
+#include "CommandBuffer.hpp"
+
+#include <deque>
+
+// transient command pools for everything recorded during a frame, one per thread for every frame in flight
+// buffers are handed out in order and a frame slot's pools are reset in one go once its fence has signalled,
+// so nothing is ever reset or freed on its own and a pool is only ever used by one thread at a time
+class CommandPoolRing
+{
+public:
+    void init(vk::Device device, u32 queue_family, u32 num_frames, u32 num_threads);
+    void destroy();
+
+    // the slot's fence has to have signalled, every buffer handed out for the slot before is invalid afterwards
+    void reset(u32 frame);
+
+    // only the thread the pool belongs to, or whoever records on its behalf while it isn't, may call this
+    // buffers stay where they are until the slot is reset, so the reference can be held for the whole frame
+    CommandBuffer& get_command_buffer(u32 frame, u32 thread, vk::CommandBufferLevel level = vk::CommandBufferLevel::eSecondary);
+
+    [[nodiscard]] u32 get_num_threads() const { return m_num_threads; }
+
+private:
+    struct Pool
+    {
+        vk::CommandPool vk_command_pool;
+
+        // allocated the first time a frame asks for that many, then reused after every reset
+        // a deque so handing out more never moves the ones already handed out
+        std::deque<CommandBuffer> primaries;
+        std::deque<CommandBuffer> secondaries;
+        u32 num_primaries = 0;
+        u32 num_secondaries = 0;
+    };
+
+    vk::Device m_device;
+    u32 m_num_threads = 0;
+
+    // frame slot major, the pool of a thread in a slot is at frame * num_threads + thread
+    std::vector<Pool> m_pools;
+};
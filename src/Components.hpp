@@ -2,24 +2,52 @@
 #include "GPUResources.hpp"
 #include <glm/mat4x4.hpp>
 
+#include <memory>
+
+struct AABB
+{
+    glm::vec3       min{0.f};
+    glm::vec3       max{0.f};
+};
+
+struct BoundingSphere
+{
+    glm::vec3       center{0.f};
+    f32             radius = 0.f;
+};
+
+// geometry is sub-allocated out of the renderer's geometry arena, a mesh only remembers where its range lives
 struct Mesh
 {
-    u32             vertex_buffer;
-    u32             index_buffer;
+    u32             geometry_block = 0;
+    u32             vertex_offset = 0;
+    u32             vertex_count = 0;
+    u32             first_index = 0;
     u32             index_count = 0;
+
+    // object space, computed by the loader when the mesh is imported
+    AABB            aabb;
+    BoundingSphere  sphere;
 };
 
 struct Material
 {
-    u32 descriptor_set;
-    u32 textures[4];
-    u32 sampler;
+    DescriptorSetHandle descriptor_set;
+    TextureHandle textures[4];
+    SamplerHandle sampler;
 };
 
-struct Model
+// everything loaded from one source file, shared by every model placed from it
+struct ModelAsset
 {
     std::vector<Mesh>           meshes;
     std::vector<Material>       materials;
     std::vector<glm::mat4>      transforms;
+};
+
+// an instance of an asset in the scene, the asset is reference counted by ModelCache
+struct Model
+{
+    std::shared_ptr<const ModelAsset> asset;
     glm::mat4       transform{1.f};
 };
\ No newline at end of file
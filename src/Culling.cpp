@@ -0,0 +1,171 @@
+#include "Culling.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define CULLING_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace culling
+{
+    void compute_bounds(const Vertex* vertices, u32 vertex_count, AABB& aabb, BoundingSphere& sphere)
+    {
+        if(vertex_count == 0)
+        {
+            aabb = {};
+            sphere = {};
+            return;
+        }
+
+        aabb.min = vertices[0].position;
+        aabb.max = vertices[0].position;
+        for(u32 i = 1; i < vertex_count; ++i)
+        {
+            aabb.min = glm::min(aabb.min, vertices[i].position);
+            aabb.max = glm::max(aabb.max, vertices[i].position);
+        }
+
+        // tighter than half the box's diagonal for anything that isn't box shaped
+        sphere.center = (aabb.min + aabb.max) * 0.5f;
+        f32 radius_squared = 0.f;
+        for(u32 i = 0; i < vertex_count; ++i)
+        {
+            glm::vec3 offset = vertices[i].position - sphere.center;
+            radius_squared = std::max(radius_squared, glm::dot(offset, offset));
+        }
+        sphere.radius = std::sqrt(radius_squared);
+    }
+
+    Frustum extract_frustum(const glm::mat4& view_projection)
+    {
+        // glm is column major, so the rows of the matrix are gathered across the columns
+        auto row = [&](int i) { return glm::vec4(view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]); };
+
+        Frustum frustum{};
+        frustum.planes[0] = row(3) + row(0);
+        frustum.planes[1] = row(3) - row(0);
+        frustum.planes[2] = row(3) + row(1);
+        frustum.planes[3] = row(3) - row(1);
+        frustum.planes[4] = row(2);
+        frustum.planes[5] = row(3) - row(2);
+
+        for(glm::vec4& plane : frustum.planes)
+        {
+            plane /= glm::length(glm::vec3(plane));
+        }
+
+        return frustum;
+    }
+
+    Containment test_box(const Frustum& frustum, const AABB& box, u32& plane_mask)
+    {
+        glm::vec3 center = (box.min + box.max) * 0.5f;
+        glm::vec3 extents = (box.max - box.min) * 0.5f;
+
+        for(u32 i = 0; i < 6; ++i)
+        {
+            if(!(plane_mask & (1u << i)))
+            {
+                continue;
+            }
+
+            const glm::vec4& plane = frustum.planes[i];
+            f32 distance = glm::dot(glm::vec3(plane), center) + plane.w;
+            f32 radius = glm::dot(glm::abs(glm::vec3(plane)), extents);
+
+            if(distance + radius < 0.f)
+            {
+                return Containment::Outside;
+            }
+
+            if(distance - radius >= 0.f)
+            {
+                plane_mask &= ~(1u << i);
+            }
+        }
+
+        return plane_mask == 0 ? Containment::Inside : Containment::Intersecting;
+    }
+
+    AABB transform_aabb(const AABB& box, const glm::mat4& transform)
+    {
+        glm::vec3 local_center = (box.min + box.max) * 0.5f;
+        glm::vec3 local_extents = (box.max - box.min) * 0.5f;
+
+        glm::vec3 center = glm::vec3(transform * glm::vec4(local_center, 1.f));
+        glm::vec3 extents = glm::abs(glm::vec3(transform[0])) * local_extents.x +
+                            glm::abs(glm::vec3(transform[1])) * local_extents.y +
+                            glm::abs(glm::vec3(transform[2])) * local_extents.z;
+
+        return { center - extents, center + extents };
+    }
+
+    u32 test_box_instances(const Frustum& frustum, const AABB& box, const glm::mat4* transforms, u32 count)
+    {
+        glm::vec3 local_center = (box.min + box.max) * 0.5f;
+        glm::vec3 local_extents = (box.max - box.min) * 0.5f;
+
+        // world space boxes as centre and half extents, one lane per instance
+        // unused lanes repeat the first instance and are masked off at the end
+        alignas(16) f32 center_x[4], center_y[4], center_z[4];
+        alignas(16) f32 extent_x[4], extent_y[4], extent_z[4];
+        for(u32 i = 0; i < 4; ++i)
+        {
+            const glm::mat4& transform = transforms[i < count ? i : 0];
+            glm::vec3 center = glm::vec3(transform * glm::vec4(local_center, 1.f));
+
+            // each world axis picks up the absolute contribution of every local axis
+            glm::vec3 extents = glm::abs(glm::vec3(transform[0])) * local_extents.x +
+                                glm::abs(glm::vec3(transform[1])) * local_extents.y +
+                                glm::abs(glm::vec3(transform[2])) * local_extents.z;
+
+            center_x[i] = center.x;
+            center_y[i] = center.y;
+            center_z[i] = center.z;
+            extent_x[i] = extents.x;
+            extent_y[i] = extents.y;
+            extent_z[i] = extents.z;
+        }
+
+        // a box is outside when it is fully behind any one plane
+        u32 outside = 0;
+#ifdef CULLING_SSE
+        __m128 cx = _mm_load_ps(center_x);
+        __m128 cy = _mm_load_ps(center_y);
+        __m128 cz = _mm_load_ps(center_z);
+        __m128 ex = _mm_load_ps(extent_x);
+        __m128 ey = _mm_load_ps(extent_y);
+        __m128 ez = _mm_load_ps(extent_z);
+
+        __m128 outside_lanes = _mm_setzero_ps();
+        for(const glm::vec4& plane : frustum.planes)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+                                         _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(std::abs(plane.x))), _mm_mul_ps(ey, _mm_set1_ps(std::abs(plane.y)))),
+                                       _mm_mul_ps(ez, _mm_set1_ps(std::abs(plane.z))));
+
+            outside_lanes = _mm_or_ps(outside_lanes, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+        }
+        outside = static_cast<u32>(_mm_movemask_ps(outside_lanes));
+#else
+        for(u32 i = 0; i < 4; ++i)
+        {
+            for(const glm::vec4& plane : frustum.planes)
+            {
+                f32 distance = center_x[i] * plane.x + center_y[i] * plane.y + center_z[i] * plane.z + plane.w;
+                f32 radius = extent_x[i] * std::abs(plane.x) + extent_y[i] * std::abs(plane.y) + extent_z[i] * std::abs(plane.z);
+                if(distance + radius < 0.f)
+                {
+                    outside |= 1u << i;
+                    break;
+                }
+            }
+        }
+#endif
+
+        return ~outside & ((1u << count) - 1);
+    }
+}
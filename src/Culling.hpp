@@ -0,0 +1,40 @@
+#pragma once
+
+#include "config.hpp"
+#include "Components.hpp"
+#include "Vertex.hpp"
+
+// view frustum culling on the CPU
+// bounds are computed once at import, every frame the instances' world space boxes are tested four at a time
+namespace culling
+{
+    // planes point inwards, a point p is inside when dot(plane.xyz, p) + plane.w >= 0
+    struct Frustum
+    {
+        glm::vec4 planes[6];
+    };
+
+    // the box around the vertices and a sphere around the box's centre that still touches the furthest vertex
+    void compute_bounds(const Vertex* vertices, u32 vertex_count, AABB& aabb, BoundingSphere& sphere);
+
+    // left, right, bottom, top, near and far planes of a projection * view matrix with a zero to one depth range
+    Frustum extract_frustum(const glm::mat4& view_projection);
+
+    enum class Containment
+    {
+        Outside,
+        Intersecting,
+        Inside
+    };
+
+    // plane_mask has a bit for every plane that still needs testing
+    // planes the box is completely in front of are cleared, so the children of a box never test them again
+    Containment test_box(const Frustum& frustum, const AABB& box, u32& plane_mask);
+
+    // world space box around a transformed object space box
+    AABB transform_aabb(const AABB& box, const glm::mat4& transform);
+
+    // tests the same object space box under up to four transforms
+    // bit i of the result is set when transforms[i] puts the box at least partly inside the frustum
+    u32 test_box_instances(const Frustum& frustum, const AABB& box, const glm::mat4* transforms, u32 count);
+}
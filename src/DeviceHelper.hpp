@@ -26,8 +26,15 @@ const std::vector<const char *> g_device_extensions =
         VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME // for bindless resources
 };
 
+// without a surface we never present, so the swapchain extension isn't needed
+const std::vector<const char *> g_headless_device_extensions =
+{
+        VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME
+};
+
 namespace DeviceHelper
 {
+    // surface can be null when rendering headless, in that case the graphics family stands in for present
     static QueueFamilyIndices find_queue_families(vk::PhysicalDevice device, vk::SurfaceKHR surface)
     {
         QueueFamilyIndices indices;
@@ -54,7 +61,11 @@ namespace DeviceHelper
             // it is very likely that these will be the same family
             // can add logic to prefer queue families that contain both
             vk::Bool32 present_support = false;
-            if(device.getSurfaceSupportKHR(i, surface, &present_support) != vk::Result::eSuccess)
+            if(!surface)
+            {
+                present_support = indices.graphics_family.has_value() && indices.graphics_family.value() == i;
+            }
+            else if(device.getSurfaceSupportKHR(i, surface, &present_support) != vk::Result::eSuccess)
             {
                 throw std::runtime_error("Could not retrieve surface support details !");
             }
@@ -69,10 +80,16 @@ namespace DeviceHelper
             ++i;
         }
 
+        // some devices (software rasterizers especially) only expose a single family that does everything
+        if(!indices.transfer_family.has_value())
+        {
+            indices.transfer_family = indices.graphics_family;
+        }
+
         return indices;
     }
 
-    static bool check_device_extension_support(vk::PhysicalDevice device)
+    static bool check_device_extension_support(vk::PhysicalDevice device, const std::vector<const char*>& extensions)
     {
         unsigned extension_count = 0;
         vk::Result result = device.enumerateDeviceExtensionProperties(nullptr, &extension_count, nullptr);
@@ -80,7 +97,7 @@ namespace DeviceHelper
         std::vector<vk::ExtensionProperties> available_extensions(extension_count);
         result = device.enumerateDeviceExtensionProperties(nullptr, &extension_count, available_extensions.data());
 
-        std::set<std::string> required_extensions(g_device_extensions.begin(), g_device_extensions.end());
+        std::set<std::string> required_extensions(extensions.begin(), extensions.end());
 
         for(const auto& extension : available_extensions)
         {
@@ -90,7 +107,7 @@ namespace DeviceHelper
         return required_extensions.empty();
     }
 
-    bool is_device_suitable(vk::PhysicalDevice device)
+    bool is_device_suitable(vk::PhysicalDevice device, const std::vector<const char*>& extensions)
     {
         vk::PhysicalDeviceDescriptorIndexingFeatures indexing_features;
         indexing_features.sType = vk::StructureType::ePhysicalDeviceDescriptorIndexingFeaturesEXT;
@@ -100,7 +117,7 @@ namespace DeviceHelper
         physical_device_features2.pNext = &indexing_features;
         device.getFeatures2(&physical_device_features2);
 
-        return indexing_features.descriptorBindingPartiallyBound && indexing_features.runtimeDescriptorArray && check_device_extension_support(device);
+        return indexing_features.descriptorBindingPartiallyBound && indexing_features.runtimeDescriptorArray && check_device_extension_support(device, extensions);
     }
 
     static int rate_device_suitability(vk::PhysicalDevice device)
@@ -130,7 +147,7 @@ namespace DeviceHelper
         return score;
     }
 
-    vk::PhysicalDevice pick_physical_device(const vk::Instance& instance)
+    vk::PhysicalDevice pick_physical_device(const vk::Instance& instance, const std::vector<const char*>& extensions)
     {
         unsigned device_count = 0;
         vk::Result result = instance.enumeratePhysicalDevices(&device_count, nullptr);
@@ -148,7 +165,7 @@ namespace DeviceHelper
 
         for (const auto& device: devices)
         {
-            if (is_device_suitable(device))
+            if (is_device_suitable(device, extensions))
             {
                 int score = rate_device_suitability(device);
                 candidates.insert(std::make_pair(score, device));
@@ -1,5 +1,6 @@
 #pragma once
 #include "config.hpp"
+#include "Memory.hpp"
 
 #include <vk_mem_alloc.h>
 
@@ -27,7 +28,7 @@ struct Texture
     u16                             depth = 1;
     u8                              mipmaps = 1;
 
-    const char*                     name;
+    std::string                     name;
 };
 
 struct Sampler
@@ -53,11 +54,17 @@ struct DescriptorSet
     u32                             num_resources;
 };
 
+typedef Handle<Buffer>          BufferHandle;
+typedef Handle<Texture>         TextureHandle;
+typedef Handle<Sampler>         SamplerHandle;
+typedef Handle<DescriptorSet>   DescriptorSetHandle;
+
 struct BufferCreationInfo
 {
     vk::BufferUsageFlags            usage;
     u32                             size;
     bool                            persistent = false;
+    bool                            device_local = false;   // for static data like geometry, written once at creation
     void*                           data;
 };
 
@@ -95,10 +102,11 @@ struct DescriptorSetLayoutCreationInfo
 };
 
 // FIXME: naughty magic numbers
+// resources can be buffers or textures depending on the type, so they are stored as raw handle values
 struct DescriptorSetCreationInfo
 {
     u32                             resource_handles[8]{};
-    u32                             sampler_handles[8]{};
+    SamplerHandle                   sampler_handles[8]{};
     u16                             bindings[8]{};
     vk::DescriptorType              types[8]{};
 
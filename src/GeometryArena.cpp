@@ -0,0 +1,181 @@
+#include "GeometryArena.hpp"
+#include "Renderer.hpp"
+#include "Vertex.hpp"
+
+RangeAllocator::RangeAllocator(u32 size) :
+    m_size(size),
+    m_free(size)
+{
+    if(size > 0)
+    {
+        m_free_ranges[0] = size;
+    }
+}
+
+bool RangeAllocator::allocate(u32 count, u32& offset)
+{
+    // nothing to place, so it fits anywhere and never needs a free range
+    if(count == 0)
+    {
+        offset = 0;
+        return true;
+    }
+
+    for(auto it = m_free_ranges.begin(); it != m_free_ranges.end(); ++it)
+    {
+        if(it->second < count)
+        {
+            continue;
+        }
+
+        offset = it->first;
+        u32 remaining = it->second - count;
+        m_free_ranges.erase(it);
+
+        if(remaining > 0)
+        {
+            m_free_ranges[offset + count] = remaining;
+        }
+
+        m_free -= count;
+        return true;
+    }
+
+    return false;
+}
+
+void RangeAllocator::free(u32 offset, u32 count)
+{
+    if(count == 0)
+    {
+        return;
+    }
+
+    m_free += count;
+    auto next = m_free_ranges.lower_bound(offset);
+
+    // merge with the range right after
+    if(next != m_free_ranges.end() && offset + count == next->first)
+    {
+        count += next->second;
+        next = m_free_ranges.erase(next);
+    }
+
+    // and the range right before
+    if(next != m_free_ranges.begin())
+    {
+        auto previous = std::prev(next);
+        if(previous->first + previous->second == offset)
+        {
+            previous->second += count;
+            return;
+        }
+    }
+
+    m_free_ranges[offset] = count;
+}
+
+void GeometryArena::init(Renderer* renderer)
+{
+    m_renderer = renderer;
+}
+
+void GeometryArena::destroy()
+{
+    for(u32 i = 0; i < m_num_blocks; ++i)
+    {
+        m_renderer->destroy_buffer(m_blocks[i].vertex_buffer);
+        m_renderer->destroy_buffer(m_blocks[i].index_buffer);
+    }
+
+    m_num_blocks = 0;
+}
+
+GeometryAllocation GeometryArena::allocate(u32 vertex_count, u32 index_count)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    GeometryAllocation allocation;
+
+    // an empty mesh takes no space, it shouldn't make a new block just because the existing ones are full
+    if(vertex_count == 0 && index_count == 0)
+    {
+        return allocation;
+    }
+
+    for(u32 i = 0; i < m_num_blocks; ++i)
+    {
+        GeometryBlock& block = m_blocks[i];
+        if(block.vertices.get_free() < vertex_count || block.indices.get_free() < index_count)
+        {
+            continue;
+        }
+
+        if(!block.vertices.allocate(vertex_count, allocation.vertex_offset))
+        {
+            continue;
+        }
+
+        // both halves have to fit in the same block since a draw only has one set of buffers bound
+        if(!block.indices.allocate(index_count, allocation.first_index))
+        {
+            block.vertices.free(allocation.vertex_offset, vertex_count);
+            continue;
+        }
+
+        allocation.block = i;
+        return allocation;
+    }
+
+    allocation.block = create_block(std::max(vertex_count, k_vertices_per_block), std::max(index_count, k_indices_per_block));
+    m_blocks[allocation.block].vertices.allocate(vertex_count, allocation.vertex_offset);
+    m_blocks[allocation.block].indices.allocate(index_count, allocation.first_index);
+
+    return allocation;
+}
+
+void GeometryArena::free(const GeometryAllocation& allocation, u32 vertex_count, u32 index_count)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_blocks[allocation.block].vertices.free(allocation.vertex_offset, vertex_count);
+    m_blocks[allocation.block].indices.free(allocation.first_index, index_count);
+}
+
+u32 GeometryArena::create_block(u32 num_vertices, u32 num_indices)
+{
+    u32 index = m_num_blocks.load(std::memory_order_relaxed);
+    if(index == k_max_blocks)
+    {
+        throw std::runtime_error("ran out of geometry blocks!");
+    }
+
+    GeometryBlock& block = m_blocks[index];
+
+    // persistent so the arena can be written in place when the buffers end up in resizable BAR memory
+    block.vertex_buffer = m_renderer->create_buffer({
+        .usage = vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst,
+        .size = (u32)(num_vertices * sizeof(Vertex)),
+        .persistent = true,
+        .device_local = true,
+        .data = nullptr
+    });
+
+    block.index_buffer = m_renderer->create_buffer({
+        .usage = vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst,
+        .size = (u32)(num_indices * sizeof(u32)),
+        .persistent = true,
+        .device_local = true,
+        .data = nullptr
+    });
+
+    block.vk_vertex_buffer = m_renderer->get_buffer(block.vertex_buffer)->vk_buffer;
+    block.vk_index_buffer = m_renderer->get_buffer(block.index_buffer)->vk_buffer;
+    block.vertices = RangeAllocator(num_vertices);
+    block.indices = RangeAllocator(num_indices);
+
+    // only published once it is fully set up
+    m_num_blocks.store(index + 1, std::memory_order_release);
+
+    return index;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "config.hpp"
+#include "GPUResources.hpp"
+
+#include <array>
+#include <atomic>
+#include <mutex>
+
+class Renderer;
+
+// first fit free list over a range of elements, neighbouring free ranges are merged again when freed
+class RangeAllocator
+{
+public:
+    explicit RangeAllocator(u32 size = 0);
+
+    bool allocate(u32 count, u32& offset);
+    void free(u32 offset, u32 count);
+
+    [[nodiscard]] u32 get_size() const { return m_size; }
+    [[nodiscard]] u32 get_free() const { return m_free; }
+
+private:
+    // offset -> count, ordered so neighbours are easy to find
+    std::map<u32, u32> m_free_ranges;
+    u32 m_size;
+    u32 m_free;
+};
+
+// one large vertex buffer and index buffer, meshes are sub-allocated out of it
+struct GeometryBlock
+{
+    BufferHandle vertex_buffer;
+    BufferHandle index_buffer;
+
+    // cached so drawing doesn't go through the buffer pool
+    vk::Buffer vk_vertex_buffer;
+    vk::Buffer vk_index_buffer;
+
+    RangeAllocator vertices;
+    RangeAllocator indices;
+};
+
+struct GeometryAllocation
+{
+    u32 block = 0;
+    u32 vertex_offset = 0;
+    u32 first_index = 0;
+};
+
+// all mesh geometry lives in a handful of blocks, so draws only rebind buffers when the block changes
+// a new block is created once the existing ones are full, meshes bigger than a block get a block of their own
+class GeometryArena
+{
+public:
+    void init(Renderer* renderer);
+    void destroy();
+
+    // safe to call from any thread, empty requests get a zeroed allocation without touching any block
+    GeometryAllocation allocate(u32 vertex_count, u32 index_count);
+    void free(const GeometryAllocation& allocation, u32 vertex_count, u32 index_count);
+
+    // blocks never move once created so this can be read while loaders are allocating
+    [[nodiscard]] const GeometryBlock& get_block(u32 block) const { return m_blocks[block]; }
+    [[nodiscard]] u32 get_num_blocks() const { return m_num_blocks.load(std::memory_order_acquire); }
+
+    static constexpr u32 k_vertices_per_block = 1 << 20;
+    static constexpr u32 k_indices_per_block = 1 << 22;
+    static constexpr u32 k_max_blocks = 64;
+
+private:
+    Renderer* m_renderer = nullptr;
+
+    std::mutex m_mutex;
+    std::array<GeometryBlock, k_max_blocks> m_blocks;
+    std::atomic<u32> m_num_blocks = 0;
+
+    u32 create_block(u32 num_vertices, u32 num_indices);
+};
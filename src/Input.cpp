@@ -5,23 +5,32 @@ GLFWwindow* Input::m_window_handle = nullptr;
 
 bool Input::is_key_pressed(int key_code)
 {
+	// there is no window to poll when running headless
+	if(!m_window_handle) return false;
+
 	auto state = glfwGetKey(m_window_handle, key_code);
 	return (state == GLFW_PRESS) || (state == GLFW_REPEAT);
 }
 
 bool Input::is_button_pressed(int button_code)
 {
+	if(!m_window_handle) return false;
+
 	auto state = glfwGetMouseButton(m_window_handle, button_code);
 	return (state == GLFW_PRESS) || (state == GLFW_REPEAT);
 }
 
 void Input::set_mouse_pos(int x, int y)
 {
+	if(!m_window_handle) return;
+
 	glfwSetCursorPos(m_window_handle, x, y);
 }
 
 std::pair<float, float> Input::get_mouse_pos()
 {
+	if(!m_window_handle) return { 0.f, 0.f };
+
 	double xPos, yPos;
 	glfwGetCursorPos(m_window_handle, &xPos, &yPos);
 
@@ -30,6 +39,8 @@ std::pair<float, float> Input::get_mouse_pos()
 
 void Input::show_cursor(bool show)
 {
+	if(!m_window_handle) return;
+
 	if(show)
     {
         glfwSetInputMode(m_window_handle, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// the parts of the KTX2 container the engine and the texture converter need
+// only non-supercompressed 2D textures with a single layer and face are written or read
+// https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html
+namespace ktx2
+{
+    static const uint8_t k_identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+    // VkFormat values, the converter doesn't pull in the vulkan headers
+    static const uint32_t k_format_bc1_rgb_unorm = 131;
+    static const uint32_t k_format_bc1_rgb_srgb = 132;
+    static const uint32_t k_format_bc5_unorm = 141;
+    static const uint32_t k_format_bc7_unorm = 145;
+    static const uint32_t k_format_bc7_srgb = 146;
+
+    // data format descriptor values from the khronos data format spec
+    static const uint8_t k_df_model_bc1a = 128;
+    static const uint8_t k_df_model_bc5 = 132;
+    static const uint8_t k_df_model_bc7 = 134;
+    static const uint8_t k_df_primaries_bt709 = 1;
+    static const uint8_t k_df_transfer_linear = 1;
+    static const uint8_t k_df_transfer_srgb = 2;
+
+    struct Header
+    {
+        uint8_t identifier[12];
+        uint32_t vk_format;
+        uint32_t type_size;
+        uint32_t pixel_width;
+        uint32_t pixel_height;
+        uint32_t pixel_depth;
+        uint32_t layer_count;
+        uint32_t face_count;
+        uint32_t level_count;
+        uint32_t supercompression_scheme;
+
+        // index
+        uint32_t dfd_byte_offset;
+        uint32_t dfd_byte_length;
+        uint32_t kvd_byte_offset;
+        uint32_t kvd_byte_length;
+        uint64_t sgd_byte_offset;
+        uint64_t sgd_byte_length;
+    };
+
+    static_assert(sizeof(Header) == 80, "KTX2 header has to match the file layout");
+
+    // one per mip level straight after the header, level 0 first
+    // the data itself is stored smallest level first
+    struct LevelIndex
+    {
+        uint64_t byte_offset;
+        uint64_t byte_length;
+        uint64_t uncompressed_byte_length;
+    };
+
+    // 4x4 blocks, 8 bytes for BC1 and 16 for BC5/BC7
+    inline uint32_t get_block_size(uint32_t vk_format)
+    {
+        switch(vk_format)
+        {
+            case k_format_bc1_rgb_unorm:
+            case k_format_bc1_rgb_srgb:
+                return 8;
+            case k_format_bc5_unorm:
+            case k_format_bc7_unorm:
+            case k_format_bc7_srgb:
+                return 16;
+            default:
+                return 0;
+        }
+    }
+
+    inline bool check_identifier(const Header& header)
+    {
+        return memcmp(header.identifier, k_identifier, sizeof(k_identifier)) == 0;
+    }
+}
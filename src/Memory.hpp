@@ -1,43 +1,264 @@
 #pragma once
 #include "config.hpp"
 
-struct Chunk
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <new>
+
+// handles pack a slot index and the generation of that slot
+// freeing a slot bumps its generation so any handle still pointing at it stops being valid
+template<typename T>
+struct Handle
 {
+    static const u32 k_index_bits = 20;
+    static const u32 k_index_mask = (1u << k_index_bits) - 1;
+    static const u32 k_generation_mask = (1u << (32 - k_index_bits)) - 1;
+
+    // generation 0 is never handed out, so a zeroed handle is always invalid
+    u32 value = 0;
+
+    Handle() = default;
+    explicit Handle(u32 _value) : value(_value) {}
+    Handle(u32 index, u32 generation) : value((generation << k_index_bits) | (index & k_index_mask)) {}
+
+    [[nodiscard]] u32 index() const { return value & k_index_mask; }
+    [[nodiscard]] u32 generation() const { return value >> k_index_bits; }
+    [[nodiscard]] bool is_valid() const { return generation() != 0; }
+
+    bool operator==(const Handle& other) const { return value == other.value; }
+    bool operator!=(const Handle& other) const { return value != other.value; }
 };
 
-class PoolAllocator
+// objects live in pages that are never moved, so pointers from access() stay good while the pool grows
+// free slots are linked through the slots themselves, acquire, free and access are all O(1)
+// acquire, free and access are safe to call from any thread, only growing the pool takes a lock
+// handles are typed on Tag, so a pool can hold something other than the thing its handles refer to
+template<typename T, typename Tag = T>
+class ResourcePool
 {
 public:
-    PoolAllocator() = default;
-    ~PoolAllocator();
+    explicit ResourcePool(u32 resources_per_page) :
+        m_resources_per_page(resources_per_page)
+    {
+        if(resources_per_page == 0 || (resources_per_page & (resources_per_page - 1)) != 0)
+        {
+            throw std::invalid_argument("resources per page must be a power of 2!");
+        }
+
+        while((1u << m_page_shift) < resources_per_page)
+        {
+            ++m_page_shift;
+        }
+
+        // the page table is sized up front so readers never see it move
+        m_max_pages = (Handle<Tag>::k_index_mask + 1) / resources_per_page;
+        m_pages = std::make_unique<std::atomic<Slot*>[]>(m_max_pages);
+
+        add_page();
+    }
+
+    ~ResourcePool()
+    {
+        for(u32 i = 0; i < m_num_pages; ++i)
+        {
+            delete[] m_pages[i].load();
+        }
+    }
+
+    ResourcePool(const ResourcePool&) = delete;
+    ResourcePool& operator=(const ResourcePool&) = delete;
+
+    Handle<Tag> acquire()
+    {
+        u64 head = m_free_head.load(std::memory_order_acquire);
+        u32 index;
+
+        while(true)
+        {
+            index = head_index(head);
+            if(index == k_end_of_list)
+            {
+                grow();
+                head = m_free_head.load(std::memory_order_acquire);
+                continue;
+            }
+
+            // the tag changes on every push and pop, so a slot that was popped and pushed back in between fails the exchange
+            u32 next = get_slot(index).next_free.load(std::memory_order_relaxed);
+            if(m_free_head.compare_exchange_weak(head, make_head(head_tag(head) + 1, next), std::memory_order_acquire, std::memory_order_acquire))
+            {
+                break;
+            }
+        }
+
+        Slot& slot = get_slot(index);
+        slot.resource = T{};
+        slot.next_free.store(k_in_use, std::memory_order_release);
+        m_num_used.fetch_add(1, std::memory_order_relaxed);
+
+        return Handle<Tag>(index, slot.generation.load(std::memory_order_relaxed));
+    }
+
+    void free(Handle<Tag> handle)
+    {
+        if(!valid_handle(handle))
+        {
+            return;
+        }
+
+        u32 index = handle.index();
+        Slot& slot = get_slot(index);
+
+        // skip 0 on wrap around so the invalid handle never becomes valid
+        // only one of two racing frees of the same handle gets to bump the generation
+        u32 generation = handle.generation();
+        u32 next_generation = (generation + 1) & Handle<Tag>::k_generation_mask;
+        if(!slot.generation.compare_exchange_strong(generation, next_generation == 0 ? 1 : next_generation, std::memory_order_acq_rel))
+        {
+            return;
+        }
+
+        push_free(index, slot);
+        m_num_used.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    T* access(Handle<Tag> handle)
+    {
+        assert(valid_handle(handle) && "stale or invalid resource handle");
+        return &get_slot(handle.index()).resource;
+    }
+
+    const T* access(Handle<Tag> handle) const
+    {
+        assert(valid_handle(handle) && "stale or invalid resource handle");
+        return &get_slot(handle.index()).resource;
+    }
 
-    void* allocate(u32 num_resources, u32 resource_size);
-    void deallocate(void* ptr);
+    [[nodiscard]] bool valid_handle(Handle<Tag> handle) const
+    {
+        if(!handle.is_valid() || handle.index() >= m_capacity.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        const Slot& slot = get_slot(handle.index());
+        return slot.next_free.load(std::memory_order_acquire) == k_in_use && slot.generation.load(std::memory_order_acquire) == handle.generation();
+    }
+
+    [[nodiscard]] u32 size() const { return m_num_used.load(std::memory_order_relaxed); }
+    [[nodiscard]] u32 capacity() const { return m_capacity.load(std::memory_order_relaxed); }
 
 private:
-    std::vector<void*> m_block_ptrs;
+    static const u32 k_end_of_list = UINT32_MAX;
+    static const u32 k_in_use = UINT32_MAX - 1;
+
+    struct Slot
+    {
+        T resource{};
+        std::atomic<u32> generation = 1;
+        std::atomic<u32> next_free = k_end_of_list;
+    };
+
+    std::unique_ptr<std::atomic<Slot*>[]> m_pages;
+    u32 m_max_pages = 0;
+    u32 m_num_pages = 0;
+    u32 m_resources_per_page;
+    u32 m_page_shift = 0;
+    std::atomic<u32> m_capacity = 0;
+    std::atomic<u32> m_num_used = 0;
+    std::mutex m_grow_mutex;
+
+    // free list head packed as tag << 32 | index, the tag protects against ABA
+    std::atomic<u64> m_free_head = make_head(0, k_end_of_list);
+
+    static u64 make_head(u32 tag, u32 index) { return ((u64)tag << 32) | index; }
+    static u32 head_index(u64 head) { return (u32)head; }
+    static u32 head_tag(u64 head) { return (u32)(head >> 32); }
+
+    Slot& get_slot(u32 index) { return m_pages[index >> m_page_shift].load(std::memory_order_acquire)[index & (m_resources_per_page - 1)]; }
+    const Slot& get_slot(u32 index) const { return m_pages[index >> m_page_shift].load(std::memory_order_acquire)[index & (m_resources_per_page - 1)]; }
+
+    // puts a chain of slots starting at first onto the front of the free list, last_slot gets linked to the old head
+    void push_free(u32 first, Slot& last_slot)
+    {
+        u64 head = m_free_head.load(std::memory_order_relaxed);
+        do
+        {
+            last_slot.next_free.store(head_index(head), std::memory_order_relaxed);
+        }
+        while(!m_free_head.compare_exchange_weak(head, make_head(head_tag(head) + 1, first), std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    void grow()
+    {
+        std::lock_guard<std::mutex> lock(m_grow_mutex);
+
+        // somebody else may have grown the pool or freed a slot while we waited on the lock
+        if(head_index(m_free_head.load(std::memory_order_acquire)) != k_end_of_list)
+        {
+            return;
+        }
+
+        add_page();
+    }
 
+    void add_page()
+    {
+        if(m_num_pages == m_max_pages)
+        {
+            throw std::runtime_error("resource pool is out of handles!");
+        }
+
+        u32 first = m_capacity.load(std::memory_order_relaxed);
+        auto* page = new Slot[m_resources_per_page];
+
+        // link the new slots in index order so handles come out low to high
+        for(u32 i = 0; i + 1 < m_resources_per_page; ++i)
+        {
+            page[i].next_free.store(first + i + 1, std::memory_order_relaxed);
+        }
+
+        m_pages[m_num_pages].store(page, std::memory_order_release);
+        ++m_num_pages;
+        m_capacity.store(first + m_resources_per_page, std::memory_order_release);
+
+        push_free(first, page[m_resources_per_page - 1]);
+    }
 };
 
-class ResourcePool
+// hands out storage starting on a cache line, so the first element of an array never straddles two lines
+template<typename T, std::size_t Alignment = 64>
+struct AlignedAllocator
 {
-public:
-    ResourcePool(PoolAllocator* allocator, u32 num_resources, u32 resource_size);
-    ~ResourcePool();
+    typedef T value_type;
 
-    u32 acquire();
-    void free(u32 handle);
+    template<typename U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
 
-    void* access(u32 handle);
-    bool valid_handle(u32 handle);
+    AlignedAllocator() = default;
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
 
-private:
-    PoolAllocator* m_allocator = nullptr;
-    std::vector<void*> m_resource_chunks;
-    std::list<u32> m_free_indices;
-    u32 m_resources_per_pool;
-    u32 m_resource_size;
-    u32 m_free_index;
-
-    void parse_chunks(void* pool_start);
+    T* allocate(std::size_t count)
+    {
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* data, std::size_t)
+    {
+        ::operator delete(data, std::align_val_t(Alignment));
+    }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template<typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
 };
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
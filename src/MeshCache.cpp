@@ -0,0 +1,305 @@
+#include "MeshCache.hpp"
+#include "Profiler.hpp"
+
+#include <filesystem>
+#include <functional>
+#include <thread>
+
+#ifdef PLATFORM_WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef PLATFORM_WINDOWS
+bool MappedFile::open(const std::string& path)
+{
+    close();
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(!mapping)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    m_data = static_cast<const u8*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if(!m_data)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    m_file = file;
+    m_mapping = mapping;
+    m_size = static_cast<size_t>(file_size.QuadPart);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if(m_data)
+    {
+        UnmapViewOfFile(m_data);
+        CloseHandle(m_mapping);
+        CloseHandle(m_file);
+    }
+
+    m_data = nullptr;
+    m_size = 0;
+}
+#else
+bool MappedFile::open(const std::string& path)
+{
+    close();
+
+    int file = ::open(path.c_str(), O_RDONLY);
+    if(file < 0)
+    {
+        return false;
+    }
+
+    struct stat file_stat{};
+    if(fstat(file, &file_stat) != 0 || file_stat.st_size == 0)
+    {
+        ::close(file);
+        return false;
+    }
+
+    // the mapping keeps its own reference to the file
+    void* data = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    ::close(file);
+
+    if(data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    m_data = static_cast<const u8*>(data);
+    m_size = static_cast<size_t>(file_stat.st_size);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if(m_data)
+    {
+        munmap(const_cast<u8*>(m_data), m_size);
+    }
+
+    m_data = nullptr;
+    m_size = 0;
+}
+#endif
+
+namespace
+{
+    // count elements of element_size bytes starting at offset, all inside the file and aligned so they can be used in place
+    // the sizes come from the file itself, so everything is done in 64 bits and checked against overflow
+    bool is_section_valid(const MappedFile& file, u64 offset, u64 count, u64 element_size)
+    {
+        if(offset > file.size() || (element_size > 1 && offset % 16 != 0))
+        {
+            return false;
+        }
+
+        return count <= (file.size() - offset) / element_size;
+    }
+
+    bool is_record_valid(const MappedFile& file, const mesh_cache::MeshRecord& record)
+    {
+        const mesh_cache::Header& header = mesh_cache::get_header(file);
+        if(u64(record.first_vertex) + record.vertex_count > header.num_vertices || u64(record.first_index) + record.index_count > header.num_indices)
+        {
+            return false;
+        }
+
+        // every texture path has to start inside the string block and end with a terminator before the block does
+        const char* strings = reinterpret_cast<const char*>(file.data() + header.strings_offset);
+        for(u32 texture : record.textures)
+        {
+            if(texture == mesh_cache::k_no_texture)
+            {
+                continue;
+            }
+
+            if(texture >= header.strings_size || !memchr(strings + texture, '\0', header.strings_size - texture))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+}
+
+namespace mesh_cache
+{
+    u64 hash_file(const std::string& path)
+    {
+        PROFILE_FUNCTION();
+
+        MappedFile file;
+        if(!file.open(path))
+        {
+            return 0;
+        }
+
+        u64 hash = 14695981039346656037ull;
+        for(size_t i = 0; i < file.size(); ++i)
+        {
+            hash ^= static_cast<unsigned char>(file.data()[i]);
+            hash *= 1099511628211ull;
+        }
+
+        return hash;
+    }
+
+    bool write(const std::string& path, u64 source_hash, u32 import_flags, const Builder& builder)
+    {
+        PROFILE_FUNCTION();
+
+        std::vector<MeshRecord> meshes = builder.meshes;
+
+        // texture paths are deduplicated, materials share textures all the time
+        std::string strings;
+        std::map<std::string, u32> string_offsets;
+        for(u32 i = 0; i < meshes.size(); ++i)
+        {
+            for(u32 j = 0; j < 4; ++j)
+            {
+                const std::string& texture = builder.textures[i][j];
+                if(texture == "none")
+                {
+                    meshes[i].textures[j] = k_no_texture;
+                    continue;
+                }
+
+                auto [it, inserted] = string_offsets.emplace(texture, static_cast<u32>(strings.size()));
+                if(inserted)
+                {
+                    strings.append(texture);
+                    strings.push_back('\0');
+                }
+                meshes[i].textures[j] = it->second;
+            }
+        }
+
+        Header header{};
+        header.magic = k_magic;
+        header.version = k_version;
+        header.source_hash = source_hash;
+        header.import_flags = import_flags;
+        header.vertex_size = sizeof(Vertex);
+        header.num_meshes = static_cast<u32>(meshes.size());
+        header.num_vertices = static_cast<u32>(builder.vertices.size());
+        header.num_indices = static_cast<u32>(builder.indices.size());
+        header.strings_size = static_cast<u32>(strings.size());
+
+        // every block starts 16 byte aligned so the mapped data can be used in place
+        auto align = [](u64 offset) { return (offset + 15) & ~u64(15); };
+        header.meshes_offset = align(sizeof(Header));
+        header.vertices_offset = align(header.meshes_offset + meshes.size() * sizeof(MeshRecord));
+        header.indices_offset = align(header.vertices_offset + builder.vertices.size() * sizeof(Vertex));
+        header.strings_offset = align(header.indices_offset + builder.indices.size() * sizeof(u32));
+
+        std::vector<u8> data(header.strings_offset + strings.size(), 0);
+        memcpy(data.data(), &header, sizeof(header));
+        memcpy(data.data() + header.meshes_offset, meshes.data(), meshes.size() * sizeof(MeshRecord));
+        memcpy(data.data() + header.vertices_offset, builder.vertices.data(), builder.vertices.size() * sizeof(Vertex));
+        memcpy(data.data() + header.indices_offset, builder.indices.data(), builder.indices.size() * sizeof(u32));
+        memcpy(data.data() + header.strings_offset, strings.data(), strings.size());
+
+        std::string temporary_path = path + ".tmp" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        {
+            std::ofstream file(temporary_path, std::ios::binary);
+            if(!file)
+            {
+                return false;
+            }
+
+            file.write(data.data(), static_cast<std::streamsize>(data.size()));
+            if(!file.good())
+            {
+                return false;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporary_path, path, error);
+        if(error)
+        {
+            std::filesystem::remove(temporary_path, error);
+            return false;
+        }
+
+        return true;
+    }
+
+    bool open(const std::string& path, u64 source_hash, u32 import_flags, MappedFile& file)
+    {
+        PROFILE_FUNCTION();
+
+        if(!file.open(path))
+        {
+            return false;
+        }
+
+        if(file.size() < sizeof(Header))
+        {
+            file.close();
+            return false;
+        }
+
+        // anything stale, truncated or corrupt is ignored and gets rebuilt from the source
+        const Header& header = get_header(file);
+        bool valid = header.magic == k_magic &&
+                     header.version == k_version &&
+                     header.source_hash == source_hash &&
+                     header.import_flags == import_flags &&
+                     header.vertex_size == sizeof(Vertex) &&
+                     is_section_valid(file, header.meshes_offset, header.num_meshes, sizeof(MeshRecord)) &&
+                     is_section_valid(file, header.vertices_offset, header.num_vertices, sizeof(Vertex)) &&
+                     is_section_valid(file, header.indices_offset, header.num_indices, sizeof(u32)) &&
+                     is_section_valid(file, header.strings_offset, header.strings_size, 1) &&
+                     header.strings_offset + header.strings_size == file.size();
+
+        // the records are only read once the sections are known to be inside the file
+        const MeshRecord* meshes = valid ? get_meshes(file) : nullptr;
+        for(u32 i = 0; valid && i < header.num_meshes; ++i)
+        {
+            valid = is_record_valid(file, meshes[i]);
+        }
+
+        if(!valid)
+        {
+            file.close();
+        }
+
+        return valid;
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "config.hpp"
+#include "Vertex.hpp"
+#include "Components.hpp"
+
+#include <array>
+#include <string>
+
+// read only view of a whole file, mapped instead of read so large caches cost nothing until they are touched
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    [[nodiscard]] const u8* data() const { return m_data; }
+    [[nodiscard]] size_t size() const { return m_size; }
+    [[nodiscard]] bool is_open() const { return m_data != nullptr; }
+
+private:
+    const u8* m_data = nullptr;
+    size_t m_size = 0;
+
+#ifdef PLATFORM_WINDOWS
+    void* m_file = nullptr;
+    void* m_mapping = nullptr;
+#endif
+};
+
+// binary cache of an imported model, written next to the source file on the first load
+// the layout is a header, the mesh records, all vertices, all indices and finally the texture path strings
+// everything is stored exactly as the loader uses it, so a warm load is a mapping plus the GPU uploads
+namespace mesh_cache
+{
+    // bump whenever the layout, Vertex or the import post processing changes
+    static const u32 k_magic = 0x4D435456; // "VTCM"
+    static const u32 k_version = 2;
+    static const u32 k_no_texture = UINT32_MAX;
+
+    struct Header
+    {
+        u32 magic;
+        u32 version;
+        u64 source_hash;
+        u32 import_flags;
+        u32 vertex_size;
+
+        u32 num_meshes;
+        u32 num_vertices;
+        u32 num_indices;
+        u32 strings_size;
+
+        u64 meshes_offset;
+        u64 vertices_offset;
+        u64 indices_offset;
+        u64 strings_offset;
+    };
+
+    struct MeshRecord
+    {
+        glm::mat4 transform;
+
+        u32 first_vertex;
+        u32 vertex_count;
+        u32 first_index;
+        u32 index_count;
+
+        // offsets into the string block, k_no_texture for unused slots
+        u32 textures[4];
+
+        AABB aabb;
+        BoundingSphere sphere;
+    };
+
+    // what the loader collects while importing with assimp
+    struct Builder
+    {
+        std::vector<Vertex> vertices;
+        std::vector<u32> indices;
+        std::vector<MeshRecord> meshes;
+        std::vector<std::array<std::string, 4>> textures;
+    };
+
+    // 64 bit FNV-1a over the source file's bytes
+    u64 hash_file(const std::string& path);
+
+    // writes to a temporary file first and renames it, models that are loaded several times at once race on this
+    bool write(const std::string& path, u64 source_hash, u32 import_flags, const Builder& builder);
+
+    // maps the cache and checks it belongs to this source and these import flags
+    // every section, mesh range and texture string is checked against the file, so the getters below can't read past it
+    bool open(const std::string& path, u64 source_hash, u32 import_flags, MappedFile& file);
+
+    inline const Header& get_header(const MappedFile& file) { return *reinterpret_cast<const Header*>(file.data()); }
+    inline const MeshRecord* get_meshes(const MappedFile& file) { return reinterpret_cast<const MeshRecord*>(file.data() + get_header(file).meshes_offset); }
+    inline const Vertex* get_vertices(const MappedFile& file) { return reinterpret_cast<const Vertex*>(file.data() + get_header(file).vertices_offset); }
+    inline const u32* get_indices(const MappedFile& file) { return reinterpret_cast<const u32*>(file.data() + get_header(file).indices_offset); }
+    inline const char* get_string(const MappedFile& file, u32 offset) { return reinterpret_cast<const char*>(file.data() + get_header(file).strings_offset + offset); }
+}
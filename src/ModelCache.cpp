@@ -0,0 +1,71 @@
+#include "ModelCache.hpp"
+#include "ModelLoader.hpp"
+#include "Profiler.hpp"
+
+ModelCache::ModelCache(Renderer* renderer) :
+    m_renderer(renderer)
+{
+}
+
+std::shared_ptr<const ModelAsset> ModelCache::load(const std::string& path)
+{
+    PROFILE_FUNCTION();
+
+    std::promise<std::shared_ptr<const ModelAsset>> promise;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        Entry& entry = m_entries[path];
+
+        if(std::shared_ptr<const ModelAsset> asset = entry.asset.lock())
+        {
+            return asset;
+        }
+
+        if(entry.loading.valid())
+        {
+            std::shared_future<std::shared_ptr<const ModelAsset>> loading = entry.loading;
+            lock.unlock();
+
+            PROFILE_SCOPE("Wait for shared model");
+            return loading.get();
+        }
+
+        entry.loading = promise.get_future().share();
+    }
+
+    std::shared_ptr<const ModelAsset> asset;
+    try
+    {
+        ModelLoader loader(m_renderer, path.c_str());
+
+        // textures stay in the renderer's texture cache, only the geometry belongs to the asset
+        Renderer* renderer = m_renderer;
+        asset = std::shared_ptr<const ModelAsset>(new ModelAsset(loader.load()), [renderer](const ModelAsset* model)
+        {
+            for(const Mesh& mesh : model->meshes)
+            {
+                renderer->destroy_mesh(mesh);
+            }
+            delete model;
+        });
+    }
+    catch(...)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_entries.erase(path);
+        }
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Entry& entry = m_entries[path];
+        entry.asset = asset;
+        entry.loading = {};
+    }
+    promise.set_value(asset);
+
+    return asset;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "config.hpp"
+#include "Components.hpp"
+
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class Renderer;
+
+// imports each source file once and shares the result between every model that uses it
+// assets are reference counted, their meshes go back to the geometry arena when the last model holding them is gone
+class ModelCache
+{
+public:
+    explicit ModelCache(Renderer* renderer);
+
+    // safe to call from several loading tasks at once, requests for a file that is still loading wait for the first one
+    std::shared_ptr<const ModelAsset> load(const std::string& path);
+
+private:
+    struct Entry
+    {
+        // only valid while the first request is still loading
+        std::shared_future<std::shared_ptr<const ModelAsset>> loading;
+        // weak so the cache itself never keeps an asset alive
+        std::weak_ptr<const ModelAsset> asset;
+    };
+
+    Renderer* m_renderer;
+    std::mutex m_mutex;
+    std::map<std::string, Entry> m_entries;
+};
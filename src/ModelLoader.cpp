@@ -1,23 +1,63 @@
 #include "ModelLoader.hpp"
+#include "Profiler.hpp"
+#include "Culling.hpp"
 
-ModelLoader::ModelLoader(Renderer* renderer, const char* file_path) :
-    m_renderer(renderer),
-    m_scene(m_importer.ReadFile(file_path,
-                               aiProcess_CalcTangentSpace       |
+#include <filesystem>
+
+namespace
+{
+    // part of the mesh cache key, the cached output is only valid for the same post processing
+    const u32 k_import_flags = aiProcess_CalcTangentSpace       |
                                aiProcess_Triangulate            |
                                aiProcess_JoinIdenticalVertices  |
-                               aiProcess_SortByPType))
+                               aiProcess_SortByPType;
+
+    // textures that have been run through the texture converter are used instead of the source image
+    std::string find_texture(const std::string& path)
+    {
+        std::filesystem::path compressed = std::filesystem::path(path).replace_extension(".ktx2");
+        return std::filesystem::exists(compressed) ? compressed.string() : path;
+    }
+}
+
+ModelLoader::ModelLoader(Renderer* renderer, const char* file_path) :
+    m_renderer(renderer),
+    m_scene(nullptr)
 {
     std::string path(file_path);
     m_base_dir = path.substr(0, (path.find_last_of('/') + 1));
 
     if(m_base_dir.empty())
         m_base_dir = path.substr(0, (path.find_last_of('\\') + 1));
+
+    // a cache written by an earlier run skips assimp completely
+    m_cache_path = path + ".meshcache";
+    m_source_hash = mesh_cache::hash_file(path);
+    if(mesh_cache::open(m_cache_path, m_source_hash, k_import_flags, m_cache_file))
+    {
+        return;
+    }
+
+    {
+        PROFILE_SCOPE("Assimp import");
+        m_scene = m_importer.ReadFile(file_path, k_import_flags);
+    }
 }
 
-Model ModelLoader::load()
+ModelAsset ModelLoader::load()
 {
-    Model model;
+    PROFILE_FUNCTION();
+
+    ModelAsset model;
+    if(m_cache_file.is_open())
+    {
+        load_cached(model);
+        load_textures(model);
+        m_renderer->flush_uploads();
+
+        return model;
+    }
+
     aiNode* root = m_scene->mRootNode;
     aiMatrix4x4 root_transform = root->mTransformation;
 
@@ -40,10 +80,72 @@ Model ModelLoader::load()
         model.transforms.push_back(aimatrix4x4_to_glmmat4(root_transform));
     }
 
+    load_textures(model);
+
+    // all of this model's textures go to the GPU in one batch
+    m_renderer->flush_uploads();
+
+    write_cache(model);
+
     return model;
 }
 
-void ModelLoader::load_node(aiNode* current_node, aiMatrix4x4 relative_transform, Model& model)
+void ModelLoader::load_cached(ModelAsset& model)
+{
+    PROFILE_FUNCTION();
+
+    const mesh_cache::Header& header = mesh_cache::get_header(m_cache_file);
+    const mesh_cache::MeshRecord* records = mesh_cache::get_meshes(m_cache_file);
+    const Vertex* vertices = mesh_cache::get_vertices(m_cache_file);
+    const u32* indices = mesh_cache::get_indices(m_cache_file);
+
+    for(u32 i = 0; i < header.num_meshes; ++i)
+    {
+        const mesh_cache::MeshRecord& record = records[i];
+        if(record.first_vertex + record.vertex_count > header.num_vertices || record.first_index + record.index_count > header.num_indices)
+        {
+            throw std::runtime_error("corrupt mesh cache!");
+        }
+
+        // uploaded straight out of the mapping
+        Mesh mesh{};
+        m_renderer->create_mesh(vertices + record.first_vertex, record.vertex_count, indices + record.first_index, record.index_count, mesh);
+        mesh.aabb = record.aabb;
+        mesh.sphere = record.sphere;
+
+        model.meshes.push_back(mesh);
+        model.materials.push_back({});
+        model.transforms.push_back(record.transform);
+
+        std::array<std::string, 4>& textures = m_material_textures.emplace_back();
+        for(u32 j = 0; j < 4; ++j)
+        {
+            textures[j] = (record.textures[j] == mesh_cache::k_no_texture) ? "none" : mesh_cache::get_string(m_cache_file, record.textures[j]);
+        }
+    }
+}
+
+void ModelLoader::write_cache(const ModelAsset& model)
+{
+    if(m_source_hash == 0)
+    {
+        return;
+    }
+
+    // meshes, transforms and materials were all pushed in the same order
+    for(u32 i = 0; i < m_cache_builder.meshes.size(); ++i)
+    {
+        m_cache_builder.meshes[i].transform = model.transforms[i];
+    }
+    m_cache_builder.textures = m_material_textures;
+
+    if(!mesh_cache::write(m_cache_path, m_source_hash, k_import_flags, m_cache_builder))
+    {
+        std::cout << "failed to write mesh cache " << m_cache_path << "\n";
+    }
+}
+
+void ModelLoader::load_node(aiNode* current_node, aiMatrix4x4 relative_transform, ModelAsset& model)
 {
     relative_transform *= current_node->mTransformation;
 
@@ -67,50 +169,43 @@ void ModelLoader::load_node(aiNode* current_node, aiMatrix4x4 relative_transform
 
 void ModelLoader::load_mesh(u32 mesh_index, Mesh& mesh)
 {
+    PROFILE_FUNCTION();
+
     std::vector<Vertex> vertices = get_vertices(m_scene->mMeshes[mesh_index]);
     std::vector<u32> indices = get_indices(m_scene->mMeshes[mesh_index]);
 
-    mesh.vertex_buffer = m_renderer->create_buffer({
-           .usage = vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst,
-           .size = (u32)(sizeof(vertices[0]) * vertices.size()),
-           .data = vertices.data()
-   });
-
-    mesh.index_count = indices.size();
-    mesh.index_buffer = m_renderer->create_buffer({
-          .usage = vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst,
-          .size = (u32)(sizeof(indices[0]) * indices.size()),
-          .data = indices.data()
-    });
+    m_renderer->create_mesh(vertices, indices, mesh);
+    culling::compute_bounds(vertices.data(), static_cast<u32>(vertices.size()), mesh.aabb, mesh.sphere);
+
+    // kept for the mesh cache, the transform is filled in once the whole model is loaded
+    mesh_cache::MeshRecord& record = m_cache_builder.meshes.emplace_back();
+    record.first_vertex = static_cast<u32>(m_cache_builder.vertices.size());
+    record.vertex_count = static_cast<u32>(vertices.size());
+    record.first_index = static_cast<u32>(m_cache_builder.indices.size());
+    record.index_count = static_cast<u32>(indices.size());
+    record.aabb = mesh.aabb;
+    record.sphere = mesh.sphere;
+    m_cache_builder.vertices.insert(m_cache_builder.vertices.end(), vertices.begin(), vertices.end());
+    m_cache_builder.indices.insert(m_cache_builder.indices.end(), indices.begin(), indices.end());
 }
 
 void ModelLoader::load_material(u32 material_index, Material& material)
 {
+    PROFILE_FUNCTION();
+
+    // the textures themselves are loaded for the whole model at once in load_textures
+    std::array<std::string, 4>& textures = m_material_textures.emplace_back();
+
     aiString diffuse_texture_path, specular_texture_path, normal_texture_path, occlusion_texture_path;
     m_scene->mMaterials[material_index]->GetTexture(aiTextureType_DIFFUSE, 0, &diffuse_texture_path);
 
     // don't bother to check other textures if no base colour is found
     if (diffuse_texture_path.length == 0)
     {
-        std::string textures[] = {
-            "../textures/white_on_white.jpeg",
-            "none",
-            "none",
-            "none"
-        };
-
-        material.textures[0] = m_renderer->create_texture({
-            .format = vk::Format::eR8G8B8A8Srgb,
-            .image_src = textures[0].c_str()
-        });
-
-        material.textures[1] = m_renderer->get_null_texture_handle();
-        material.textures[2] = m_renderer->get_null_texture_handle();
-        material.textures[3] = m_renderer->get_null_texture_handle();
-
-        // FIXME
-        u32 texture_handles[] = { material.textures[0], m_renderer->get_null_texture_handle(), m_renderer->get_null_texture_handle(), m_renderer->get_null_texture_handle() };
-        m_renderer->update_texture_set(texture_handles, 4);
+        textures[0] = "../textures/white_on_white.jpeg";
+        textures[1] = "none";
+        textures[2] = "none";
+        textures[3] = "none";
 
         return;
     }
@@ -119,40 +214,64 @@ void ModelLoader::load_material(u32 material_index, Material& material)
     m_scene->mMaterials[material_index]->GetTexture(aiTextureType_NORMALS, 0, &normal_texture_path);
     m_scene->mMaterials[material_index]->GetTexture(aiTextureType_AMBIENT, 0, &occlusion_texture_path);
 
-    std::string textures[4];
-
     textures[0] = m_base_dir + diffuse_texture_path.C_Str();
     textures[1] = (specular_texture_path.length > 0) ? m_base_dir + specular_texture_path.C_Str() : "none";
     textures[2] = (normal_texture_path.length > 0) ? m_base_dir + normal_texture_path.C_Str() : "none";
     textures[3] = (occlusion_texture_path.length > 0) ? m_base_dir + occlusion_texture_path.C_Str() : "none";
+}
 
-    material.textures[0] = m_renderer->create_texture({
-        .format = vk::Format::eR8G8B8A8Srgb,
-        .image_src = textures[0].c_str()
-    });
+void ModelLoader::load_textures(ModelAsset& model)
+{
+    PROFILE_FUNCTION();
 
-    for(int i = 1; i < 4; ++i)
+    // every texture of every material goes to the renderer in one go so they are all decoded in parallel
+    // converted .ktx2 files are looked up here rather than when importing so the mesh cache keeps the source paths
+    std::vector<std::string> texture_paths;
+    for(const std::array<std::string, 4>& textures : m_material_textures)
     {
-        if(textures[i] != "none")
+        for(const std::string& texture : textures)
         {
-            material.textures[i] = m_renderer->create_texture({
-                .format = vk::Format::eR8G8B8A8Srgb,
-                .image_src = textures[i].c_str()
-            });
+            if(texture != "none")
+            {
+                texture_paths.push_back(find_texture(texture));
+            }
         }
-        else
+    }
+
+    std::vector<TextureCreationInfo> texture_creations;
+    for(const std::string& texture_path : texture_paths)
+    {
+        texture_creations.push_back({
+            .format = vk::Format::eR8G8B8A8Srgb,
+            .image_src = texture_path.c_str()
+        });
+    }
+
+    std::vector<TextureHandle> texture_handles(texture_creations.size());
+    m_renderer->create_textures(texture_creations.data(), static_cast<u32>(texture_creations.size()), texture_handles.data());
+
+    u32 next_handle = 0;
+    for(u32 i = 0; i < model.materials.size(); ++i)
+    {
+        Material& material = model.materials[i];
+        for(u32 j = 0; j < 4; ++j)
         {
-            material.textures[i] = m_renderer->get_null_texture_handle();
+            material.textures[j] = (m_material_textures[i][j] != "none") ? texture_handles[next_handle++] : m_renderer->get_null_texture_handle();
         }
-    }
 
-    // FIXME
-    u32 texture_handles[] = { material.textures[0], material.textures[1], material.textures[2], material.textures[3] };
-    m_renderer->update_texture_set(texture_handles, 4);
+        // FIXME
+        m_renderer->update_texture_set(material.textures, 4);
+    }
 }
 
 const char* ModelLoader::get_name()
 {
+    // the cache doesn't keep names
+    if(!m_scene)
+    {
+        return m_cache_path.c_str();
+    }
+
     return m_scene->mMeshes[0]->mName.C_Str();
 }
 
@@ -179,18 +298,8 @@ void ModelLoader::load_primitive(Renderer* renderer, PrimitiveTypes primitive, M
         }
     }
 
-    mesh.vertex_buffer = renderer->create_buffer({
-        .usage = vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst,
-        .size = (u32)(sizeof(vertices[0]) * vertices.size()),
-        .data = vertices.data()
-    });
-
-    mesh.index_count = indices.size();
-    mesh.index_buffer = renderer->create_buffer({
-        .usage = vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst,
-        .size = (u32)(sizeof(indices[0]) * indices.size()),
-        .data = indices.data()
-    });
+    renderer->create_mesh(vertices, indices, mesh);
+    culling::compute_bounds(vertices.data(), static_cast<u32>(vertices.size()), mesh.aabb, mesh.sphere);
 }
 
 // FIXME: loading single texture should not create a descriptor set
@@ -210,7 +319,7 @@ void ModelLoader::load_texture(Renderer* renderer, const char* texture_path, Mat
     });
 
     material.descriptor_set = renderer->create_descriptor_set({
-        .resource_handles = { material.textures[0], renderer->get_null_texture_handle(), renderer->get_null_texture_handle(), renderer->get_null_texture_handle() },
+        .resource_handles = { material.textures[0].value, renderer->get_null_texture_handle().value, renderer->get_null_texture_handle().value, renderer->get_null_texture_handle().value },
         .sampler_handles = { material.sampler, material.sampler, material.sampler, material.sampler },
         .bindings = {0, 1, 2, 3},
         .types = {vk::DescriptorType::eCombinedImageSampler, vk::DescriptorType::eCombinedImageSampler, vk::DescriptorType::eCombinedImageSampler, vk::DescriptorType::eCombinedImageSampler},
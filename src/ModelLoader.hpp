@@ -5,19 +5,25 @@
 #include "Components.hpp"
 #include "Renderer.hpp"
 #include "Vertex.hpp"
+#include "MeshCache.hpp"
 
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 
+#include <array>
+
 class ModelLoader
 {
 public:
     explicit ModelLoader(Renderer* renderer, const char* file_path);
-    Model load();
-    void load_node(aiNode* current_node, aiMatrix4x4 relative_transform, Model& model);
+    ModelAsset load();
+    void load_node(aiNode* current_node, aiMatrix4x4 relative_transform, ModelAsset& model);
     void load_mesh(u32 mesh_index, Mesh& mesh);
     void load_material(u32 material_index, Material& material);
+    void load_textures(ModelAsset& model);
+    void load_cached(ModelAsset& model);
+    void write_cache(const ModelAsset& model);
     const char* get_name();
 
     static void load_primitive(Renderer* renderer, PrimitiveTypes primitive, Mesh& mesh);
@@ -32,5 +38,13 @@ private:
     Assimp::Importer m_importer;
     const aiScene* m_scene;
     std::string m_base_dir;
+
+    // texture paths of each material in model order, "none" for unused slots
+    std::vector<std::array<std::string, 4>> m_material_textures;
+
+    std::string m_cache_path;
+    u64 m_source_hash = 0;
+    MappedFile m_cache_file;
+    mesh_cache::Builder m_cache_builder;
 };
 
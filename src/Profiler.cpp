@@ -0,0 +1,257 @@
+#include "Profiler.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <TaskScheduler.h>
+
+namespace
+{
+    struct ZoneEvent
+    {
+        const char* name;
+        u64 start;
+        u64 end;
+    };
+
+    // one ring entry, only ever written by the owning thread
+    // sequence is the number of the zone in it plus one, or 0 while it's being written, so a dump copying it
+    // at the same time can tell the copy was torn or overwritten by checking it didn't change around the copy
+    struct ZoneSlot
+    {
+        std::atomic<u64> sequence{0};
+        std::atomic<const char*> name{nullptr};
+        std::atomic<u64> start{0};
+        std::atomic<u64> end{0};
+    };
+
+    struct ThreadProfile
+    {
+        // must be a power of 2, oldest zones get overwritten once it fills up
+        static const u32 k_capacity = 1 << 16;
+        static const u32 k_max_depth = 64;
+
+        ZoneSlot events[k_capacity];
+
+        // total number of zones ever written, published after the zone itself
+        std::atomic<u64> head{0};
+
+        // zones that have begun but not ended yet
+        ZoneEvent open_zones[k_max_depth];
+        u32 depth = 0;
+
+        u32 thread_id = 0;
+
+        // names are set rarely and never while recording, so a lock is fine here
+        std::mutex name_mutex;
+        std::string name;
+    };
+
+    std::mutex g_registry_mutex;
+    std::vector<std::unique_ptr<ThreadProfile>> g_thread_profiles;
+    const auto g_epoch = std::chrono::steady_clock::now();
+
+    thread_local ThreadProfile* t_profile = nullptr;
+
+    inline u64 now_ns()
+    {
+        return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_epoch).count();
+    }
+
+    // only happens the first time a thread records something
+    ThreadProfile* register_thread()
+    {
+        std::lock_guard<std::mutex> lock(g_registry_mutex);
+
+        auto profile = std::make_unique<ThreadProfile>();
+        profile->thread_id = (u32)g_thread_profiles.size();
+        profile->name = "Thread " + std::to_string(profile->thread_id);
+
+        g_thread_profiles.push_back(std::move(profile));
+        return g_thread_profiles.back().get();
+    }
+
+    inline ThreadProfile* get_thread_profile()
+    {
+        if(!t_profile)
+        {
+            t_profile = register_thread();
+        }
+
+        return t_profile;
+    }
+
+    void write_escaped(std::ostream& out, const std::string& str)
+    {
+        for(char c : str)
+        {
+            if(c == '"' || c == '\\') out << '\\';
+            out << c;
+        }
+    }
+
+    // enkiTS only gives us the thread number so these just forward to the zone functions
+    void on_worker_start(uint32_t threadnum)
+    {
+        std::string name = "enkiTS worker " + std::to_string(threadnum);
+        Profiler::set_thread_name(name.c_str());
+    }
+
+    void on_wait_for_new_task_start(uint32_t) { Profiler::begin_zone("Worker idle"); }
+    void on_wait_for_task_complete_start(uint32_t) { Profiler::begin_zone("Wait for task"); }
+    void on_wait_for_task_complete_suspend_start(uint32_t) { Profiler::begin_zone("Wait for task (suspended)"); }
+    void on_zone_stop(uint32_t) { Profiler::end_zone(); }
+}
+
+void Profiler::begin_zone(const char* name)
+{
+    ThreadProfile* profile = get_thread_profile();
+
+    // anything deeper than this is almost certainly a missing end_zone, just drop it
+    if(profile->depth < ThreadProfile::k_max_depth)
+    {
+        profile->open_zones[profile->depth] = { name, now_ns(), 0 };
+    }
+    ++profile->depth;
+}
+
+void Profiler::end_zone()
+{
+    ThreadProfile* profile = get_thread_profile();
+
+    if(profile->depth == 0)
+    {
+        return;
+    }
+
+    --profile->depth;
+    if(profile->depth >= ThreadProfile::k_max_depth)
+    {
+        return;
+    }
+
+    const ZoneEvent& zone = profile->open_zones[profile->depth];
+
+    // this thread is the only writer, so head can be read relaxed
+    u64 head = profile->head.load(std::memory_order_relaxed);
+    ZoneSlot& slot = profile->events[head & (ThreadProfile::k_capacity - 1)];
+
+    // the fence keeps the zone's stores from becoming visible before the slot is marked as being written
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.name.store(zone.name, std::memory_order_relaxed);
+    slot.start.store(zone.start, std::memory_order_relaxed);
+    slot.end.store(now_ns(), std::memory_order_relaxed);
+
+    slot.sequence.store(head + 1, std::memory_order_release);
+    profile->head.store(head + 1, std::memory_order_release);
+}
+
+void Profiler::set_thread_name(const char* name)
+{
+    ThreadProfile* profile = get_thread_profile();
+
+    std::lock_guard<std::mutex> lock(profile->name_mutex);
+    profile->name = name;
+}
+
+void Profiler::dump_trace(const char* file_name)
+{
+    // copy every ring oldest first without stopping the recording threads,
+    // zones they overwrite or are in the middle of writing while being copied are left out
+    struct ThreadSnapshot
+    {
+        u32 thread_id;
+        std::string name;
+        std::vector<ZoneEvent> events;
+    };
+    std::vector<ThreadSnapshot> snapshots;
+
+    {
+        std::lock_guard<std::mutex> registry_lock(g_registry_mutex);
+        snapshots.reserve(g_thread_profiles.size());
+
+        for(const auto& profile : g_thread_profiles)
+        {
+            ThreadSnapshot& snapshot = snapshots.emplace_back();
+            snapshot.thread_id = profile->thread_id;
+            {
+                std::lock_guard<std::mutex> lock(profile->name_mutex);
+                snapshot.name = profile->name;
+            }
+
+            u64 head = profile->head.load(std::memory_order_acquire);
+            u64 first = (head > ThreadProfile::k_capacity) ? head - ThreadProfile::k_capacity : 0;
+            snapshot.events.reserve(head - first);
+            for(u64 i = first; i < head; ++i)
+            {
+                const ZoneSlot& slot = profile->events[i & (ThreadProfile::k_capacity - 1)];
+
+                u64 sequence = slot.sequence.load(std::memory_order_acquire);
+                ZoneEvent zone = {
+                    slot.name.load(std::memory_order_relaxed),
+                    slot.start.load(std::memory_order_relaxed),
+                    slot.end.load(std::memory_order_relaxed)
+                };
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if(sequence == i + 1 && slot.sequence.load(std::memory_order_relaxed) == sequence)
+                {
+                    snapshot.events.push_back(zone);
+                }
+            }
+        }
+    }
+
+    std::stringstream out;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    bool first_event = true;
+    auto separator = [&]() { out << (first_event ? "" : ",\n"); first_event = false; };
+
+    for(const ThreadSnapshot& profile : snapshots)
+    {
+        separator();
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << profile.thread_id << ",\"args\":{\"name\":\"";
+        write_escaped(out, profile.name);
+        out << "\"}}";
+
+        for(const ZoneEvent& zone : profile.events)
+        {
+
+            // complete events, chrome nests them by time so the hierarchy comes for free
+            separator();
+            out << "{\"name\":\"";
+            write_escaped(out, zone.name);
+            out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << profile.thread_id
+                << ",\"ts\":" << (f64)zone.start * 0.001
+                << ",\"dur\":" << (f64)(zone.end - zone.start) * 0.001 << "}";
+        }
+    }
+
+    out << "\n]}\n";
+
+    std::string trace = out.str();
+    std::ofstream file(file_name, std::ios::binary);
+
+    if(!file.is_open())
+    {
+        throw std::runtime_error("failed to open trace file!");
+    }
+
+    file.write(trace.data(), (std::streamsize)trace.size());
+    std::cout << "Trace written to " << file_name << "\n";
+}
+
+void Profiler::register_scheduler_callbacks(enki::TaskSchedulerConfig& scheduler_config)
+{
+    scheduler_config.profilerCallbacks.threadStart = on_worker_start;
+    scheduler_config.profilerCallbacks.waitForNewTaskSuspendStart = on_wait_for_new_task_start;
+    scheduler_config.profilerCallbacks.waitForNewTaskSuspendStop = on_zone_stop;
+    scheduler_config.profilerCallbacks.waitForTaskCompleteStart = on_wait_for_task_complete_start;
+    scheduler_config.profilerCallbacks.waitForTaskCompleteStop = on_zone_stop;
+    scheduler_config.profilerCallbacks.waitForTaskCompleteSuspendStart = on_wait_for_task_complete_suspend_start;
+    scheduler_config.profilerCallbacks.waitForTaskCompleteSuspendStop = on_zone_stop;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "config.hpp"
+
+namespace enki { struct TaskSchedulerConfig; }
+
+// zone based CPU profiler
+// every thread records finished zones into its own lock free ring buffer
+// the most recent zones of all threads can be dumped as a chrome trace (chrome://tracing or ui.perfetto.dev)
+#ifdef ENABLE_PROFILING
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+#define PROFILE_SCOPE(name) ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__FUNCTION__)
+#define PROFILE_BEGIN(name) Profiler::begin_zone(name)
+#define PROFILE_END() Profiler::end_zone()
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_FUNCTION()
+#define PROFILE_BEGIN(name)
+#define PROFILE_END()
+#endif
+
+class Profiler
+{
+public:
+    // zone names must outlive the profiler, in practice they are always string literals
+    static void begin_zone(const char* name);
+    static void end_zone();
+
+    static void set_thread_name(const char* name);
+
+    // safe while other threads record and never blocks them, zones overwritten during the copy are dropped from the trace
+    static void dump_trace(const char* file_name);
+
+    // hooks up enkiTS so worker idle time and task waits show up in the trace
+    static void register_scheduler_callbacks(enki::TaskSchedulerConfig& scheduler_config);
+};
+
+struct ProfileZone
+{
+    explicit ProfileZone(const char* name) { Profiler::begin_zone(name); }
+    ~ProfileZone() { Profiler::end_zone(); }
+};
@@ -0,0 +1,187 @@
+#include "RenderQueue.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    constexpr u32 k_radix_bits = 8;
+    constexpr u32 k_num_buckets = 1 << k_radix_bits;
+    constexpr u32 k_num_passes = 64 / k_radix_bits;
+
+    // below this one thread gets through the keys quicker than handing out the chunks takes
+    constexpr u32 k_min_parallel_keys = 4096;
+
+    u32 get_bucket(u64 key, u32 shift)
+    {
+        return static_cast<u32>(key >> shift) & (k_num_buckets - 1);
+    }
+
+    // each chunk counts its keys into its own row of buckets
+    struct HistogramTask : enki::ITaskSet
+    {
+        void init(const DrawKey* _keys, u32 _count, u32 _chunk_size, u32 _shift, u32* _histograms, u32 _num_chunks)
+        {
+            keys = _keys;
+            count = _count;
+            chunk_size = _chunk_size;
+            shift = _shift;
+            histograms = _histograms;
+
+            m_SetSize = _num_chunks;
+            m_MinRange = 1;
+        }
+
+        void ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum) override
+        {
+            for(u32 chunk = range.start; chunk < range.end; ++chunk)
+            {
+                u32* histogram = histograms + chunk * k_num_buckets;
+                std::fill(histogram, histogram + k_num_buckets, 0);
+
+                u32 end = std::min(count, (chunk + 1) * chunk_size);
+                for(u32 i = chunk * chunk_size; i < end; ++i)
+                {
+                    ++histogram[get_bucket(keys[i].key, shift)];
+                }
+            }
+        }
+
+        const DrawKey* keys;
+        u32 count;
+        u32 chunk_size;
+        u32 shift;
+        u32* histograms;
+    };
+
+    // each chunk writes its keys from its own offsets, so no two chunks ever write the same slot
+    struct ScatterTask : enki::ITaskSet
+    {
+        void init(const DrawKey* _keys, DrawKey* _sorted, u32 _count, u32 _chunk_size, u32 _shift, u32* _offsets, u32 _num_chunks)
+        {
+            keys = _keys;
+            sorted = _sorted;
+            count = _count;
+            chunk_size = _chunk_size;
+            shift = _shift;
+            offsets = _offsets;
+
+            m_SetSize = _num_chunks;
+            m_MinRange = 1;
+        }
+
+        void ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum) override
+        {
+            for(u32 chunk = range.start; chunk < range.end; ++chunk)
+            {
+                u32* chunk_offsets = offsets + chunk * k_num_buckets;
+
+                u32 end = std::min(count, (chunk + 1) * chunk_size);
+                for(u32 i = chunk * chunk_size; i < end; ++i)
+                {
+                    sorted[chunk_offsets[get_bucket(keys[i].key, shift)]++] = keys[i];
+                }
+            }
+        }
+
+        const DrawKey* keys;
+        DrawKey* sorted;
+        u32 count;
+        u32 chunk_size;
+        u32 shift;
+        u32* offsets;
+    };
+
+    template<typename Task>
+    void run(Task& task, u32 num_chunks, enki::TaskScheduler* scheduler)
+    {
+        if(num_chunks == 1)
+        {
+            task.ExecuteRange({0, 1}, 0);
+            return;
+        }
+
+        scheduler->AddTaskSetToPipe(&task);
+        scheduler->WaitforTask(&task);
+    }
+}
+
+u64 RenderQueue::make_key(u32 pipeline, u32 material, u32 geometry, f32 depth)
+{
+    // positive floats order the same way as their bits, so the top of them is a front to back depth key
+    u32 depth_bits = 0;
+    if(depth > 0.f)
+    {
+        memcpy(&depth_bits, &depth, sizeof(depth_bits));
+        depth_bits >>= 32 - k_depth_bits;
+    }
+
+    u64 key = pipeline & ((1u << k_pipeline_bits) - 1);
+    key = (key << k_material_bits) | (material & ((1u << k_material_bits) - 1));
+    key = (key << k_geometry_bits) | (geometry & ((1u << k_geometry_bits) - 1));
+    key = (key << k_depth_bits) | depth_bits;
+    return key;
+}
+
+void RenderQueue::sort(enki::TaskScheduler* scheduler)
+{
+    PROFILE_FUNCTION();
+
+    u32 count = size();
+    if(count < 2)
+    {
+        return;
+    }
+
+    u32 num_chunks = count < k_min_parallel_keys ? 1 : scheduler->GetNumTaskThreads();
+    u32 chunk_size = (count + num_chunks - 1) / num_chunks;
+
+    m_scratch.resize(count);
+    m_histograms.resize(num_chunks * k_num_buckets);
+
+    DrawKey* keys = m_keys.data();
+    DrawKey* sorted = m_scratch.data();
+    for(u32 pass = 0; pass < k_num_passes; ++pass)
+    {
+        u32 shift = pass * k_radix_bits;
+
+        HistogramTask histogram_task;
+        histogram_task.init(keys, count, chunk_size, shift, m_histograms.data(), num_chunks);
+        run(histogram_task, num_chunks, scheduler);
+
+        // bucket by bucket and chunk by chunk, each count becomes where that chunk's share of the bucket starts
+        // earlier chunks go first within a bucket, which keeps every pass stable
+        u32 offset = 0;
+        bool single_bucket = false;
+        for(u32 bucket = 0; bucket < k_num_buckets && !single_bucket; ++bucket)
+        {
+            u32 bucket_start = offset;
+            for(u32 chunk = 0; chunk < num_chunks; ++chunk)
+            {
+                u32& histogram = m_histograms[chunk * k_num_buckets + bucket];
+                u32 bucket_count = histogram;
+                histogram = offset;
+                offset += bucket_count;
+            }
+            single_bucket = offset - bucket_start == count;
+        }
+
+        if(single_bucket)
+        {
+            continue;
+        }
+
+        ScatterTask scatter_task;
+        scatter_task.init(keys, sorted, count, chunk_size, shift, m_histograms.data(), num_chunks);
+        run(scatter_task, num_chunks, scheduler);
+
+        std::swap(keys, sorted);
+    }
+
+    // an odd number of scatters leaves the result in the scratch keys
+    if(keys != m_keys.data())
+    {
+        std::swap(m_keys, m_scratch);
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <TaskScheduler.h>
+
+#include <vector>
+
+struct DrawKey
+{
+    u64 key;
+    u32 draw;   // index of the draw in whatever list the caller keeps
+};
+
+// the draws of a frame in the order they should be recorded
+// keys go from the most expensive state to change down to depth: pipeline, material, geometry block,
+// so draws sharing state end up next to each other and within the same state they are drawn front to back
+class RenderQueue
+{
+public:
+    static constexpr u32 k_pipeline_bits = 4;
+    static constexpr u32 k_material_bits = 24;
+    static constexpr u32 k_geometry_bits = 12;
+    static constexpr u32 k_depth_bits = 24;
+
+    // ids wider than their field wrap around, which costs some extra binds but never correctness
+    // depth is the distance in front of the camera, anything behind it sorts first
+    static u64 make_key(u32 pipeline, u32 material, u32 geometry, f32 depth);
+
+    void clear() { m_keys.clear(); }
+    void push(u64 key, u32 draw) { m_keys.push_back({key, draw}); }
+
+    // least significant digit radix sort a byte at a time, the chunks of each pass are counted and scattered in parallel
+    // passes where every key has the same byte are skipped, so unused high bits cost a count and nothing else
+    void sort(enki::TaskScheduler* scheduler);
+
+    [[nodiscard]] const DrawKey* data() const { return m_keys.data(); }
+    [[nodiscard]] u32 size() const { return static_cast<u32>(m_keys.size()); }
+
+private:
+    std::vector<DrawKey> m_keys;
+    std::vector<DrawKey> m_scratch;
+
+    // a row of bucket counts per chunk, turned into the chunk's scatter offsets in place
+    std::vector<u32> m_histograms;
+};
@@ -3,8 +3,13 @@
 #include "DeviceHelper.hpp"
 #include "Vertex.hpp"
 #include "Utility.hpp"
+#include "Profiler.hpp"
+#include "KTX2.hpp"
 
+#include <algorithm>
+#include <bit>
 #include <filesystem>
+#include <numeric>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -13,62 +18,233 @@
 #include <backends/imgui_impl_glfw.h>
 #include <backends/imgui_impl_vulkan.h>
 
+// the order of these bits is also the order the results come back in
+const vk::QueryPipelineStatisticFlags k_pipeline_statistics =
+        vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations |
+        vk::QueryPipelineStatisticFlagBits::eClippingPrimitives |
+        vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+
+// writes the transforms of each batch's visible models into its range of the instance buffer
+// every batch belongs to exactly one worker, so the writes never overlap
+struct CullBatchesTask : enki::ITaskSet
+{
+    void init(DrawBatch* _batches, u32 _num_batches, const glm::mat4* _model_transforms, const u32* _batch_models, glm::mat4* _instances, const culling::Frustum* _frustum, bool _cull)
+    {
+        batches = _batches;
+        model_transforms = _model_transforms;
+        batch_models = _batch_models;
+        instances = _instances;
+        frustum = _frustum;
+        cull = _cull;
+
+        m_SetSize = _num_batches;
+        m_MinRange = 8;
+    }
+
+    void ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum) override
+    {
+        PROFILE_SCOPE("CullBatchesTask");
+
+        // distances to the near plane put the batches front to back
+        const glm::vec4& near_plane = frustum->planes[4];
+
+        for(u32 i = range.start; i < range.end; ++i)
+        {
+            DrawBatch& batch = batches[i];
+            const AABB& box = batch.asset->meshes[batch.mesh_index].aabb;
+            const BoundingSphere& sphere = batch.asset->meshes[batch.mesh_index].sphere;
+            const glm::mat4& mesh_transform = batch.asset->transforms[batch.mesh_index];
+            glm::mat4* batch_instances = instances + batch.first_instance;
+            batch.depth = std::numeric_limits<f32>::max();
+
+            // the plane tests run on four models at a time
+            for(u32 j = 0; j < batch.model_count; j += 4)
+            {
+                u32 count = std::min(batch.model_count - j, 4u);
+                glm::mat4 transforms[4];
+                for(u32 k = 0; k < count; ++k)
+                {
+                    transforms[k] = model_transforms[batch_models[batch.first_model + j + k]] * mesh_transform;
+                }
+
+                u32 visible = cull ? culling::test_box_instances(*frustum, box, transforms, count) : (1u << count) - 1;
+                for(u32 k = 0; k < count; ++k)
+                {
+                    if(visible & (1u << k))
+                    {
+                        batch_instances[batch.instance_count++] = transforms[k];
+
+                        glm::vec3 centre = glm::vec3(transforms[k] * glm::vec4(sphere.center, 1.f));
+                        batch.depth = std::min(batch.depth, glm::dot(glm::vec3(near_plane), centre) + near_plane.w);
+                    }
+                }
+            }
+        }
+    }
+
+    DrawBatch* batches;
+    const glm::mat4* model_transforms;
+    const u32* batch_models;
+    glm::mat4* instances;
+    const culling::Frustum* frustum;
+    bool cull;
+};
+
+// records the sorted batches a chunk at a time, enkiTS hands out ranges of chunks and idle threads steal from busy ones
+// a chunk goes into the secondary of whichever thread picked it up, render() began all of them beforehand
 struct RecordDrawTask : enki::ITaskSet
 {
-    void init(Renderer* _renderer, vk::CommandBuffer* _command_buffer, const Scene* _scene, u32 _start, u32 _end, DescriptorSet* _camera_data, DescriptorSet* _material_data)
+    // with GPU culling the draws come from the cull pass' indirect commands and counts, otherwise both buffers are null
+    void init(Renderer* _renderer, const vk::CommandBuffer* _thread_command_buffers, const DrawBatch* _batches, const DrawKey* _keys, const RecordChunk* _chunks, u32 _num_chunks, vk::Buffer _indirect_commands, vk::Buffer _draw_counts)
     {
         renderer = _renderer;
-        command_buffer = _command_buffer;
-        scene = _scene;
-        start = _start;
-        end = _end;
-        camera_data = _camera_data;
-        material_data = _material_data;
+        thread_command_buffers = _thread_command_buffers;
+        batches = _batches;
+        keys = _keys;
+        chunks = _chunks;
+        indirect_commands = _indirect_commands;
+        draw_counts = _draw_counts;
+
+        m_SetSize = _num_chunks;
+        m_MinRange = 1;
     }
 
     void ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum) override
     {
-        for(u32 i = start; i < end; ++i)
+        PROFILE_SCOPE("RecordDrawTask");
+
+        vk::CommandBuffer command_buffer = thread_command_buffers[threadnum];
+        for(u32 chunk = range.start; chunk < range.end; ++chunk)
         {
-            // need to bind right descriptor sets before draw call
-            // descriptor sets are not unique to graphics pipelines
-            command_buffer->bindDescriptorSets(vk::PipelineBindPoint::eGraphics, renderer->get_pipeline_layout(), 1, 1, &material_data->vk_descriptor_set, 0, nullptr);
-            command_buffer->bindDescriptorSets(vk::PipelineBindPoint::eGraphics, renderer->get_pipeline_layout(), 0, 1, &camera_data->vk_descriptor_set, 0, nullptr);
+            record(command_buffer, chunks[chunk]);
+        }
+    }
 
-            for(u32 j = 0; j < scene->models[i].meshes.size(); ++j)
+private:
+    void record(vk::CommandBuffer command_buffer, const RecordChunk& chunk) const
+    {
+        // the keys put batches with the same material and geometry next to each other, so most binds repeat the last one
+        // another chunk may have been recorded into this buffer in between, so each chunk starts without assumptions
+        u32 bound_block = std::numeric_limits<u32>::max();
+        glm::uvec4 pushed_textures{};
+        for(u32 i = chunk.start; i < chunk.end; ++i)
+        {
+            u32 draw = keys[i].draw;
+            const DrawBatch& batch = batches[draw];
+            const TextureHandle* textures = batch.asset->materials[batch.mesh_index].textures;
+            glm::uvec4 texture_indices = { textures[0].index(), textures[1].index(), textures[2].index(), textures[3].index() };
+            if(i == chunk.start || texture_indices != pushed_textures)
             {
-                glm::mat4 final_transform = scene->models[i].transform * scene->models[i].transforms[j];
-                command_buffer->pushConstants(renderer->get_pipeline_layout(), vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4), &final_transform);
-                command_buffer->pushConstants(renderer->get_pipeline_layout(), vk::ShaderStageFlagBits::eFragment, 64, sizeof(glm::uvec4), scene->models[i].materials[j].textures);
+                command_buffer.pushConstants(renderer->get_pipeline_layout(), vk::ShaderStageFlagBits::eFragment, 64, sizeof(glm::uvec4), &texture_indices);
+                pushed_textures = texture_indices;
+            }
 
-                Buffer* vertex_buffer = renderer->get_buffer(scene->models[i].meshes[j].vertex_buffer);
-                vk::Buffer vertex_buffers[] = {vertex_buffer->vk_buffer};
+            // meshes share the arena's buffers, so they only need rebinding when the block changes
+            const Mesh& mesh = batch.asset->meshes[batch.mesh_index];
+            if(mesh.geometry_block != bound_block)
+            {
+                const GeometryBlock& block = renderer->get_geometry_arena().get_block(mesh.geometry_block);
+                vk::Buffer vertex_buffers[] = {block.vk_vertex_buffer};
                 vk::DeviceSize offsets[] = {0};
-                command_buffer->bindVertexBuffers(0, 1, vertex_buffers, offsets);
-
-                Buffer* index_buffer = renderer->get_buffer(scene->models[i].meshes[j].index_buffer);
-                command_buffer->bindIndexBuffer(index_buffer->vk_buffer, 0, vk::IndexType::eUint32);
+                command_buffer.bindVertexBuffers(0, 1, vertex_buffers, offsets);
+                command_buffer.bindIndexBuffer(block.vk_index_buffer, 0, vk::IndexType::eUint32);
+                bound_block = mesh.geometry_block;
+            }
 
-                // now we can issue the actual draw command
-                // index count
-                // instance count
-                // first index: offset into the vertex buffer
-                // first instance
-                command_buffer->drawIndexed(scene->models[i].meshes[j].index_count, 1, 0, 0, 0);
+            if(indirect_commands)
+            {
+                // the cull pass packed a command for each visible placement at the front of the batch's range
+                // and the batch's count says how many of them to read, the batch index is also the index of its count
+                command_buffer.drawIndexedIndirectCount(indirect_commands, batch.first_instance * sizeof(vk::DrawIndexedIndirectCommand),
+                                                        draw_counts, draw * sizeof(u32), batch.instance_count, sizeof(vk::DrawIndexedIndirectCommand));
+                continue;
             }
+
+            // now we can issue the actual draw command
+            // index count
+            // instance count: every model placed from this asset
+            // first index: where the mesh's indices start in the block's index buffer
+            // vertex offset: added to every index, so indices stay relative to the mesh
+            // first instance: where the batch's transforms start, gl_InstanceIndex counts up from here
+            command_buffer.drawIndexed(mesh.index_count, batch.instance_count, mesh.first_index, static_cast<i32>(mesh.vertex_offset), batch.first_instance);
         }
-        command_buffer->end();
     }
 
-    vk::CommandBuffer* command_buffer;
+    Renderer* renderer;
+    const vk::CommandBuffer* thread_command_buffers;
+    const DrawBatch* batches;
+    const DrawKey* keys;
+    const RecordChunk* chunks;
+    vk::Buffer indirect_commands;
+    vk::Buffer draw_counts;
+};
+
+
+// decoded images waiting to be uploaded, filled by the decode tasks and drained by the thread that asked for the textures
+struct DecodedTexture
+{
+    u32 request = 0;
+    stbi_uc* pixels = nullptr;
+    i32 width = 0;
+    i32 height = 0;
+};
+
+class DecodeCompletionQueue
+{
+public:
+    void push(const DecodedTexture& decoded)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_completed.push_back(decoded);
+    }
+
+    bool try_pop(DecodedTexture& decoded)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_completed.empty())
+        {
+            return false;
+        }
+
+        decoded = m_completed.front();
+        m_completed.pop_front();
+        return true;
+    }
 
 private:
-    Renderer* renderer;
-    const Scene* scene;
-    u32 start;
-    u32 end;
-    DescriptorSet* camera_data;
-    DescriptorSet* material_data;
+    std::mutex m_mutex;
+    std::deque<DecodedTexture> m_completed;
+};
+
+struct DecodeTextureTask : enki::ITaskSet
+{
+    void init(const char* _image_src, u32 _request, DecodeCompletionQueue* _completed)
+    {
+        image_src = _image_src;
+        request = _request;
+        completed = _completed;
+    }
+
+    void ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum) override
+    {
+        PROFILE_SCOPE("DecodeTextureTask");
+
+        // the global flip flag would be a data race with the other decodes
+        stbi_set_flip_vertically_on_load_thread(1);
+
+        DecodedTexture decoded;
+        decoded.request = request;
+
+        // a failed decode still goes in the queue, the uploader reports it
+        int channels;
+        decoded.pixels = stbi_load(image_src, &decoded.width, &decoded.height, &channels, STBI_rgb_alpha);
+        completed->push(decoded);
+    }
+
+private:
+    const char* image_src;
+    u32 request;
+    DecodeCompletionQueue* completed;
 };
 
 
@@ -81,27 +257,74 @@ struct CameraData
     glm::vec3 camera_position;
 };
 
+// the four texture indices of a material folded into the material part of a sort key
+static u32 get_material_key(const Material& material)
+{
+    u32 hash = 2166136261u;
+    for(const TextureHandle& texture : material.textures)
+    {
+        hash = (hash ^ texture.index()) * 16777619u;
+    }
+
+    return hash;
+}
+
+// push constants of the cull shader
+struct CullData
+{
+    glm::vec4 planes[6];
+    u32 num_objects;
+};
+
 Renderer::Renderer(GLFWwindow* window, enki::TaskScheduler* scheduler) :
     m_window(window),
     m_scheduler(scheduler),
-    m_buffer_pool(&m_pool_allocator, 100, sizeof(Buffer)),
-    m_texture_pool(&m_pool_allocator, 100, sizeof(Texture)),
-    m_sampler_pool(&m_pool_allocator, 10, sizeof(Sampler)),
-    m_descriptor_set_pool(&m_pool_allocator, 10, sizeof(DescriptorSet))
+    m_buffer_pool(256),
+    m_texture_pool(128),
+    m_sampler_pool(16),
+    m_descriptor_set_pool(16)
+{
+    init();
+}
+
+Renderer::Renderer(u32 width, u32 height, enki::TaskScheduler* scheduler) :
+    m_window(nullptr),
+    m_scheduler(scheduler),
+    m_swapchain_extent(width, height),
+    m_buffer_pool(256),
+    m_texture_pool(128),
+    m_sampler_pool(16),
+    m_descriptor_set_pool(16)
+{
+    init();
+}
+
+void Renderer::init()
 {
     init_instance();
-    init_surface();
-    init_device();
-    init_swapchain();
+
+    if(is_headless())
+    {
+        init_device();
+        init_offscreen_targets();
+    }
+    else
+    {
+        init_surface();
+        init_device();
+        init_swapchain();
+    }
+
     init_render_pass();
     init_descriptor_pools();
     init_descriptor_sets();
     init_graphics_pipeline();
+    init_cull_pipeline();
     init_command_pools();
     init_depth_resources();
     init_framebuffers();
-    init_command_buffers();
     init_sync_objects();
+    init_query_pools();
 
     // create null texture
     m_null_texture = create_texture({
@@ -119,9 +342,24 @@ Renderer::Renderer(GLFWwindow* window, enki::TaskScheduler* scheduler) :
 
 Renderer::~Renderer()
 {
+    // the retired assets return their meshes to the arena, which can only happen once nothing is drawing them
+    logical_device.waitIdle();
+    for(auto& assets : m_retired_assets)
+    {
+        assets.clear();
+    }
+
+    // waits for outstanding uploads and frees their staging buffers, so it has to happen before any pools go
+    m_upload_queue.destroy();
+    m_staging_ring.destroy();
+    m_geometry_arena.destroy();
+
     ImGui_ImplVulkan_Shutdown();
     logical_device.destroyDescriptorPool(m_imgui_pool, nullptr);
 
+    logical_device.destroyQueryPool(m_timestamp_pool, nullptr);
+    logical_device.destroyQueryPool(m_statistics_pool, nullptr);
+
     for(i32 i = 0; i < s_max_frames_in_flight; ++i)
     {
         // sync objects
@@ -132,9 +370,28 @@ Renderer::~Renderer()
         // uniform buffers
         destroy_buffer(m_camera_buffers[i]);
         destroy_buffer(m_light_buffers[i]);
+        destroy_buffer(m_instance_buffers[i]);
+
+        if(m_gpu_culling_supported)
+        {
+            destroy_buffer(m_cull_frames[i].objects);
+            destroy_buffer(m_cull_frames[i].commands);
+            destroy_buffer(m_cull_frames[i].counts);
+        }
     }
 
-    destroy_texture(m_null_texture);
+    // every texture ever loaded is in the cache, the null texture and those of assets that were already released included
+    // destroy_texture takes them out of the map, so the handles are gathered first
+    std::vector<TextureHandle> textures;
+    textures.reserve(m_texture_map.size());
+    for(auto& [path, texture] : m_texture_map)
+    {
+        textures.push_back(texture.get());
+    }
+    for(TextureHandle texture : textures)
+    {
+        destroy_texture(texture);
+    }
     destroy_sampler(m_default_sampler);
 
     cleanup_swapchain();
@@ -143,17 +400,20 @@ Renderer::~Renderer()
     logical_device.destroyDescriptorSetLayout(m_descriptor_set_layout, nullptr);
     logical_device.destroyDescriptorSetLayout(m_camera_data_layout, nullptr);
     logical_device.destroyDescriptorSetLayout(m_texture_set_layout, nullptr);
+    logical_device.destroyDescriptorSetLayout(m_cull_set_layout, nullptr);
 
     vmaDestroyAllocator(m_allocator);
 
-    logical_device.destroyCommandPool(m_main_command_pool);
-    logical_device.destroyCommandPool(m_extra_command_pool);
-    for(auto& command_pool : m_command_pools)
+    m_command_pool_ring.destroy();
+    m_cached_command_pool_ring.destroy();
+    for(auto& command_pool : m_upload_command_pools)
     {
         logical_device.destroyCommandPool(command_pool, nullptr);
     }
     logical_device.destroyPipeline(m_graphics_pipeline, nullptr);
     logical_device.destroyPipelineLayout(m_pipeline_layout, nullptr);
+    logical_device.destroyPipeline(m_cull_pipeline, nullptr);
+    logical_device.destroyPipelineLayout(m_cull_pipeline_layout, nullptr);
     logical_device.destroyRenderPass(m_render_pass, nullptr);
 
     // devices don't interact directly with instances
@@ -169,6 +429,8 @@ Renderer::~Renderer()
 
 void Renderer::render(Scene* scene)
 {
+    PROFILE_FUNCTION();
+
     CameraData camera_data{};
     camera_data.view = scene->camera.camera_look_at();
     camera_data.proj = scene->camera.get_perspective();
@@ -180,151 +442,747 @@ void Renderer::render(Scene* scene)
 
     // this is the most efficient way to pass constantly changing values to the shader
     // another way to handle smaller data is to use push constants
-    auto* camera_buffer = static_cast<Buffer*>(m_buffer_pool.access(m_camera_buffers[m_current_frame]));
+    auto* camera_buffer = m_buffer_pool.access(m_camera_buffers[m_current_frame]);
     memcpy(camera_buffer->mapped_data, &camera_data, pad_uniform_buffer(sizeof(camera_data)));
 
     begin_frame();
 
-    auto* material_set = static_cast<DescriptorSet*>(m_descriptor_set_pool.access(m_texture_set));
-    auto* camera_set = static_cast<DescriptorSet*>(m_descriptor_set_pool.access(m_camera_sets[m_current_frame]));
+    // this slot's fence was just waited on, so every frame submitted before the models went was too
+    m_retired_assets[m_current_frame].clear();
+    scene->take_removed_assets(m_retired_assets[m_current_frame]);
 
-    RecordDrawTask record_draw_tasks[m_scheduler->GetNumTaskThreads()];
-    u32 models_per_thread, num_recordings, surplus;
+    Timer record_timer;
+    culling::Frustum frustum = culling::extract_frustum(camera_data.proj * camera_data.view);
 
-    if (m_scheduler->GetNumTaskThreads() > scene->models.size())
+    // the GPU path only touches the scene when it changed, after that the cull pass does the per model work
+    vk::Buffer indirect_commands = nullptr;
+    vk::Buffer draw_counts = nullptr;
+    if(m_gpu_culling_enabled)
     {
-        models_per_thread = 1;
-        num_recordings = scene->models.size();
-        surplus = 0;
+        if(scene->get_version() != m_gpu_scene_version)
+        {
+            build_gpu_objects(scene);
+        }
+
+        record_cull_pass(m_primary_command_buffer->vk_command_buffer, frustum);
+        indirect_commands = m_buffer_pool.access(m_cull_frames[m_current_frame].commands)->vk_buffer;
+        draw_counts = m_buffer_pool.access(m_cull_frames[m_current_frame].counts)->vk_buffer;
     }
     else
     {
-        models_per_thread = scene->models.size() / m_scheduler->GetNumTaskThreads();
-        num_recordings = m_scheduler->GetNumTaskThreads();
-        surplus = scene->models.size() % m_scheduler->GetNumTaskThreads();
+        build_draw_batches(scene, frustum);
     }
 
+    // all functions that record commands can be recognized by their vk::Cmd prefix
+    // they all return void, so no error handling until the recording is finished
+    m_primary_command_buffer->begin_renderpass(m_render_pass, m_swapchain_framebuffers[m_image_index], m_swapchain_extent, vk::SubpassContents::eSecondaryCommandBuffers);
+
+    auto* material_set = m_descriptor_set_pool.access(m_texture_set);
+    auto* camera_set = m_descriptor_set_pool.access(m_camera_sets[m_current_frame]);
+    u32 num_threads = m_scheduler->GetNumTaskThreads();
+
 	vk::CommandBufferInheritanceInfo inheritance_info{};
 	inheritance_info.renderPass = m_render_pass;
 	inheritance_info.framebuffer = m_swapchain_framebuffers[m_image_index];
 	inheritance_info.subpass = 0;
 
-    u32 start = 0;
-    for(u32 i = 0; i < num_recordings; ++i)
-    {
-        m_command_buffers[m_current_cb_index].begin(inheritance_info);
-        m_command_buffers[m_current_cb_index].bind_pipeline(m_graphics_pipeline);
+	// the statistics query in the primary stays active while the secondaries execute
+	if(m_statistics_supported)
+	{
+		inheritance_info.pipelineStatistics = k_pipeline_statistics;
+	}
 
-        // since we specified that the viewport and scissor were dynamic we need to do them now
-        m_command_buffers[m_current_cb_index].set_viewport(m_swapchain_extent.width, m_swapchain_extent.height);
-        m_command_buffers[m_current_cb_index].set_scissor(m_swapchain_extent);
+	// timestamps for the draw secondaries come after render pass and imgui
+	u32 draw_timestamp = get_timestamp_index(4);
 
-        record_draw_tasks[i].init(this, &m_command_buffers[m_current_cb_index].vk_command_buffer, scene, start, start + models_per_thread, camera_set, material_set);
-        m_scheduler->AddTaskSetToPipe(&record_draw_tasks[i]);
+    // the draws only change when the batches, their order or the state they bind do, not when models move,
+    // so while that holds the slot's secondaries from last time are executed again as they are
+    RecordCache& record_cache = m_record_caches[m_current_frame];
+    bool rerecord = !is_record_cache_valid(record_cache, indirect_commands != nullptr);
+    m_draw_stats.recorded_draws = rerecord ? m_render_queue.size() : 0;
 
-        start += models_per_thread;
-        m_current_cb_index += s_max_frames_in_flight;
+    // every scheduler thread records into its own secondary, whichever chunks it ends up with
+    // they are all begun here so the state every draw needs is in place before the first chunk lands on them
+    CommandBuffer* thread_command_buffers[num_threads];
+    vk::CommandBuffer thread_vk_command_buffers[num_threads];
+    if(rerecord)
+    {
+        // the cached buffers of this slot are only reset here, its fence has signalled so none of them are pending
+        m_cached_command_pool_ring.reset(m_current_frame);
     }
 
-    RecordDrawTask extra_draws;
-    if(surplus > 0)
+    // kept secondaries can't depend on which swapchain image they end up in, leaving the framebuffer out allows that
+    vk::CommandBufferInheritanceInfo draw_inheritance_info = inheritance_info;
+    draw_inheritance_info.framebuffer = nullptr;
+
+    for(u32 i = 0; i < num_threads && rerecord; ++i)
     {
-        m_extra_draw_commands[m_current_frame].begin(inheritance_info);
-        m_extra_draw_commands[m_current_frame].bind_pipeline(m_graphics_pipeline);
-        m_extra_draw_commands[m_current_frame].set_viewport(m_swapchain_extent.width, m_swapchain_extent.height);
-        m_extra_draw_commands[m_current_frame].set_scissor(m_swapchain_extent);
+        // the workers are idle until the task is added, so the main thread can take buffers from their pools
+        CommandBuffer& command_buffer = m_cached_command_pool_ring.get_command_buffer(m_current_frame, i);
+        command_buffer.begin(draw_inheritance_info, false);
+        if(m_timestamps_supported)
+        {
+            command_buffer.vk_command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, m_timestamp_pool, draw_timestamp + 2 * i);
+        }
+        command_buffer.bind_pipeline(m_graphics_pipeline);
+
+        // since we specified that the viewport and scissor were dynamic we need to do them now
+        command_buffer.set_viewport(m_swapchain_extent.width, m_swapchain_extent.height);
+        command_buffer.set_scissor(m_swapchain_extent);
+
+        // need to bind right descriptor sets before draw call
+        // descriptor sets are not unique to graphics pipelines
+        command_buffer.vk_command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_pipeline_layout, 1, 1, &material_set->vk_descriptor_set, 0, nullptr);
+        command_buffer.vk_command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_pipeline_layout, 0, 1, &camera_set->vk_descriptor_set, 0, nullptr);
 
-        extra_draws.init(this, &m_extra_draw_commands[m_current_frame].vk_command_buffer, scene, start, start + surplus, camera_set, material_set);
-        m_scheduler->AddTaskSetToPipe(&extra_draws);
+        thread_command_buffers[i] = &command_buffer;
+        thread_vk_command_buffers[i] = command_buffer.vk_command_buffer;
     }
+    m_num_draw_timestamps[m_current_frame] = num_threads;
 
-    m_imgui_commands[m_current_frame].begin(inheritance_info);
-    ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(),  m_imgui_commands[m_current_frame].vk_command_buffer);
-    m_imgui_commands[m_current_frame].end();
+    RecordDrawTask record_draw_task;
+    if(rerecord)
+    {
+        build_record_chunks();
+        record_draw_task.init(this, thread_vk_command_buffers, m_draw_batches.data(), m_render_queue.data(), m_record_chunks.data(), static_cast<u32>(m_record_chunks.size()), indirect_commands, draw_counts);
+        if(!m_record_chunks.empty())
+        {
+            m_scheduler->AddTaskSetToPipe(&record_draw_task);
+        }
+    }
 
-    for(u32 i = 0; i < num_recordings; ++i)
+    // the main thread is thread 0 and only picks up chunks once it waits, so its pool is free until then
+    CommandBuffer& imgui_commands = m_command_pool_ring.get_command_buffer(m_current_frame, 0);
+    imgui_commands.begin(inheritance_info);
     {
-        m_scheduler->WaitforTask(&record_draw_tasks[i]);
+        PROFILE_SCOPE("Record ImGui");
+        if(m_timestamps_supported)
+        {
+            imgui_commands.vk_command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, m_timestamp_pool, get_timestamp_index(2));
+        }
+
+        ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(),  imgui_commands.vk_command_buffer);
 
-        if(record_draw_tasks[i].command_buffer)
+        if(m_timestamps_supported)
         {
-            m_primary_command_buffers[m_current_frame].vk_command_buffer.executeCommands(1, record_draw_tasks[i].command_buffer);
+            imgui_commands.vk_command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, m_timestamp_pool, get_timestamp_index(3));
         }
     }
-    if(surplus > 0)
+    imgui_commands.end();
+
+    if(rerecord)
     {
-        m_scheduler->WaitforTask(&extra_draws);
-        m_primary_command_buffers[m_current_frame].vk_command_buffer.executeCommands(1, extra_draws.command_buffer);
+        PROFILE_BEGIN("Wait for record tasks");
+        if(!m_record_chunks.empty())
+        {
+            m_scheduler->WaitforTask(&record_draw_task);
+        }
+        PROFILE_END();
+
+        for(u32 i = 0; i < num_threads; ++i)
+        {
+            if(m_timestamps_supported)
+            {
+                thread_vk_command_buffers[i].writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, m_timestamp_pool, draw_timestamp + 2 * i + 1);
+            }
+            thread_command_buffers[i]->end();
+        }
+
+        store_record_cache(record_cache, thread_vk_command_buffers, num_threads, indirect_commands != nullptr);
     }
-    m_primary_command_buffers[m_current_frame].vk_command_buffer.executeCommands(1, &m_imgui_commands[m_current_frame].vk_command_buffer);
+    m_primary_command_buffer->vk_command_buffer.executeCommands(static_cast<u32>(record_cache.command_buffers.size()), record_cache.command_buffers.data());
+    m_primary_command_buffer->vk_command_buffer.executeCommands(1, &imgui_commands.vk_command_buffer);
+    m_frame_timings.record = record_timer.stop();
 
     end_frame();
 
     m_current_frame = (m_current_frame + 1) % s_max_frames_in_flight;
-    m_current_cb_index = m_current_frame;
+}
+
+void Renderer::build_draw_batches(const Scene* scene, const culling::Frustum& frustum)
+{
+    PROFILE_FUNCTION();
+
+    // the batches are about to be replaced and the instance buffer overwritten, so the GPU path has to start over next time
+    m_gpu_scene_version = k_stale_version;
+
+    // the scene's BVH throws out whole groups of models before anything looks at their meshes
+    // it is only missing models while they are still being added, everything is drawn until the next rebuild then
+    m_visible_models.clear();
+    const BVH& bvh = scene->get_bvh();
+    u32 num_scene_models = scene->get_num_models();
+    const ModelAsset* const* model_assets = scene->get_assets();
+    if(m_culling_enabled && bvh.get_num_items() == num_scene_models)
+    {
+        bvh.query_frustum(frustum, m_scheduler, m_visible_models);
+    }
+    else
+    {
+        m_visible_models.resize(num_scene_models);
+        std::iota(m_visible_models.begin(), m_visible_models.end(), 0);
+    }
+
+    // count the placements of each asset first, every mesh of an asset gets a batch with room for all of them
+    m_asset_batches.clear();
+    for(u32 model_index : m_visible_models)
+    {
+        ++m_asset_batches[model_assets[model_index]].num_models;
+    }
+
+    // lay the batches out back to back in the instance buffer, the batches of one asset share its range of models
+    m_draw_batches.clear();
+    u32 num_instances = 0;
+    u32 num_models = 0;
+    for(auto& [asset, asset_batches] : m_asset_batches)
+    {
+        asset_batches.cursor = num_models;
+        for(u32 i = 0; i < asset->meshes.size(); ++i)
+        {
+            m_draw_batches.push_back({asset, i, num_instances, 0, num_models, asset_batches.num_models});
+            num_instances += asset_batches.num_models;
+        }
+        num_models += asset_batches.num_models;
+    }
+
+    m_batch_models.resize(num_models);
+    for(u32 model_index : m_visible_models)
+    {
+        m_batch_models[m_asset_batches[model_assets[model_index]].cursor++] = model_index;
+    }
+
+    reserve_instances(num_instances);
+    auto* instances = reinterpret_cast<glm::mat4*>(m_buffer_pool.access(m_instance_buffers[m_current_frame])->mapped_data);
+
+    CullBatchesTask cull_task;
+    cull_task.init(m_draw_batches.data(), static_cast<u32>(m_draw_batches.size()), scene->get_transforms(), m_batch_models.data(), instances, &frustum, m_culling_enabled);
+    m_scheduler->AddTaskSetToPipe(&cull_task);
+    m_scheduler->WaitforTask(&cull_task);
+
+    // batches with nothing on screen don't need recording at all
+    u32 num_visible = 0;
+    for(const DrawBatch& batch : m_draw_batches)
+    {
+        num_visible += batch.instance_count;
+    }
+    m_draw_batches.erase(std::remove_if(m_draw_batches.begin(), m_draw_batches.end(), [](const DrawBatch& batch) { return batch.instance_count == 0; }), m_draw_batches.end());
+
+    m_draw_stats.draws = static_cast<u32>(m_draw_batches.size());
+    m_draw_stats.instances = num_visible;
+    m_draw_stats.culled_models = num_scene_models - static_cast<u32>(m_visible_models.size());
+    m_draw_stats.culled_instances = num_instances - num_visible;
+
+    queue_draw_batches();
+}
+
+void Renderer::queue_draw_batches()
+{
+    PROFILE_FUNCTION();
+
+    // there is only the one graphics pipeline so far, its bits are there for when there are more
+    m_render_queue.clear();
+    for(u32 i = 0; i < m_draw_batches.size(); ++i)
+    {
+        const DrawBatch& batch = m_draw_batches[i];
+        const Mesh& mesh = batch.asset->meshes[batch.mesh_index];
+        u32 material = get_material_key(batch.asset->materials[batch.mesh_index]);
+        m_render_queue.push(RenderQueue::make_key(0, material, mesh.geometry_block, batch.depth), i);
+    }
+
+    m_render_queue.sort(m_scheduler);
+}
+
+Renderer::RecordedDraw Renderer::get_recorded_draw(const DrawBatch& batch)
+{
+    const Mesh& mesh = batch.asset->meshes[batch.mesh_index];
+    const TextureHandle* textures = batch.asset->materials[batch.mesh_index].textures;
+
+    return {
+        .first_instance = batch.first_instance,
+        .instance_count = batch.instance_count,
+        .geometry_block = mesh.geometry_block,
+        .first_index = mesh.first_index,
+        .index_count = mesh.index_count,
+        .vertex_offset = mesh.vertex_offset,
+        .textures = { textures[0].index(), textures[1].index(), textures[2].index(), textures[3].index() }
+    };
+}
+
+bool Renderer::is_record_cache_valid(const RecordCache& cache, bool indirect) const
+{
+    PROFILE_FUNCTION();
+
+    if(!cache.valid || cache.indirect != indirect || cache.keys.size() != m_render_queue.size())
+    {
+        return false;
+    }
+
+    // depth only decides the order, which the draw indices already cover, so it can change freely
+    const DrawKey* keys = m_render_queue.data();
+    for(u32 i = 0; i < m_render_queue.size(); ++i)
+    {
+        const DrawKey& cached_key = cache.keys[i];
+        if(cached_key.draw != keys[i].draw || (cached_key.key >> RenderQueue::k_depth_bits) != (keys[i].key >> RenderQueue::k_depth_bits))
+        {
+            return false;
+        }
+
+        if(cache.draws[cached_key.draw] != get_recorded_draw(m_draw_batches[keys[i].draw]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Renderer::store_record_cache(RecordCache& cache, const vk::CommandBuffer* command_buffers, u32 count, bool indirect)
+{
+    cache.command_buffers.assign(command_buffers, command_buffers + count);
+    cache.draws.resize(m_draw_batches.size());
+    for(u32 i = 0; i < m_draw_batches.size(); ++i)
+    {
+        cache.draws[i] = get_recorded_draw(m_draw_batches[i]);
+    }
+    cache.keys.assign(m_render_queue.data(), m_render_queue.data() + m_render_queue.size());
+    cache.indirect = indirect;
+    cache.valid = true;
+}
+
+void Renderer::invalidate_record_caches()
+{
+    for(auto& cache : m_record_caches)
+    {
+        cache.valid = false;
+    }
+}
+
+void Renderer::build_record_chunks()
+{
+    PROFILE_FUNCTION();
+
+    // with GPU culling the instance count is every placement, so the cost is an upper bound rather than an estimate
+    auto get_cost = [this](const DrawKey& key)
+    {
+        const DrawBatch& batch = m_draw_batches[key.draw];
+        const Mesh& mesh = batch.asset->meshes[batch.mesh_index];
+        return k_draw_cost + static_cast<u64>(mesh.index_count) * batch.instance_count;
+    };
+
+    const DrawKey* keys = m_render_queue.data();
+    u32 num_keys = m_render_queue.size();
+
+    u64 total_cost = 0;
+    for(u32 i = 0; i < num_keys; ++i)
+    {
+        total_cost += get_cost(keys[i]);
+    }
+
+    // one batch heavier than the target just gets a chunk of its own
+    u32 max_chunks = m_scheduler->GetNumTaskThreads() * k_chunks_per_thread;
+    u64 target_cost = std::max<u64>(total_cost / max_chunks, 1);
+
+    m_record_chunks.clear();
+    u32 start = 0;
+    u64 chunk_cost = 0;
+    for(u32 i = 0; i < num_keys; ++i)
+    {
+        chunk_cost += get_cost(keys[i]);
+        if(chunk_cost >= target_cost)
+        {
+            m_record_chunks.push_back({start, i + 1});
+            start = i + 1;
+            chunk_cost = 0;
+        }
+    }
+
+    if(start < num_keys)
+    {
+        m_record_chunks.push_back({start, num_keys});
+    }
+}
+
+void Renderer::reserve_instances(u32 count)
+{
+    if(count <= m_instance_capacity[m_current_frame])
+    {
+        return;
+    }
+
+    // begin_frame waited on this slot's fence, so the old buffer and the camera set pointing at it are no longer in use
+    u32 capacity = std::max(count, m_instance_capacity[m_current_frame] * 2);
+    destroy_buffer(m_instance_buffers[m_current_frame]);
+    m_instance_buffers[m_current_frame] = create_buffer({
+        .usage = vk::BufferUsageFlagBits::eStorageBuffer,
+        .size = static_cast<u32>(capacity * sizeof(glm::mat4)),
+        .persistent = true
+    });
+    m_instance_capacity[m_current_frame] = capacity;
+
+    auto* buffer = m_buffer_pool.access(m_instance_buffers[m_current_frame]);
+    vk::DescriptorBufferInfo descriptor_info{};
+    descriptor_info.buffer = buffer->vk_buffer;
+    descriptor_info.offset = 0;
+    descriptor_info.range = buffer->size;
+
+    vk::WriteDescriptorSet descriptor_write{};
+    descriptor_write.sType = vk::StructureType::eWriteDescriptorSet;
+    descriptor_write.dstSet = m_descriptor_set_pool.access(m_camera_sets[m_current_frame])->vk_descriptor_set;
+    descriptor_write.dstBinding = 2;
+
+    // the set isn't update after bind, so writing it invalidates the slot's kept draw secondaries that bind it
+    m_record_caches[m_current_frame].valid = false;
+    descriptor_write.dstArrayElement = 0;
+    descriptor_write.descriptorType = vk::DescriptorType::eStorageBuffer;
+    descriptor_write.descriptorCount = 1;
+    descriptor_write.pBufferInfo = &descriptor_info;
+
+    std::lock_guard<std::mutex> lock(m_descriptor_mutex);
+    logical_device.updateDescriptorSets(1, &descriptor_write, 0, nullptr);
+}
+
+void Renderer::build_gpu_objects(const Scene* scene)
+{
+    PROFILE_FUNCTION();
+
+    // same layout as the CPU batches, except every placement of every asset gets a command whether it is visible or not
+    u32 num_scene_models = scene->get_num_models();
+    const ModelAsset* const* model_assets = scene->get_assets();
+    const glm::mat4* model_transforms = scene->get_transforms();
+
+    m_asset_batches.clear();
+    for(u32 i = 0; i < num_scene_models; ++i)
+    {
+        ++m_asset_batches[model_assets[i]].num_models;
+    }
+
+    m_draw_batches.clear();
+    u32 num_objects = 0;
+    for(auto& [asset, asset_batches] : m_asset_batches)
+    {
+        asset_batches.first_batch = static_cast<u32>(m_draw_batches.size());
+        for(u32 i = 0; i < asset->meshes.size(); ++i)
+        {
+            m_draw_batches.push_back({asset, i, num_objects, asset_batches.num_models, 0, asset_batches.num_models});
+            num_objects += asset_batches.num_models;
+        }
+    }
+
+    // an object's index is its command slot and where its transform goes, so each batch's objects are consecutive
+    m_gpu_objects.resize(num_objects);
+    m_gpu_transforms.resize(num_objects);
+    for(u32 model_index = 0; model_index < num_scene_models; ++model_index)
+    {
+        const ModelAsset* asset = model_assets[model_index];
+        AssetBatches& asset_batches = m_asset_batches[asset];
+        u32 placement = asset_batches.cursor++;
+
+        for(u32 i = 0; i < asset->meshes.size(); ++i)
+        {
+            u32 batch_index = asset_batches.first_batch + i;
+            const DrawBatch& batch = m_draw_batches[batch_index];
+            const Mesh& mesh = asset->meshes[i];
+            u32 object_index = batch.first_instance + placement;
+
+            m_gpu_transforms[object_index] = model_transforms[model_index] * asset->transforms[i];
+            m_gpu_objects[object_index] = {
+                .sphere = glm::vec4(mesh.sphere.center, mesh.sphere.radius),
+                .transform_index = object_index,
+                .first_index = mesh.first_index,
+                .index_count = mesh.index_count,
+                .vertex_offset = static_cast<i32>(mesh.vertex_offset),
+                .draw_group = batch_index,
+                .first_command = batch.first_instance
+            };
+        }
+    }
+
+    m_gpu_scene_version = scene->get_version();
+    ++m_gpu_objects_generation;
+
+    // which objects are visible is only known on the GPU, so these batches are ordered by state alone
+    queue_draw_batches();
+}
+
+void Renderer::upload_gpu_objects()
+{
+    GPUCullFrame& frame = m_cull_frames[m_current_frame];
+    if(frame.generation == m_gpu_objects_generation)
+    {
+        return;
+    }
+
+    PROFILE_FUNCTION();
+
+    // begin_frame waited on this slot's fence, so like reserve_instances its buffers can be replaced and its set rewritten
+    u32 num_objects = static_cast<u32>(m_gpu_objects.size());
+    u32 num_draws = static_cast<u32>(m_draw_batches.size());
+    reserve_instances(num_objects);
+
+    if(num_objects > frame.object_capacity)
+    {
+        u32 capacity = std::max(num_objects, frame.object_capacity * 2);
+        destroy_buffer(frame.objects);
+        destroy_buffer(frame.commands);
+        frame.objects = create_buffer({
+            .usage = vk::BufferUsageFlagBits::eStorageBuffer,
+            .size = static_cast<u32>(capacity * sizeof(GPUObject)),
+            .persistent = true
+        });
+        frame.commands = create_buffer({
+            .usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+            .size = static_cast<u32>(capacity * sizeof(vk::DrawIndexedIndirectCommand)),
+            .device_local = true
+        });
+        frame.object_capacity = capacity;
+
+        // the slot's kept draw secondaries read their commands from the old buffer
+        m_record_caches[m_current_frame].valid = false;
+    }
+
+    if(num_draws > frame.draw_capacity)
+    {
+        u32 capacity = std::max(num_draws, frame.draw_capacity * 2);
+        destroy_buffer(frame.counts);
+        frame.counts = create_buffer({
+            .usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+            .size = static_cast<u32>(capacity * sizeof(u32)),
+            .persistent = true
+        });
+        frame.draw_capacity = capacity;
+        m_record_caches[m_current_frame].valid = false;
+    }
+
+    memcpy(m_buffer_pool.access(frame.objects)->mapped_data, m_gpu_objects.data(), m_gpu_objects.size() * sizeof(GPUObject));
+    memcpy(m_buffer_pool.access(m_instance_buffers[m_current_frame])->mapped_data, m_gpu_transforms.data(), m_gpu_transforms.size() * sizeof(glm::mat4));
+
+    // any of the four may have been replaced, rewriting all of them is cheap next to the copies above
+    BufferHandle buffers[] = { frame.objects, m_instance_buffers[m_current_frame], frame.commands, frame.counts };
+    vk::DescriptorBufferInfo descriptor_infos[4];
+    vk::WriteDescriptorSet descriptor_writes[4];
+    for(u32 i = 0; i < 4; ++i)
+    {
+        auto* buffer = m_buffer_pool.access(buffers[i]);
+        descriptor_infos[i].buffer = buffer->vk_buffer;
+        descriptor_infos[i].offset = 0;
+        descriptor_infos[i].range = buffer->size;
+
+        descriptor_writes[i].sType = vk::StructureType::eWriteDescriptorSet;
+        descriptor_writes[i].dstSet = m_descriptor_set_pool.access(frame.descriptor_set)->vk_descriptor_set;
+        descriptor_writes[i].dstBinding = i;
+        descriptor_writes[i].dstArrayElement = 0;
+        descriptor_writes[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        descriptor_writes[i].descriptorCount = 1;
+        descriptor_writes[i].pBufferInfo = &descriptor_infos[i];
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_descriptor_mutex);
+        logical_device.updateDescriptorSets(4, descriptor_writes, 0, nullptr);
+    }
+
+    frame.generation = m_gpu_objects_generation;
+}
+
+void Renderer::record_cull_pass(vk::CommandBuffer command_buffer, const culling::Frustum& frustum)
+{
+    PROFILE_FUNCTION();
+
+    GPUCullFrame& frame = m_cull_frames[m_current_frame];
+
+    // the counts of the slot's last dispatch are final now that its fence has signalled,
+    // so the stats lag the frame being recorded by s_max_frames_in_flight like the GPU timings
+    auto* counts = m_buffer_pool.access(frame.counts);
+    vmaInvalidateAllocation(m_allocator, counts->vma_allocation, 0, VK_WHOLE_SIZE);
+    const u32* draw_counts = reinterpret_cast<const u32*>(counts->mapped_data);
+    u32 num_visible = std::accumulate(draw_counts, draw_counts + frame.num_draws, 0u);
+
+    upload_gpu_objects();
+
+    frame.num_objects = static_cast<u32>(m_gpu_objects.size());
+    frame.num_draws = static_cast<u32>(m_draw_batches.size());
+
+    m_draw_stats.draws = frame.num_draws;
+    m_draw_stats.instances = num_visible;
+    m_draw_stats.culled_models = 0;
+    m_draw_stats.culled_instances = frame.num_objects - std::min(num_visible, frame.num_objects);
+
+    // the shader counts up from zero, the host write is visible to it once the frame is submitted
+    counts = m_buffer_pool.access(frame.counts);
+    memset(counts->mapped_data, 0, frame.num_draws * sizeof(u32));
+    vmaFlushAllocation(m_allocator, counts->vma_allocation, 0, VK_WHOLE_SIZE);
+
+    if(frame.num_objects == 0)
+    {
+        return;
+    }
+
+    CullData cull_data{};
+    cull_data.num_objects = frame.num_objects;
+    for(u32 i = 0; i < 6; ++i)
+    {
+        // a plane nothing can be behind keeps every object when culling is turned off
+        cull_data.planes[i] = m_culling_enabled ? frustum.planes[i] : glm::vec4(0.f, 0.f, 0.f, 1.f);
+    }
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_cull_pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_cull_pipeline_layout, 0, 1, &m_descriptor_set_pool.access(frame.descriptor_set)->vk_descriptor_set, 0, nullptr);
+    command_buffer.pushConstants(m_cull_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(CullData), &cull_data);
+    command_buffer.dispatch((frame.num_objects + k_cull_group_size - 1) / k_cull_group_size, 1, 1);
+
+    // the draws read the commands and counts as indirect arguments, and the counts come back to the host next time round
+    vk::MemoryBarrier barrier{};
+    barrier.sType = vk::StructureType::eMemoryBarrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eHostRead;
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eHost,
+                                   vk::DependencyFlags(), 1, &barrier, 0, nullptr, 0, nullptr);
 }
 
 void Renderer::begin_frame()
 {
+    PROFILE_FUNCTION();
+
     // takes array of fences and waits for any and all fences
     // saying VK_TRUE means we want to wait for all fences
     // last param is the timeout which we basically disable
+    Timer wait_timer;
+    PROFILE_BEGIN("waitForFences");
     vk::Result result = logical_device.waitForFences(1, &m_in_flight_fences[m_current_frame], true, UINT64_MAX);
+    PROFILE_END();
+    m_frame_timings.fence_wait = wait_timer.stop();
+
+    // nothing from this slot's last frame is still executing, so all of its command buffers go back at once
+    m_command_pool_ring.reset(m_current_frame);
+    m_primary_command_buffer = &m_command_pool_ring.get_command_buffer(m_current_frame, 0, vk::CommandBufferLevel::ePrimary);
 
-    // logical device and swapchain we want to get the image from
-    // third param is timeout for image to become available
-    // next 2 params are sync objects to be signaled when presentation engine is done with the image
-    result = logical_device.acquireNextImageKHR(m_swapchain, UINT64_MAX, m_image_available_semaphores[m_current_frame], nullptr, &m_image_index);
+    // the fence means this frame slot's queries from last time are finished
+    read_gpu_stats();
 
-    // if swapchain is not good we immediately recreate and try again in the next frame
-    if(result == vk::Result::eErrorOutOfDateKHR)
+    // anything a loader recorded but didn't flush goes out now, and finished uploads release their staging memory
+    m_upload_queue.flush();
+    m_upload_queue.collect();
+
+    Timer acquire_timer;
+
+    if(is_headless())
     {
-        recreate_swapchain();
-        return;
+        // offscreen targets are owned by us, so each frame in flight just uses its own
+        m_image_index = m_current_frame;
     }
+    else
+    {
+        // logical device and swapchain we want to get the image from
+        // third param is timeout for image to become available
+        // next 2 params are sync objects to be signaled when presentation engine is done with the image
+        PROFILE_SCOPE("acquireNextImageKHR");
+        result = logical_device.acquireNextImageKHR(m_swapchain, UINT64_MAX, m_image_available_semaphores[m_current_frame], nullptr, &m_image_index);
+
+        // if swapchain is not good we immediately recreate and try again in the next frame
+        if(result == vk::Result::eErrorOutOfDateKHR)
+        {
+            recreate_swapchain();
+            return;
+        }
+    }
+    m_frame_timings.acquire = acquire_timer.stop();
 
     // need to reset fences to unsignaled
     // but only reset if we are submitting work
     result = logical_device.resetFences(1, &m_in_flight_fences[m_current_frame]);
 
-    m_primary_command_buffers[m_current_frame].begin();
-//    for(u32 i = 0; i < m_scheduler->GetNumTaskThreads(); ++i)
-//    {
-//        logical_device.resetCommandPool(m_command_pools[i]);
-//    }
+    m_primary_command_buffer->begin();
 
-    // all functions that record commands can be recognized by their vk::Cmd prefix
-    // they all return void, so no error handling until the recording is finished
-    m_primary_command_buffers[m_current_frame].begin_renderpass(m_render_pass, m_swapchain_framebuffers[m_image_index], m_swapchain_extent, vk::SubpassContents::eSecondaryCommandBuffers);
+    // queries have to be reset before they can be written again and that can't happen inside a render pass
+    vk::CommandBuffer primary = m_primary_command_buffer->vk_command_buffer;
+    if(m_timestamps_supported)
+    {
+        primary.resetQueryPool(m_timestamp_pool, get_timestamp_index(0), m_timestamps_per_frame);
+        primary.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, m_timestamp_pool, get_timestamp_index(0));
+    }
+
+    if(m_statistics_supported)
+    {
+        primary.resetQueryPool(m_statistics_pool, m_current_frame, 1);
+        primary.beginQuery(m_statistics_pool, m_current_frame, vk::QueryControlFlags());
+    }
 }
 
 void Renderer::end_frame()
 {
-    m_primary_command_buffers[m_current_frame].end_renderpass();
-    m_primary_command_buffers[m_current_frame].end();
+    PROFILE_FUNCTION();
+
+    m_primary_command_buffer->end_renderpass();
+
+    vk::CommandBuffer primary = m_primary_command_buffer->vk_command_buffer;
+    if(m_timestamps_supported)
+    {
+        primary.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, m_timestamp_pool, get_timestamp_index(1));
+    }
+
+    if(m_statistics_supported)
+    {
+        primary.endQuery(m_statistics_pool, m_current_frame);
+    }
+    m_queries_written[m_current_frame] = m_timestamps_supported || m_statistics_supported;
+
+    m_primary_command_buffer->end();
 
     vk::SubmitInfo submit_info{};
     submit_info.sType = vk::StructureType::eSubmitInfo;
 
     // we are specifying what semaphores we want to use and what stage we want to wait on
-    vk::Semaphore wait_semaphores[] = {m_image_available_semaphores[m_current_frame]};
-    vk::PipelineStageFlags wait_stages[] = {vk::PipelineStageFlagBits::eColorAttachmentOutput};
-    submit_info.waitSemaphoreCount = 1;
-    submit_info.pWaitSemaphores = wait_semaphores;
-    submit_info.pWaitDstStageMask = wait_stages;
+    // headless frames have no image to acquire or present, so there is nothing to wait on or signal
+    // the upload timeline is always waited on so nothing is drawn before its data has arrived
+    std::array<vk::Semaphore, 2> wait_semaphores;
+    std::array<vk::PipelineStageFlags, 2> wait_stages;
+    std::array<u64, 2> wait_values{}; // ignored for the binary semaphore
+    u32 wait_count = 0;
+
+    if(!is_headless())
+    {
+        wait_semaphores[wait_count] = m_image_available_semaphores[m_current_frame];
+        wait_stages[wait_count] = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+        ++wait_count;
+    }
+
+    wait_semaphores[wait_count] = m_upload_queue.get_timeline();
+    wait_stages[wait_count] = vk::PipelineStageFlagBits::eAllCommands;
+    wait_values[wait_count] = m_upload_queue.get_submitted_ticket();
+    ++wait_count;
+
+    vk::TimelineSemaphoreSubmitInfo timeline_info{};
+    timeline_info.sType = vk::StructureType::eTimelineSemaphoreSubmitInfo;
+    timeline_info.waitSemaphoreValueCount = wait_count;
+    timeline_info.pWaitSemaphoreValues = wait_values.data();
+
+    submit_info.pNext = &timeline_info;
+    submit_info.waitSemaphoreCount = wait_count;
+    submit_info.pWaitSemaphores = wait_semaphores.data();
+    submit_info.pWaitDstStageMask = wait_stages.data();
 
     // which command buffers to submit
     submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &m_primary_command_buffers[m_current_frame].vk_command_buffer;
+    submit_info.pCommandBuffers = &m_primary_command_buffer->vk_command_buffer;
 
     // which semaphores to signal once the command buffer is finished
     vk::Semaphore signal_semaphores[] = {m_render_finished_semaphores[m_current_frame]};
-    submit_info.signalSemaphoreCount = 1;
+    submit_info.signalSemaphoreCount = is_headless() ? 0 : 1;
     submit_info.pSignalSemaphores = signal_semaphores;
 
-    if(m_graphics_queue.submit(1, &submit_info, m_in_flight_fences[m_current_frame]) != vk::Result::eSuccess)
+    Timer submit_timer;
     {
-        throw std::runtime_error("failed to submit draw command!");
+        PROFILE_SCOPE("Queue submit");
+        std::lock_guard<std::mutex> lock(m_queue_mutex);
+        if(m_graphics_queue.submit(1, &submit_info, m_in_flight_fences[m_current_frame]) != vk::Result::eSuccess)
+        {
+            throw std::runtime_error("failed to submit draw command!");
+        }
+    }
+    m_frame_timings.submit = submit_timer.stop();
+
+    if(is_headless())
+    {
+        return;
     }
 
     // last step is to submit the result back to the swapchain
@@ -342,7 +1200,14 @@ void Renderer::end_frame()
     // can get an array of vk::Result to check every swapchain to see if presentation was successful
     present_info.pResults = nullptr;
 
-    vk::Result result = m_present_queue.presentKHR(&present_info);
+    Timer present_timer;
+    vk::Result result;
+    {
+        PROFILE_SCOPE("presentKHR");
+        std::lock_guard<std::mutex> lock(m_queue_mutex);
+        result = m_present_queue.presentKHR(&present_info);
+    }
+    m_frame_timings.present = present_timer.stop();
 
     if(result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR)
     {
@@ -352,6 +1217,12 @@ void Renderer::end_frame()
 
 void Renderer::recreate_swapchain()
 {
+    // offscreen targets never go out of date
+    if(is_headless())
+    {
+        return;
+    }
+
     int width = 0, height = 0;
     glfwGetFramebufferSize(m_window, &width, &height);
     while (width == 0 || height == 0) {
@@ -364,6 +1235,9 @@ void Renderer::recreate_swapchain()
     init_swapchain();
     init_depth_resources();
     init_framebuffers();
+
+    // the kept draw secondaries have the old extent baked into their viewport and scissor
+    invalidate_record_caches();
 }
 
 void Renderer::configure_lighting(LightingData data)
@@ -371,7 +1245,7 @@ void Renderer::configure_lighting(LightingData data)
     m_light_data = data;
     for(int i = 0; i < s_max_frames_in_flight; ++i)
     {
-        auto* buffer = static_cast<Buffer*>(m_buffer_pool.access(m_light_buffers[i]));
+        auto* buffer = m_buffer_pool.access(m_light_buffers[i]);
         memcpy(buffer->mapped_data, &m_light_data, pad_uniform_buffer(sizeof(m_light_data)));
     }
 }
@@ -471,6 +1345,9 @@ void Renderer::init_device()
     physical_device_features12.runtimeDescriptorArray = true;
     physical_device_features12.shaderSampledImageArrayNonUniformIndexing = true;
 
+    // upload batches are tracked with a timeline semaphore
+    physical_device_features12.timelineSemaphore = true;
+
     vk::DeviceCreateInfo create_info{};
     create_info.sType = vk::StructureType::eDeviceCreateInfo;
 
@@ -487,7 +1364,29 @@ void Renderer::init_device()
         create_info.enabledLayerCount = 0;
     }
 
-    m_physical_device = DeviceHelper::pick_physical_device(m_instance);
+    const std::vector<const char*>& device_extensions = is_headless() ? g_headless_device_extensions : g_device_extensions;
+
+    m_physical_device = DeviceHelper::pick_physical_device(m_instance, device_extensions);
+
+    // pipeline statistics are only worth it if they keep counting through our secondary command buffers
+    vk::PhysicalDeviceFeatures supported_features;
+    m_physical_device.getFeatures(&supported_features);
+    m_statistics_supported = supported_features.pipelineStatisticsQuery && supported_features.inheritedQueries;
+    physical_device_features.pipelineStatisticsQuery = m_statistics_supported;
+    physical_device_features.inheritedQueries = m_statistics_supported;
+
+    // culling on the GPU reads each batch's draw count from a buffer and points first instance at the object's transform
+    vk::PhysicalDeviceVulkan12Features supported_features12{};
+    supported_features12.sType = vk::StructureType::ePhysicalDeviceVulkan12Features;
+    vk::PhysicalDeviceFeatures2 supported_features2{};
+    supported_features2.sType = vk::StructureType::ePhysicalDeviceFeatures2;
+    supported_features2.pNext = &supported_features12;
+    m_physical_device.getFeatures2(&supported_features2);
+    m_gpu_culling_supported = supported_features12.drawIndirectCount && supported_features.drawIndirectFirstInstance;
+    m_gpu_culling_enabled = m_gpu_culling_supported;
+    physical_device_features12.drawIndirectCount = m_gpu_culling_supported;
+    physical_device_features.drawIndirectFirstInstance = m_gpu_culling_supported;
+
     QueueFamilyIndices indices = DeviceHelper::find_queue_families(m_physical_device, m_surface);
 
     std::vector<vk::DeviceQueueCreateInfo> queue_create_infos;
@@ -520,8 +1419,8 @@ void Renderer::init_device()
     // previous versions of Vulkan had a distinction between instance and device specific validation layers
     // meaning enabledLayerCount and ppEnabledLayerNames field are ignored
     // it is still a good idea to set them to be compatible with older versions
-    create_info.enabledExtensionCount = static_cast<unsigned>(g_device_extensions.size());
-    create_info.ppEnabledExtensionNames = g_device_extensions.data();
+    create_info.enabledExtensionCount = static_cast<unsigned>(device_extensions.size());
+    create_info.ppEnabledExtensionNames = device_extensions.data();
 
 
 
@@ -545,6 +1444,21 @@ void Renderer::init_device()
     vma_info.instance = m_instance;
 
     vmaCreateAllocator(&vma_info, &m_allocator);
+
+    // resizable BAR (or an integrated GPU) exposes device local memory to the CPU well past the usual 256MB window
+    vk::PhysicalDeviceMemoryProperties memory_properties;
+    m_physical_device.getMemoryProperties(&memory_properties);
+
+    vk::MemoryPropertyFlags bar_flags = vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+    for(u32 i = 0; i < memory_properties.memoryTypeCount; ++i)
+    {
+        const vk::MemoryType& memory_type = memory_properties.memoryTypes[i];
+        if((memory_type.propertyFlags & bar_flags) == bar_flags && memory_properties.memoryHeaps[memory_type.heapIndex].size > 256ull * 1024 * 1024)
+        {
+            m_rebar_supported = true;
+            break;
+        }
+    }
 }
 
 void Renderer::create_image(u32 width, u32 height, vk::Format format, vk::ImageTiling tiling, vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Image &image, vk::DeviceMemory &image_memory)
@@ -599,7 +1513,7 @@ void Renderer::create_image(u32 width, u32 height, vk::Format format, vk::ImageT
     logical_device.bindImageMemory(image, image_memory, 0);
 }
 
-vk::ImageView Renderer::create_image_view(const vk::Image& image, vk::Format format, vk::ImageAspectFlags image_aspect)
+vk::ImageView Renderer::create_image_view(const vk::Image& image, vk::Format format, vk::ImageAspectFlags image_aspect, u32 mip_levels)
 {
     vk::ImageViewCreateInfo create_info{};
     create_info.sType = vk::StructureType::eImageViewCreateInfo;
@@ -618,10 +1532,10 @@ vk::ImageView Renderer::create_image_view(const vk::Image& image, vk::Format for
     create_info.components.a = vk::ComponentSwizzle::eIdentity;
 
     // describes what the image's purpose is and which part of the image should be used
-    // these images will be used as colour targets without any mipmapping
+    // render targets only have the one level, textures cover their whole mip chain
     create_info.subresourceRange.aspectMask = image_aspect;
     create_info.subresourceRange.baseMipLevel = 0;
-    create_info.subresourceRange.levelCount = 1;
+    create_info.subresourceRange.levelCount = mip_levels;
     create_info.subresourceRange.baseArrayLayer = 0;
     create_info.subresourceRange.layerCount = 1;
 
@@ -634,10 +1548,15 @@ vk::ImageView Renderer::create_image_view(const vk::Image& image, vk::Format for
     return image_view;
 }
 
-u32 Renderer::create_buffer(const BufferCreationInfo& buffer_creation)
+BufferHandle Renderer::create_buffer(const BufferCreationInfo& buffer_creation)
 {
-    u32 handle = m_buffer_pool.acquire();
-    auto* buffer = static_cast<Buffer*>(m_buffer_pool.access(handle));
+    if(buffer_creation.device_local)
+    {
+        return create_device_local_buffer(buffer_creation);
+    }
+
+    BufferHandle handle = m_buffer_pool.acquire();
+    auto* buffer = m_buffer_pool.access(handle);
 
     buffer->size = buffer_creation.size;
 
@@ -653,43 +1572,354 @@ u32 Renderer::create_buffer(const BufferCreationInfo& buffer_creation)
 
     if(buffer_creation.persistent)
     {
-        memory_info.flags |= VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        memory_info.flags |= VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    }
+
+    VmaAllocationInfo allocation_info{};
+    vmaCreateBuffer(m_allocator, reinterpret_cast<const VkBufferCreateInfo*>(&buffer_info), &memory_info,
+                    &buffer->vk_buffer, &buffer->vma_allocation, &allocation_info);
+
+    if(buffer_creation.data)
+    {
+        void* data;
+        vmaMapMemory(m_allocator, buffer->vma_allocation, &data);
+        memcpy(data, buffer_creation.data, (size_t)buffer_creation.size);
+        vmaUnmapMemory(m_allocator, buffer->vma_allocation);
+    }
+
+    if(buffer_creation.persistent)
+    {
+        buffer->mapped_data = static_cast<u8*>(allocation_info.pMappedData);
+    }
+
+    return handle;
+}
+
+BufferHandle Renderer::create_device_local_buffer(const BufferCreationInfo& buffer_creation)
+{
+    PROFILE_FUNCTION();
+
+    BufferHandle handle = m_buffer_pool.acquire();
+    auto* buffer = m_buffer_pool.access(handle);
+
+    buffer->size = buffer_creation.size;
+
+    vk::BufferCreateInfo buffer_info{};
+    buffer_info.sType = vk::StructureType::eBufferCreateInfo;
+    buffer_info.size = buffer_creation.size;
+    buffer_info.usage = buffer_creation.usage | vk::BufferUsageFlagBits::eTransferDst;
+    buffer_info.sharingMode = vk::SharingMode::eExclusive;
+
+    VmaAllocationCreateInfo memory_info{};
+    VmaAllocationInfo allocation_info{};
+
+    // with resizable BAR the CPU can write straight into VRAM, which saves the staging copy entirely
+    if(m_rebar_supported)
+    {
+        memory_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        memory_info.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+        if(vmaCreateBuffer(m_allocator, reinterpret_cast<const VkBufferCreateInfo*>(&buffer_info), &memory_info,
+                           &buffer->vk_buffer, &buffer->vma_allocation, &allocation_info) == VK_SUCCESS)
+        {
+            if(buffer_creation.data)
+            {
+                memcpy(allocation_info.pMappedData, buffer_creation.data, (size_t)buffer_creation.size);
+            }
+
+            if(buffer_creation.persistent)
+            {
+                buffer->mapped_data = static_cast<u8*>(allocation_info.pMappedData);
+            }
+
+            return handle;
+        }
+
+        // the BAR heap can still run out, in that case take the staged path like everyone else
+        memory_info = {};
+    }
+
+    memory_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    if(vmaCreateBuffer(m_allocator, reinterpret_cast<const VkBufferCreateInfo*>(&buffer_info), &memory_info,
+                       &buffer->vk_buffer, &buffer->vma_allocation, &allocation_info) != VK_SUCCESS)
+    {
+        m_buffer_pool.free(handle);
+        throw std::runtime_error("failed to create device local buffer!");
+    }
+
+    if(buffer_creation.data)
+    {
+        BufferHandle dedicated_staging;
+        StagingRing::Allocation staging = stage_data(buffer_creation.data, buffer_creation.size, dedicated_staging);
+
+        UploadQueue::Ticket ticket = m_upload_queue.upload_buffer(staging.buffer, staging.offset, buffer->vk_buffer, 0, buffer_creation.size);
+        release_staging(staging, dedicated_staging, ticket);
+    }
+
+    return handle;
+}
+
+StagingRing::Allocation Renderer::stage_data(const void* data, vk::DeviceSize size, BufferHandle& dedicated_staging)
+{
+    StagingRing::Allocation staging = m_staging_ring.allocate(size);
+
+    if(staging.data)
+    {
+        memcpy(staging.data, data, (size_t)size);
+    }
+    else
+    {
+        dedicated_staging = create_buffer({
+           .usage = vk::BufferUsageFlagBits::eTransferSrc,
+           .size = (u32)size,
+           .data = const_cast<void*>(data)
+        });
+        staging.buffer = m_buffer_pool.access(dedicated_staging)->vk_buffer;
+    }
+
+    return staging;
+}
+
+void Renderer::release_staging(const StagingRing::Allocation& staging, BufferHandle dedicated_staging, UploadQueue::Ticket ticket)
+{
+    // staging memory has to stay around until the copy has actually happened
+    if(staging.data)
+    {
+        m_staging_ring.retire(staging, ticket);
+    }
+    else
+    {
+        m_upload_queue.on_complete([this, dedicated_staging]() { destroy_buffer(dedicated_staging); });
+    }
+}
+
+void Renderer::write_buffer(BufferHandle buffer_handle, vk::DeviceSize offset, const void* data, vk::DeviceSize size)
+{
+    if(size == 0)
+    {
+        return;
+    }
+
+    auto* buffer = m_buffer_pool.access(buffer_handle);
+    if(buffer->mapped_data)
+    {
+        memcpy(buffer->mapped_data + offset, data, (size_t)size);
+        return;
+    }
+
+    BufferHandle dedicated_staging;
+    StagingRing::Allocation staging = stage_data(data, size, dedicated_staging);
+
+    UploadQueue::Ticket ticket = m_upload_queue.upload_buffer(staging.buffer, staging.offset, buffer->vk_buffer, offset, size);
+    release_staging(staging, dedicated_staging, ticket);
+}
+
+void Renderer::create_mesh(const Vertex* vertices, u32 vertex_count, const u32* indices, u32 index_count, Mesh& mesh)
+{
+    PROFILE_FUNCTION();
+
+    GeometryAllocation allocation = m_geometry_arena.allocate(vertex_count, index_count);
+
+    mesh.geometry_block = allocation.block;
+    mesh.vertex_offset = allocation.vertex_offset;
+    mesh.vertex_count = vertex_count;
+    mesh.first_index = allocation.first_index;
+    mesh.index_count = index_count;
+
+    const GeometryBlock& block = m_geometry_arena.get_block(allocation.block);
+    write_buffer(block.vertex_buffer, allocation.vertex_offset * sizeof(Vertex), vertices, vertex_count * sizeof(Vertex));
+    write_buffer(block.index_buffer, allocation.first_index * sizeof(u32), indices, index_count * sizeof(u32));
+}
+
+void Renderer::destroy_mesh(const Mesh& mesh)
+{
+    GeometryAllocation allocation;
+    allocation.block = mesh.geometry_block;
+    allocation.vertex_offset = mesh.vertex_offset;
+    allocation.first_index = mesh.first_index;
+
+    m_geometry_arena.free(allocation, mesh.vertex_count, mesh.index_count);
+}
+
+bool Renderer::claim_texture(const char* path, std::promise<TextureHandle>& promise, std::shared_future<TextureHandle>& future)
+{
+    std::lock_guard<std::mutex> lock(m_texture_map_mutex);
+    if(auto it = m_texture_map.find(path); it != m_texture_map.end())
+    {
+        // might still be loading on another thread, in which case wait for it instead of loading the file twice
+        future = it->second;
+        return false;
+    }
+
+    future = promise.get_future().share();
+    m_texture_map.emplace(path, future);
+    return true;
+}
+
+void Renderer::fail_texture_claim(const char* path, std::promise<TextureHandle>& promise)
+{
+    // let anyone waiting see the failure and allow a later retry
+    {
+        std::lock_guard<std::mutex> lock(m_texture_map_mutex);
+        m_texture_map.erase(path);
+    }
+    promise.set_exception(std::current_exception());
+}
+
+TextureHandle Renderer::create_texture(const TextureCreationInfo& texture_creation)
+{
+    std::promise<TextureHandle> texture_promise;
+    std::shared_future<TextureHandle> texture_future;
+    if(!claim_texture(texture_creation.image_src, texture_promise, texture_future))
+    {
+        PROFILE_SCOPE("Wait for texture");
+        return texture_future.get();
+    }
+
+    TextureHandle handle;
+    try
+    {
+        handle = load_texture(texture_creation);
+    }
+    catch(...)
+    {
+        fail_texture_claim(texture_creation.image_src, texture_promise);
+        throw;
+    }
+
+    texture_promise.set_value(handle);
+    return handle;
+}
+
+void Renderer::create_textures(const TextureCreationInfo* texture_creations, u32 count, TextureHandle* texture_handles)
+{
+    PROFILE_FUNCTION();
+
+    std::vector<std::promise<TextureHandle>> texture_promises(count);
+    std::vector<std::shared_future<TextureHandle>> texture_futures(count);
+
+    // only the textures nobody else has started on are loaded here
+    std::vector<u32> requests;
+    for(u32 i = 0; i < count; ++i)
+    {
+        if(claim_texture(texture_creations[i].image_src, texture_promises[i], texture_futures[i]))
+        {
+            requests.push_back(i);
+        }
+    }
+
+    auto complete = [&](u32 request, const std::function<TextureHandle()>& load)
+    {
+        try
+        {
+            texture_promises[request].set_value(load());
+        }
+        catch(...)
+        {
+            fail_texture_claim(texture_creations[request].image_src, texture_promises[request]);
+        }
+    };
+
+    // ktx2 files are uploaded as they are, everything else is decoded on the workers
+    DecodeCompletionQueue completed;
+    std::vector<DecodeTextureTask> decode_tasks(requests.size());
+    u32 num_decodes = 0;
+
+    for(u32 request : requests)
+    {
+        if(std::filesystem::path(texture_creations[request].image_src).extension() != ".ktx2")
+        {
+            decode_tasks[num_decodes].init(texture_creations[request].image_src, request, &completed);
+            m_scheduler->AddTaskSetToPipe(&decode_tasks[num_decodes]);
+            ++num_decodes;
+        }
     }
 
-    VmaAllocationInfo allocation_info{};
-    vmaCreateBuffer(m_allocator, reinterpret_cast<const VkBufferCreateInfo*>(&buffer_info), &memory_info,
-                    &buffer->vk_buffer, &buffer->vma_allocation, &allocation_info);
+    for(u32 request : requests)
+    {
+        if(std::filesystem::path(texture_creations[request].image_src).extension() == ".ktx2")
+        {
+            complete(request, [&]() { return load_ktx2_texture(texture_creations[request]); });
+        }
+    }
 
-    if(buffer_creation.data)
+    // upload in whatever order the decodes finish, and help with the remaining ones while nothing is ready
+    // only high priority tasks are run while waiting so this thread never picks up another model load
+    u32 num_uploaded = 0;
+    u32 next_wait = 0;
+    while(num_uploaded < num_decodes)
     {
-        void* data;
-        vmaMapMemory(m_allocator, buffer->vma_allocation, &data);
-        memcpy(data, buffer_creation.data, (size_t)buffer_creation.size);
-        vmaUnmapMemory(m_allocator, buffer->vma_allocation);
+        DecodedTexture decoded;
+        if(completed.try_pop(decoded))
+        {
+            complete(decoded.request, [&]() { return upload_texture(texture_creations[decoded.request], decoded.pixels, decoded.width, decoded.height); });
+            ++num_uploaded;
+            continue;
+        }
+
+        while(next_wait < num_decodes && decode_tasks[next_wait].GetIsComplete())
+        {
+            ++next_wait;
+        }
+
+        if(next_wait < num_decodes)
+        {
+            m_scheduler->WaitforTask(&decode_tasks[next_wait], enki::TASK_PRIORITY_HIGH);
+        }
     }
 
-    if(buffer_creation.persistent)
+    // the tasks can still be finishing up after their push, they live on this stack
+    for(u32 i = 0; i < num_decodes; ++i)
     {
-        buffer->mapped_data = static_cast<u8*>(allocation_info.pMappedData);
+        m_scheduler->WaitforTask(&decode_tasks[i], enki::TASK_PRIORITY_HIGH);
     }
 
-    return handle;
+    for(u32 i = 0; i < count; ++i)
+    {
+        PROFILE_SCOPE("Wait for texture");
+        texture_handles[i] = texture_futures[i].get();
+    }
 }
 
-u32 Renderer::create_texture(const TextureCreationInfo& texture_creation)
+TextureHandle Renderer::load_texture(const TextureCreationInfo& texture_creation)
 {
-    if(m_texture_map.contains(texture_creation.image_src))
+    if(std::filesystem::path(texture_creation.image_src).extension() == ".ktx2")
     {
-        return m_texture_map[texture_creation.image_src];
+        return load_ktx2_texture(texture_creation);
     }
 
-    u32 handle = m_texture_pool.acquire();
-    auto* texture = static_cast<Texture*>(m_texture_pool.access(handle));
+    PROFILE_FUNCTION();
 
-    stbi_set_flip_vertically_on_load(1);
+    // the global flip flag would be a data race with loaders on other threads
+    stbi_set_flip_vertically_on_load_thread(1);
 
     int width, height, channels;
+    PROFILE_BEGIN("stbi_load");
     stbi_uc* pixels = stbi_load(texture_creation.image_src, &width, &height, &channels, STBI_rgb_alpha);
+    PROFILE_END();
+
+    return upload_texture(texture_creation, pixels, width, height);
+}
+
+TextureHandle Renderer::upload_texture(const TextureCreationInfo& texture_creation, unsigned char* pixels, i32 width, i32 height)
+{
+    PROFILE_FUNCTION();
+
+    if(!pixels)
+    {
+        throw std::runtime_error("failed to load texture image!");
+    }
+
+    TextureHandle handle = m_texture_pool.acquire();
+    if(handle.index() >= k_max_bindless_resources)
+    {
+        m_texture_pool.free(handle);
+        stbi_image_free(pixels);
+        throw std::runtime_error("ran out of bindless texture slots!");
+    }
+
+    auto* texture = m_texture_pool.access(handle);
 
     vk::DeviceSize image_size = width * height * 4;
 
@@ -697,18 +1927,17 @@ u32 Renderer::create_texture(const TextureCreationInfo& texture_creation)
     texture->height = height;
     texture->name = texture_creation.image_src;
 
-    if(!pixels)
+    // full chain down to 1x1, generated on the GPU with linear blits so the format has to support filtering them
+    u32 mip_levels = 1;
+    vk::FormatProperties format_properties = m_physical_device.getFormatProperties(texture_creation.format);
+    if(format_properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImageFilterLinear)
     {
-        throw std::runtime_error("failed to load texture image!");
+        mip_levels = static_cast<u32>(std::floor(std::log2(std::max(width, height)))) + 1;
     }
+    texture->mipmaps = static_cast<u8>(mip_levels);
 
-    u32 staging_handle = create_buffer({
-       .usage = vk::BufferUsageFlagBits::eTransferSrc,
-       .size = (u32)image_size,
-       .data = pixels
-    });
-
-    auto* staging_buffer = static_cast<Buffer*>(m_buffer_pool.access(staging_handle));
+    BufferHandle dedicated_staging;
+    StagingRing::Allocation staging = stage_data(pixels, image_size, dedicated_staging);
 
     stbi_image_free(pixels);
 
@@ -718,7 +1947,7 @@ u32 Renderer::create_texture(const TextureCreationInfo& texture_creation)
     image_info.extent.width = static_cast<u32>(width);
     image_info.extent.height = static_cast<u32>(height);
     image_info.extent.depth = 1;
-    image_info.mipLevels = 1;
+    image_info.mipLevels = mip_levels;
     image_info.arrayLayers = 1;
 
     // use the same format for the texels as the pixels in the buffer
@@ -732,7 +1961,8 @@ u32 Renderer::create_texture(const TextureCreationInfo& texture_creation)
 
     // image will be used as a destination to copy the pixel data to
     // also want to be able to access the image from the shader
-    image_info.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+    // and each mip level is blitted from the one above it
+    image_info.usage = vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
 
     // will only be used by one queue family
     image_info.sharingMode = vk::SharingMode::eExclusive;
@@ -745,25 +1975,134 @@ u32 Renderer::create_texture(const TextureCreationInfo& texture_creation)
 
     vmaCreateImage(m_allocator, reinterpret_cast<const VkImageCreateInfo*>(&image_info), &memory_info, &texture->vk_image, &texture->vma_allocation, nullptr);
 
-    transition_image_layout(texture->vk_image, texture_creation.format, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal);
+    // recorded into the current upload batch, the frame that first draws with it waits on the batch
+    UploadQueue::Ticket ticket = m_upload_queue.upload_image(staging.buffer, staging.offset, texture->vk_image, static_cast<unsigned>(width), static_cast<unsigned>(height), mip_levels);
+    texture->vk_image_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    texture->vk_image_view = create_image_view(texture->vk_image, texture_creation.format, vk::ImageAspectFlagBits::eColor, mip_levels);
+
+    release_staging(staging, dedicated_staging, ticket);
+
+    return handle;
+}
+
+// block compressed files written by the texture converter, the mip chain is already in the file so nothing is decoded
+TextureHandle Renderer::load_ktx2_texture(const TextureCreationInfo& texture_creation)
+{
+    PROFILE_FUNCTION();
+
+    std::vector<u8> file = util::read_binary_file(texture_creation.image_src);
+
+    ktx2::Header header{};
+    if(file.size() < sizeof(header))
+    {
+        throw std::runtime_error("invalid KTX2 file!");
+    }
+    memcpy(&header, file.data(), sizeof(header));
+
+    // only what the converter writes, single 2D images without supercompression
+    if(!ktx2::check_identifier(header) || header.supercompression_scheme != 0 || header.face_count != 1 ||
+       header.layer_count > 1 || header.pixel_depth > 1 || header.level_count == 0 || ktx2::get_block_size(header.vk_format) == 0)
+    {
+        throw std::runtime_error("unsupported KTX2 file!");
+    }
+
+    // a full chain of a w x h image has bit_width(max(w, h)) levels, anything past that has no size
+    if(header.pixel_width == 0 || header.pixel_height == 0 ||
+       header.level_count > static_cast<u32>(std::bit_width(std::max(header.pixel_width, header.pixel_height))))
+    {
+        throw std::runtime_error("invalid KTX2 file!");
+    }
+
+    vk::Format format = static_cast<vk::Format>(header.vk_format);
+    vk::FormatProperties format_properties = m_physical_device.getFormatProperties(format);
+    if(!(format_properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage))
+    {
+        throw std::runtime_error("device does not support the KTX2 texture format!");
+    }
+
+    u32 mip_levels = header.level_count;
+    if(file.size() < sizeof(header) + mip_levels * sizeof(ktx2::LevelIndex))
+    {
+        throw std::runtime_error("invalid KTX2 file!");
+    }
+
+    std::vector<ktx2::LevelIndex> levels(mip_levels);
+    memcpy(levels.data(), file.data() + sizeof(header), mip_levels * sizeof(ktx2::LevelIndex));
+
+    // the levels are packed together, so the whole chain is staged with a single copy
+    // each has to lie within the file and hold every block of its level, or the copy would read past it
+    u64 block_size = ktx2::get_block_size(header.vk_format);
+    u64 data_start = UINT64_MAX;
+    u64 data_end = 0;
+    for(u32 i = 0; i < mip_levels; ++i)
+    {
+        const ktx2::LevelIndex& level = levels[i];
+        u64 blocks_x = (std::max(header.pixel_width >> i, 1u) + 3) / 4;
+        u64 blocks_y = (std::max(header.pixel_height >> i, 1u) + 3) / 4;
+
+        if(level.byte_offset > file.size() || level.byte_length > file.size() - level.byte_offset ||
+           level.byte_length < blocks_x * blocks_y * block_size)
+        {
+            throw std::runtime_error("invalid KTX2 file!");
+        }
+
+        data_start = std::min(data_start, level.byte_offset);
+        data_end = std::max(data_end, level.byte_offset + level.byte_length);
+    }
+
+    TextureHandle handle = m_texture_pool.acquire();
+    if(handle.index() >= k_max_bindless_resources)
+    {
+        m_texture_pool.free(handle);
+        throw std::runtime_error("ran out of bindless texture slots!");
+    }
 
-    copy_buffer_to_image(staging_buffer->vk_buffer, texture->vk_image, static_cast<unsigned>(width), static_cast<unsigned>(height));
+    auto* texture = m_texture_pool.access(handle);
+    texture->width = header.pixel_width;
+    texture->height = header.pixel_height;
+    texture->mipmaps = static_cast<u8>(mip_levels);
+    texture->vk_format = static_cast<VkFormat>(format);
+    texture->name = texture_creation.image_src;
+
+    BufferHandle dedicated_staging;
+    StagingRing::Allocation staging = stage_data(file.data() + data_start, data_end - data_start, dedicated_staging);
+
+    // level offsets in the file are block aligned, and so is the staging allocation
+    std::vector<vk::BufferImageCopy> regions(mip_levels);
+    for(u32 i = 0; i < mip_levels; ++i)
+    {
+        regions[i].bufferOffset = staging.offset + (levels[i].byte_offset - data_start);
+        regions[i].bufferRowLength = 0;
+        regions[i].bufferImageHeight = 0;
+        regions[i].imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+        regions[i].imageSubresource.mipLevel = i;
+        regions[i].imageSubresource.baseArrayLayer = 0;
+        regions[i].imageSubresource.layerCount = 1;
+        regions[i].imageOffset = vk::Offset3D{0, 0, 0};
+        regions[i].imageExtent = vk::Extent3D{std::max(header.pixel_width >> i, 1u), std::max(header.pixel_height >> i, 1u), 1};
+    }
 
-    transition_image_layout(texture->vk_image, texture_creation.format, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+    vk::Image image;
+    create_image(header.pixel_width, header.pixel_height, format, vk::ImageTiling::eOptimal,
+                 vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+                 vk::MemoryPropertyFlagBits::eDeviceLocal, image, texture->vma_allocation, mip_levels);
+    texture->vk_image = image;
 
-    texture->vk_image_view = create_image_view(texture->vk_image, texture_creation.format, vk::ImageAspectFlagBits::eColor);
+    UploadQueue::Ticket ticket = m_upload_queue.upload_image_levels(staging.buffer, texture->vk_image, regions.data(), mip_levels);
+    texture->vk_image_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-    destroy_buffer(staging_handle);
+    texture->vk_image_view = create_image_view(texture->vk_image, format, vk::ImageAspectFlagBits::eColor, mip_levels);
 
-    m_texture_map[texture_creation.image_src] = handle;
+    release_staging(staging, dedicated_staging, ticket);
 
     return handle;
 }
 
-u32 Renderer::create_sampler(const SamplerCreationInfo& sampler_creation)
+SamplerHandle Renderer::create_sampler(const SamplerCreationInfo& sampler_creation)
 {
-    u32 sampler_handle = m_sampler_pool.acquire();
-    auto* sampler = static_cast<Sampler*>(m_sampler_pool.access(sampler_handle));
+    SamplerHandle sampler_handle = m_sampler_pool.acquire();
+    auto* sampler = m_sampler_pool.access(sampler_handle);
 
     vk::SamplerCreateInfo sampler_info{};
     sampler_info.sType = vk::StructureType::eSamplerCreateInfo;
@@ -790,7 +2129,7 @@ u32 Renderer::create_sampler(const SamplerCreationInfo& sampler_creation)
     sampler_info.mipmapMode = vk::SamplerMipmapMode::eLinear;
     sampler_info.mipLodBias = 0.f;
     sampler_info.minLod = 0.f;
-    sampler_info.maxLod = 0.f;
+    sampler_info.maxLod = VK_LOD_CLAMP_NONE;
 
     if(logical_device.createSampler(&sampler_info, nullptr, &sampler->vk_sampler) != vk::Result::eSuccess)
     {
@@ -800,10 +2139,12 @@ u32 Renderer::create_sampler(const SamplerCreationInfo& sampler_creation)
     return sampler_handle;
 }
 
-u32 Renderer::create_descriptor_set(const DescriptorSetCreationInfo& descriptor_set_creation)
+DescriptorSetHandle Renderer::create_descriptor_set(const DescriptorSetCreationInfo& descriptor_set_creation)
 {
-    u32 descriptor_set_handle = m_descriptor_set_pool.acquire();
-    auto* descriptor_set = static_cast<DescriptorSet*>(m_descriptor_set_pool.access(descriptor_set_handle));
+    DescriptorSetHandle descriptor_set_handle = m_descriptor_set_pool.acquire();
+    auto* descriptor_set = m_descriptor_set_pool.access(descriptor_set_handle);
+
+    std::lock_guard<std::mutex> lock(m_descriptor_mutex);
 
     vk::DescriptorSetAllocateInfo allocInfo = {};
     allocInfo.sType = vk::StructureType::eDescriptorSetAllocateInfo;
@@ -824,8 +2165,9 @@ u32 Renderer::create_descriptor_set(const DescriptorSetCreationInfo& descriptor_
         switch(descriptor_set_creation.types[i])
         {
             case vk::DescriptorType::eUniformBuffer:
+            case vk::DescriptorType::eStorageBuffer:
             {
-                auto* buffer = static_cast<Buffer*>(m_buffer_pool.access(descriptor_set_creation.resource_handles[i]));
+                auto* buffer = m_buffer_pool.access(BufferHandle(descriptor_set_creation.resource_handles[i]));
 
                 vk::DescriptorBufferInfo descriptor_info{};
                 descriptor_info.buffer = buffer->vk_buffer;
@@ -837,7 +2179,7 @@ u32 Renderer::create_descriptor_set(const DescriptorSetCreationInfo& descriptor_
                 descriptor_writes[i].dstBinding = descriptor_set_creation.bindings[i]; // index binding
                 descriptor_writes[i].dstArrayElement = 0;
 
-                descriptor_writes[i].descriptorType = vk::DescriptorType::eUniformBuffer;
+                descriptor_writes[i].descriptorType = descriptor_set_creation.types[i];
                 descriptor_writes[i].descriptorCount = 1; // how many array elements to update
 
                 descriptor_writes[i].pBufferInfo = &descriptor_info;
@@ -852,8 +2194,8 @@ u32 Renderer::create_descriptor_set(const DescriptorSetCreationInfo& descriptor_
             }
             case vk::DescriptorType::eCombinedImageSampler:
             {
-                auto* texture = static_cast<Texture*>(m_texture_pool.access(descriptor_set_creation.resource_handles[i]));
-                auto* sampler = static_cast<Sampler*>(m_sampler_pool.access(descriptor_set_creation.sampler_handles[i]));
+                auto* texture = m_texture_pool.access(TextureHandle(descriptor_set_creation.resource_handles[i]));
+                auto* sampler = m_sampler_pool.access(descriptor_set_creation.sampler_handles[i]);
 
                 vk::DescriptorImageInfo descriptor_info{};
                 descriptor_info.imageView = texture->vk_image_view;
@@ -880,7 +2222,7 @@ u32 Renderer::create_descriptor_set(const DescriptorSetCreationInfo& descriptor_
     return descriptor_set_handle;
 }
 
-void Renderer::create_image(u32 width, u32 height, vk::Format format, vk::ImageTiling tiling, vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Image& image, VmaAllocation& image_vma)
+void Renderer::create_image(u32 width, u32 height, vk::Format format, vk::ImageTiling tiling, vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Image& image, VmaAllocation& image_vma, u32 mip_levels)
 {
     vk::ImageCreateInfo image_info{};
     image_info.sType = vk::StructureType::eImageCreateInfo;
@@ -888,7 +2230,7 @@ void Renderer::create_image(u32 width, u32 height, vk::Format format, vk::ImageT
     image_info.extent.width = static_cast<unsigned>(width);
     image_info.extent.height = static_cast<unsigned>(height);
     image_info.extent.depth = 1;
-    image_info.mipLevels = 1;
+    image_info.mipLevels = mip_levels;
     image_info.arrayLayers = 1;
 
     // use the same format for the texels as the pixels in the buffer
@@ -933,15 +2275,17 @@ vk::ShaderModule Renderer::create_shader_module(const std::vector<char>& code)
     return shader_module;
 }
 
-void Renderer::update_texture_set(u32* texture_handles, u32 num_textures)
+void Renderer::update_texture_set(const TextureHandle* texture_handles, u32 num_textures)
 {
-    auto* texture_set = static_cast<DescriptorSet*>(m_descriptor_set_pool.access(m_texture_set));
+    auto* texture_set = m_descriptor_set_pool.access(m_texture_set);
+
+    std::lock_guard<std::mutex> lock(m_descriptor_mutex);
 
     // TODO: make it update all at once
     for(i32 i = 0; i < num_textures; ++i)
     {
-        auto* texture = static_cast<Texture*>(m_texture_pool.access(texture_handles[i]));
-        auto* sampler = static_cast<Sampler*>(m_sampler_pool.access(m_default_sampler)); // FIXME: magic number
+        auto* texture = m_texture_pool.access(texture_handles[i]);
+        auto* sampler = m_sampler_pool.access(m_default_sampler); // FIXME: magic number
 
         vk::DescriptorImageInfo descriptor_info{};
         descriptor_info.imageView = texture->vk_image_view;
@@ -952,7 +2296,7 @@ void Renderer::update_texture_set(u32* texture_handles, u32 num_textures)
         descriptor_write.sType = vk::StructureType::eWriteDescriptorSet;
         descriptor_write.dstSet = texture_set->vk_descriptor_set; // descriptor set to update
         descriptor_write.dstBinding = 10; // FIXME: magic number
-        descriptor_write.dstArrayElement = texture_handles[i];
+        descriptor_write.dstArrayElement = texture_handles[i].index(); // bindless index is the pool slot
         descriptor_write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
         descriptor_write.descriptorCount = 1; // how many array elements to update
         descriptor_write.pImageInfo = &descriptor_info;
@@ -961,35 +2305,38 @@ void Renderer::update_texture_set(u32* texture_handles, u32 num_textures)
     }
 }
 
-void Renderer::destroy_buffer(u32 buffer_handle)
+void Renderer::destroy_buffer(BufferHandle buffer_handle)
 {
-    auto* buffer = static_cast<Buffer*>(m_buffer_pool.access(buffer_handle));
+    auto* buffer = m_buffer_pool.access(buffer_handle);
     vmaDestroyBuffer(m_allocator, buffer->vk_buffer, buffer->vma_allocation);
     m_buffer_pool.free(buffer_handle);
 }
 
-void Renderer::destroy_texture(u32 texture_handle)
+void Renderer::destroy_texture(TextureHandle texture_handle)
 {
     if(!m_texture_pool.valid_handle(texture_handle))
     {
         return;
     }
 
-    auto* texture = static_cast<Texture*>(m_texture_pool.access(texture_handle));
+    auto* texture = m_texture_pool.access(texture_handle);
     logical_device.destroyImageView(texture->vk_image_view, nullptr);
     vmaDestroyImage(m_allocator, texture->vk_image, texture->vma_allocation);
+    {
+        std::lock_guard<std::mutex> lock(m_texture_map_mutex);
+        m_texture_map.erase(texture->name);
+    }
     m_texture_pool.free(texture_handle);
-    m_texture_map.erase(texture->name);
 }
 
-void Renderer::destroy_sampler(u32 sampler_handle)
+void Renderer::destroy_sampler(SamplerHandle sampler_handle)
 {
     if(!m_sampler_pool.valid_handle(sampler_handle))
     {
         return;
     }
 
-    auto* sampler = static_cast<Sampler*>(m_sampler_pool.access(sampler_handle));
+    auto* sampler = m_sampler_pool.access(sampler_handle);
     logical_device.destroySampler(sampler->vk_sampler, nullptr);
     m_sampler_pool.free(sampler_handle);
 }
@@ -1086,6 +2433,27 @@ void Renderer::init_swapchain()
     }
 }
 
+void Renderer::init_offscreen_targets()
+{
+    // stand in for the swapchain images, one per frame in flight so frames never share a target
+    m_swapchain_image_format = vk::Format::eB8G8R8A8Srgb;
+
+    m_swapchain_images.resize(s_max_frames_in_flight);
+    m_swapchain_image_views.resize(s_max_frames_in_flight);
+    m_offscreen_allocations.resize(s_max_frames_in_flight);
+
+    for(size_t i = 0; i < s_max_frames_in_flight; ++i)
+    {
+        create_image(m_swapchain_extent.width, m_swapchain_extent.height,
+                     m_swapchain_image_format, vk::ImageTiling::eOptimal,
+                     vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc,
+                     vk::MemoryPropertyFlagBits::eDeviceLocal,
+                     m_swapchain_images[i], m_offscreen_allocations[i]);
+
+        m_swapchain_image_views[i] = create_image_view(m_swapchain_images[i], m_swapchain_image_format, vk::ImageAspectFlagBits::eColor);
+    }
+}
+
 void Renderer::init_render_pass()
 {
     // in this case we just have a single colour buffer
@@ -1107,8 +2475,9 @@ void Renderer::init_render_pass()
     // final layout is what to transition to after the render pass
     // we set the initial layout as undefined because we don't care what the previous layout was before
     // we want the image to be ready for presentation using the swap chain hence the final layout
+    // headless targets are never presented, leave them ready to be copied out instead
     colour_attachment.initialLayout = vk::ImageLayout::eUndefined;
-    colour_attachment.finalLayout = vk::ImageLayout::ePresentSrcKHR;
+    colour_attachment.finalLayout = is_headless() ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR;
 
     vk::AttachmentDescription depth_attachment{};
     depth_attachment.format = vk::Format::eD32Sfloat;
@@ -1181,11 +2550,18 @@ void Renderer::init_descriptor_sets()
     lighting_data_layout_binding.stageFlags = vk::ShaderStageFlagBits::eFragment;
     lighting_data_layout_binding.pImmutableSamplers = nullptr;
 
-    vk::DescriptorSetLayoutBinding bindings[] = { camera_data_layout_binding, lighting_data_layout_binding };
+    vk::DescriptorSetLayoutBinding instance_data_layout_binding{};
+    instance_data_layout_binding.binding = 2;
+    instance_data_layout_binding.descriptorType = vk::DescriptorType::eStorageBuffer;
+    instance_data_layout_binding.descriptorCount = 1;
+    instance_data_layout_binding.stageFlags = vk::ShaderStageFlagBits::eVertex;
+    instance_data_layout_binding.pImmutableSamplers = nullptr;
+
+    vk::DescriptorSetLayoutBinding bindings[] = { camera_data_layout_binding, lighting_data_layout_binding, instance_data_layout_binding };
 
     vk::DescriptorSetLayoutCreateInfo uniform_layout_info{};
     uniform_layout_info.sType = vk::StructureType::eDescriptorSetLayoutCreateInfo;
-    uniform_layout_info.bindingCount = 2;
+    uniform_layout_info.bindingCount = 3;
     uniform_layout_info.pBindings = bindings;
 
     if(logical_device.createDescriptorSetLayout(&uniform_layout_info, nullptr, &m_camera_data_layout) != vk::Result::eSuccess)
@@ -1211,6 +2587,13 @@ void Renderer::init_descriptor_sets()
             .size = light_buffer_size,
             .persistent = true
         });
+
+        m_instance_buffers[i] = create_buffer({
+            .usage = vk::BufferUsageFlagBits::eStorageBuffer,
+            .size = static_cast<u32>(k_initial_instance_capacity * sizeof(glm::mat4)),
+            .persistent = true
+        });
+        m_instance_capacity[i] = k_initial_instance_capacity;
     }
 
     m_camera_sets.resize(s_max_frames_in_flight);
@@ -1219,11 +2602,11 @@ void Renderer::init_descriptor_sets()
     for(int i = 0; i < s_max_frames_in_flight; ++i)
     {
         m_camera_sets[i] = create_descriptor_set({
-           .resource_handles = {m_camera_buffers[i], m_light_buffers[i]},
-           .bindings = {0, 1},
-           .types = {vk::DescriptorType::eUniformBuffer, vk::DescriptorType::eUniformBuffer},
+           .resource_handles = {m_camera_buffers[i].value, m_light_buffers[i].value, m_instance_buffers[i].value},
+           .bindings = {0, 1, 2},
+           .types = {vk::DescriptorType::eUniformBuffer, vk::DescriptorType::eUniformBuffer, vk::DescriptorType::eStorageBuffer},
            .layout = m_camera_data_layout,
-           .num_resources = 2,
+           .num_resources = 3,
         });
     }
 
@@ -1264,7 +2647,7 @@ void Renderer::init_descriptor_sets()
     }
 
     m_texture_set = m_descriptor_set_pool.acquire();
-    auto* descriptor_set = static_cast<DescriptorSet*>(m_descriptor_set_pool.access(m_texture_set));
+    auto* descriptor_set = m_descriptor_set_pool.access(m_texture_set);
 
     vk::DescriptorSetAllocateInfo allocInfo = {};
     allocInfo.sType = vk::StructureType::eDescriptorSetAllocateInfo;
@@ -1495,18 +2878,14 @@ void Renderer::init_graphics_pipeline()
     pipeline_layout_info.pSetLayouts = layouts;
 
     // need to tell the pipeline that there will be a push constant coming in
-    vk::PushConstantRange model_push_constant_info{};
-    model_push_constant_info.offset = 0;
-    model_push_constant_info.size = sizeof(glm::mat4);
-    model_push_constant_info.stageFlags = vk::ShaderStageFlagBits::eVertex;
-
+    // the first 64 bytes used to hold the model matrix, which now comes from the instance buffer
     vk::PushConstantRange texture_push_constant_info{};
     texture_push_constant_info.offset = 64;
     texture_push_constant_info.size = sizeof(glm::uvec4);
     texture_push_constant_info.stageFlags = vk::ShaderStageFlagBits::eFragment;
 
-    vk::PushConstantRange push_constant_ranges[] = { model_push_constant_info, texture_push_constant_info };
-    pipeline_layout_info.pushConstantRangeCount = 2;
+    vk::PushConstantRange push_constant_ranges[] = { texture_push_constant_info };
+    pipeline_layout_info.pushConstantRangeCount = 1;
     pipeline_layout_info.pPushConstantRanges = push_constant_ranges;
 
     if(logical_device.createPipelineLayout(&pipeline_layout_info, nullptr, &m_pipeline_layout) != vk::Result::eSuccess)
@@ -1574,100 +2953,131 @@ void Renderer::init_graphics_pipeline()
     logical_device.destroyShaderModule(frag_shader_module, nullptr);
 }
 
-void Renderer::init_command_pools()
+void Renderer::init_cull_pipeline()
 {
-    QueueFamilyIndices queue_family_indices = DeviceHelper::find_queue_families(m_physical_device, m_surface);
-
-    vk::CommandPoolCreateInfo pool_info{};
-    pool_info.sType = vk::StructureType::eCommandPoolCreateInfo;
-
-    // allows command buffers to be rerecorded individually
-    // without this flag they all have to be reset together
-    // we will be recording a command buffer every frame, so we want to be able to write to it
-    pool_info.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
-
-    // command buffers are executed by submitting them on one of the device queues
-    // each command pool can only allocate command buffers that will be submitted to the same type of queue
-    // since we're recording commands for drawing we make it the graphics queue
-    pool_info.queueFamilyIndex = queue_family_indices.graphics_family.value();
+    if(!m_gpu_culling_supported)
+    {
+        return;
+    }
 
-    if(logical_device.createCommandPool(&pool_info, nullptr, &m_main_command_pool) != vk::Result::eSuccess)
+    // objects, transforms, indirect commands and draw counts
+    vk::DescriptorSetLayoutBinding cull_bindings[4];
+    for(u32 i = 0; i < 4; ++i)
     {
-        throw std::runtime_error("failed to create command pool!");
+        cull_bindings[i].binding = i;
+        cull_bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        cull_bindings[i].descriptorCount = 1;
+        cull_bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+        cull_bindings[i].pImmutableSamplers = nullptr;
     }
 
-    if(logical_device.createCommandPool(&pool_info, nullptr, &m_extra_command_pool) != vk::Result::eSuccess)
+    vk::DescriptorSetLayoutCreateInfo layout_info{};
+    layout_info.sType = vk::StructureType::eDescriptorSetLayoutCreateInfo;
+    layout_info.bindingCount = 4;
+    layout_info.pBindings = cull_bindings;
+
+    if(logical_device.createDescriptorSetLayout(&layout_info, nullptr, &m_cull_set_layout) != vk::Result::eSuccess)
     {
-        throw std::runtime_error("failed to create command pool!");
+        throw std::runtime_error("failed to create descriptor set layout!");
     }
 
-    m_command_pools.resize(m_scheduler->GetNumTaskThreads());
+    // the frustum planes and object count change every frame, so they are pushed rather than written into a buffer
+    vk::PushConstantRange cull_push_constant_info{};
+    cull_push_constant_info.offset = 0;
+    cull_push_constant_info.size = sizeof(CullData);
+    cull_push_constant_info.stageFlags = vk::ShaderStageFlagBits::eCompute;
+
+    vk::PipelineLayoutCreateInfo pipeline_layout_info{};
+    pipeline_layout_info.sType = vk::StructureType::ePipelineLayoutCreateInfo;
+    pipeline_layout_info.setLayoutCount = 1;
+    pipeline_layout_info.pSetLayouts = &m_cull_set_layout;
+    pipeline_layout_info.pushConstantRangeCount = 1;
+    pipeline_layout_info.pPushConstantRanges = &cull_push_constant_info;
 
-    for(auto& command_pool : m_command_pools)
+    if(logical_device.createPipelineLayout(&pipeline_layout_info, nullptr, &m_cull_pipeline_layout) != vk::Result::eSuccess)
     {
-        if(logical_device.createCommandPool(&pool_info, nullptr, &command_pool) != vk::Result::eSuccess)
-        {
-            throw std::runtime_error("failed to create command pool!");
-        }
+        throw std::runtime_error("failed to create pipeline layout!");
     }
 
-    pool_info.queueFamilyIndex = queue_family_indices.transfer_family.value();
-}
+    auto cull_shader_code = util::read_binary_file("../shaders/cull.spv");
+    vk::ShaderModule cull_shader_module = create_shader_module(cull_shader_code);
 
-void Renderer::init_command_buffers()
-{
-    m_command_buffers.resize(m_command_pools.size() * 3);
+    vk::ComputePipelineCreateInfo pipeline_info{};
+    pipeline_info.sType = vk::StructureType::eComputePipelineCreateInfo;
+    pipeline_info.stage.sType = vk::StructureType::ePipelineShaderStageCreateInfo;
+    pipeline_info.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipeline_info.stage.module = cull_shader_module;
+    pipeline_info.stage.pName = "main";
+    pipeline_info.layout = m_cull_pipeline_layout;
 
-    u32 command_buffer_index = 0;
-    for(const auto& command_pool : m_command_pools)
+    if(logical_device.createComputePipelines(nullptr, 1, &pipeline_info, nullptr, &m_cull_pipeline) != vk::Result::eSuccess)
     {
-        // now need to allocate the secondary command buffers for this pool
-        vk::CommandBufferAllocateInfo secondary_alloc_info{};
-        secondary_alloc_info.sType = vk::StructureType::eCommandBufferAllocateInfo;
-        secondary_alloc_info.commandPool = command_pool;
-        secondary_alloc_info.level = vk::CommandBufferLevel::eSecondary;
-        secondary_alloc_info.commandBufferCount = 1;
+        throw std::runtime_error("failed to create cull pipeline!");
+    }
 
-        for(u32 i = 0; i < s_max_frames_in_flight; ++i)
-        {
-            if(logical_device.allocateCommandBuffers(&secondary_alloc_info, &m_command_buffers[i + command_buffer_index].vk_command_buffer) != vk::Result::eSuccess)
-            {
-                throw std::runtime_error("failed to allocate command buffers!");
-            }
-        }
+    logical_device.destroyShaderModule(cull_shader_module, nullptr);
 
-        command_buffer_index += 3;
+    // the sets point at small starting buffers, upload_gpu_objects grows them and rewrites the set once there is a scene
+    for(u32 i = 0; i < s_max_frames_in_flight; ++i)
+    {
+        GPUCullFrame& frame = m_cull_frames[i];
+        frame.objects = create_buffer({
+            .usage = vk::BufferUsageFlagBits::eStorageBuffer,
+            .size = static_cast<u32>(k_initial_instance_capacity * sizeof(GPUObject)),
+            .persistent = true
+        });
+        frame.commands = create_buffer({
+            .usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+            .size = static_cast<u32>(k_initial_instance_capacity * sizeof(vk::DrawIndexedIndirectCommand)),
+            .device_local = true
+        });
+        frame.counts = create_buffer({
+            .usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+            .size = static_cast<u32>(k_initial_draw_capacity * sizeof(u32)),
+            .persistent = true
+        });
+        frame.object_capacity = k_initial_instance_capacity;
+        frame.draw_capacity = k_initial_draw_capacity;
+
+        frame.descriptor_set = create_descriptor_set({
+            .resource_handles = {frame.objects.value, m_instance_buffers[i].value, frame.commands.value, frame.counts.value},
+            .bindings = {0, 1, 2, 3},
+            .types = {vk::DescriptorType::eStorageBuffer, vk::DescriptorType::eStorageBuffer, vk::DescriptorType::eStorageBuffer, vk::DescriptorType::eStorageBuffer},
+            .layout = m_cull_set_layout,
+            .num_resources = 4,
+        });
     }
+}
+
+void Renderer::init_command_pools()
+{
+    QueueFamilyIndices queue_family_indices = DeviceHelper::find_queue_families(m_physical_device, m_surface);
 
-    vk::CommandBufferAllocateInfo primary_alloc_info{};
-    primary_alloc_info.sType = vk::StructureType::eCommandBufferAllocateInfo;
-    primary_alloc_info.commandPool = m_main_command_pool;
+    // command buffers are executed by submitting them on one of the device queues
+    // each command pool can only allocate command buffers that will be submitted to the same type of queue
+    // since we're recording commands for drawing we make it the graphics queue
+    m_command_pool_ring.init(logical_device, queue_family_indices.graphics_family.value(), s_max_frames_in_flight, m_scheduler->GetNumTaskThreads());
+    m_cached_command_pool_ring.init(logical_device, queue_family_indices.graphics_family.value(), s_max_frames_in_flight, m_scheduler->GetNumTaskThreads());
 
-    // primary buffers can be submitted to a queue for execution but cannot be called from other command buffers
-    primary_alloc_info.level = vk::CommandBufferLevel::ePrimary;
-    primary_alloc_info.commandBufferCount = 1;
+    // upload command buffers are short lived, so let the driver know
+    vk::CommandPoolCreateInfo upload_pool_info{};
+    upload_pool_info.sType = vk::StructureType::eCommandPoolCreateInfo;
+    upload_pool_info.flags = vk::CommandPoolCreateFlagBits::eTransient;
+    upload_pool_info.queueFamilyIndex = queue_family_indices.graphics_family.value();
 
-    vk::CommandBufferAllocateInfo extra_alloc_info{};
-    extra_alloc_info.sType = vk::StructureType::eCommandBufferAllocateInfo;
-    extra_alloc_info.commandPool = m_extra_command_pool;
-    extra_alloc_info.level = vk::CommandBufferLevel::eSecondary;
-    extra_alloc_info.commandBufferCount = 1;
+    m_upload_command_pools.resize(m_scheduler->GetNumTaskThreads());
 
-    vk::CommandBufferAllocateInfo imgui_alloc_info{};
-    imgui_alloc_info.sType = vk::StructureType::eCommandBufferAllocateInfo;
-    imgui_alloc_info.commandPool = m_main_command_pool;
-    imgui_alloc_info.level = vk::CommandBufferLevel::eSecondary;
-    imgui_alloc_info.commandBufferCount = 1;
+    for(auto& command_pool : m_upload_command_pools)
+    {
+        if(logical_device.createCommandPool(&upload_pool_info, nullptr, &command_pool) != vk::Result::eSuccess)
+        {
+            throw std::runtime_error("failed to create upload command pool!");
+        }
+    }
 
-	for(u32 i = 0; i < s_max_frames_in_flight; ++i)
-	{
-		if (logical_device.allocateCommandBuffers(&primary_alloc_info, &m_primary_command_buffers[i].vk_command_buffer) != vk::Result::eSuccess ||
-        logical_device.allocateCommandBuffers(&extra_alloc_info, &m_extra_draw_commands[i].vk_command_buffer) != vk::Result::eSuccess ||
-        logical_device.allocateCommandBuffers(&imgui_alloc_info, &m_imgui_commands[i].vk_command_buffer) != vk::Result::eSuccess)
-		{
-			throw std::runtime_error("failed to allocate command buffers!");
-		}
-	}
+    m_upload_queue.init(logical_device, queue_family_indices.transfer_family.value(), queue_family_indices.graphics_family.value(), m_transfer_queue, m_graphics_queue, &m_queue_mutex);
+    m_staging_ring.init(m_allocator, k_staging_ring_size, &m_upload_queue);
+    m_geometry_arena.init(this);
 }
 
 void Renderer::init_framebuffers()
@@ -1703,6 +3113,7 @@ void Renderer::init_descriptor_pools()
     vk::DescriptorPoolSize pool_sizes[] =
     {
         { vk::DescriptorType::eUniformBuffer, k_max_bindless_resources },
+        { vk::DescriptorType::eStorageBuffer, k_max_bindless_resources },
         { vk::DescriptorType::eCombinedImageSampler, k_max_bindless_resources },
         { vk::DescriptorType::eStorageImage, k_max_bindless_resources }
     };
@@ -1711,7 +3122,7 @@ void Renderer::init_descriptor_pools()
     pool_info.sType = vk::StructureType::eDescriptorPoolCreateInfo;
     pool_info.flags = vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT; // for bindless resources
     pool_info.maxSets = 20;
-    pool_info.poolSizeCount = 3;
+    pool_info.poolSizeCount = 4;
     pool_info.pPoolSizes = pool_sizes;
 
     if(logical_device.createDescriptorPool(&pool_info, nullptr, &m_descriptor_pool) != vk::Result::eSuccess)
@@ -1754,6 +3165,96 @@ void Renderer::init_sync_objects()
     }
 }
 
+void Renderer::init_query_pools()
+{
+    // every graphics queue can write timestamps if this is set, otherwise we just go without GPU timings
+    m_timestamps_supported = m_device_properties.limits.timestampComputeAndGraphics;
+
+    // render pass and imgui begin/end, then a pair for every thread's draw secondary
+    m_timestamps_per_frame = 4 + 2 * m_scheduler->GetNumTaskThreads();
+
+    if(m_timestamps_supported)
+    {
+        vk::QueryPoolCreateInfo timestamp_info{};
+        timestamp_info.sType = vk::StructureType::eQueryPoolCreateInfo;
+        timestamp_info.queryType = vk::QueryType::eTimestamp;
+        timestamp_info.queryCount = m_timestamps_per_frame * s_max_frames_in_flight;
+
+        if(logical_device.createQueryPool(&timestamp_info, nullptr, &m_timestamp_pool) != vk::Result::eSuccess)
+        {
+            throw std::runtime_error("failed to create timestamp query pool!");
+        }
+    }
+
+    if(m_statistics_supported)
+    {
+        vk::QueryPoolCreateInfo statistics_info{};
+        statistics_info.sType = vk::StructureType::eQueryPoolCreateInfo;
+        statistics_info.queryType = vk::QueryType::ePipelineStatistics;
+        statistics_info.queryCount = s_max_frames_in_flight;
+        statistics_info.pipelineStatistics = k_pipeline_statistics;
+
+        if(logical_device.createQueryPool(&statistics_info, nullptr, &m_statistics_pool) != vk::Result::eSuccess)
+        {
+            throw std::runtime_error("failed to create pipeline statistics query pool!");
+        }
+    }
+}
+
+void Renderer::read_gpu_stats()
+{
+    if(!m_queries_written[m_current_frame])
+    {
+        return;
+    }
+    m_queries_written[m_current_frame] = false;
+    m_gpu_stats.valid = false;
+
+    if(m_timestamps_supported)
+    {
+        u32 num_timestamps = 4 + 2 * m_num_draw_timestamps[m_current_frame];
+        std::vector<u64> timestamps(num_timestamps);
+
+        // the fence has already been waited on so everything should be available, if not skip the frame rather than stall
+        vk::Result result = logical_device.getQueryPoolResults(m_timestamp_pool, get_timestamp_index(0), num_timestamps, timestamps.size() * sizeof(u64), timestamps.data(), sizeof(u64), vk::QueryResultFlagBits::e64);
+        if(result != vk::Result::eSuccess)
+        {
+            return;
+        }
+
+        // timestampPeriod is the number of nanoseconds per tick
+        f64 period = m_device_properties.limits.timestampPeriod * 1e-6;
+        auto to_ms = [&](u32 begin) { return (f32)((f64)(timestamps[begin + 1] - timestamps[begin]) * period); };
+
+        m_gpu_stats.render_pass = to_ms(0);
+        m_gpu_stats.imgui = to_ms(2);
+
+        m_gpu_stats.scene_draws = 0.f;
+        m_gpu_stats.draw_command_buffers.resize(m_num_draw_timestamps[m_current_frame]);
+        for(u32 i = 0; i < m_num_draw_timestamps[m_current_frame]; ++i)
+        {
+            m_gpu_stats.draw_command_buffers[i] = to_ms(4 + 2 * i);
+            m_gpu_stats.scene_draws += m_gpu_stats.draw_command_buffers[i];
+        }
+    }
+
+    if(m_statistics_supported)
+    {
+        std::array<u64, 3> statistics{};
+        vk::Result result = logical_device.getQueryPoolResults(m_statistics_pool, m_current_frame, 1, sizeof(statistics), statistics.data(), sizeof(statistics), vk::QueryResultFlagBits::e64);
+        if(result != vk::Result::eSuccess)
+        {
+            return;
+        }
+
+        m_gpu_stats.vertex_invocations = statistics[0];
+        m_gpu_stats.clipping_primitives = statistics[1];
+        m_gpu_stats.fragment_invocations = statistics[2];
+    }
+
+    m_gpu_stats.valid = true;
+}
+
 void Renderer::cleanup_swapchain()
 {
     for(auto framebuffer : m_swapchain_framebuffers)
@@ -1766,6 +3267,12 @@ void Renderer::cleanup_swapchain()
         logical_device.destroyImageView(image_view, nullptr);
     }
 
+    for(size_t i = 0; i < m_offscreen_allocations.size(); ++i)
+    {
+        vmaDestroyImage(m_allocator, m_swapchain_images[i], m_offscreen_allocations[i]);
+    }
+    m_offscreen_allocations.clear();
+
     logical_device.destroyImage(m_depth_image, nullptr);
     logical_device.freeMemory(m_depth_image_memory);
     logical_device.destroyImageView(m_depth_image_view, nullptr);
@@ -1804,7 +3311,15 @@ void Renderer::init_imgui()
 
     ImGui::CreateContext();
 
-    ImGui_ImplGlfw_InitForVulkan(m_window, true);
+    if(is_headless())
+    {
+        // normally the glfw backend keeps this up to date
+        ImGui::GetIO().DisplaySize = ImVec2((float)m_swapchain_extent.width, (float)m_swapchain_extent.height);
+    }
+    else
+    {
+        ImGui_ImplGlfw_InitForVulkan(m_window, true);
+    }
 
     ImGui_ImplVulkan_InitInfo init_info{};
     init_info.Instance = m_instance;
@@ -1826,116 +3341,6 @@ void Renderer::init_imgui()
     ImGui_ImplVulkan_DestroyFontUploadObjects();
 }
 
-// memory transfer ops are executed with command buffers
-void Renderer::copy_buffer(vk::Buffer src_buffer, vk::Buffer dst_buffer, vk::DeviceSize size)
-{
-    vk::CommandBuffer command_buffer = begin_single_time_commands();
-
-    vk::BufferCopy copy_region{};
-    copy_region.srcOffset = 0; // optional
-    copy_region.dstOffset = 0; // optional
-    copy_region.size = size;
-    command_buffer.copyBuffer(src_buffer, dst_buffer, 1, &copy_region);
-
-    end_single_time_commands(command_buffer);
-}
-
-void Renderer::copy_buffer_to_image(vk::Buffer buffer, vk::Image image, u32 width, u32 height)
-{
-    vk::CommandBuffer command_buffer = begin_single_time_commands();
-
-    vk::BufferImageCopy region{};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-
-    region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-
-    region.imageOffset = vk::Offset3D{0,0,0};
-    region.imageExtent = vk::Extent3D
-    {
-            width,
-            height,
-            1
-    };
-
-    command_buffer.copyBufferToImage(buffer, image, vk::ImageLayout::eTransferDstOptimal, 1, &region);
-
-    end_single_time_commands(command_buffer);
-}
-
-void Renderer::transition_image_layout(vk::Image image, vk::Format format, vk::ImageLayout old_layout, vk::ImageLayout new_layout)
-{
-    vk::CommandBuffer command_buffer = begin_single_time_commands();
-
-    vk::PipelineStageFlags source_stage, destination_stage;
-
-    // a common way to perform layout transitions is using an image memory barrier
-    // a barrier like that is normally used to sync access to resources,
-    // but it can also be used to transition image layouts and transfer queue family ownership
-    // when vk::_SHARING_MODE_EXCLUSIVE is used
-    // there is an equivalent buffer memory barrier for buffers
-    vk::ImageMemoryBarrier barrier{};
-    barrier.sType = vk::StructureType::eImageMemoryBarrier;
-    barrier.oldLayout = old_layout; // can be vk::_IMAGE_LAYOUT_UNDEFINED if you don't care about original image
-    barrier.newLayout = new_layout;
-
-    // these are not the default values
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-
-    // sub resource range specifies the area of the image that is affected
-    // this image is not an array and does not have mipping
-    barrier.image = image;
-    barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-
-    // since barriers are used for sync purposes, you must specify which types of operations happen
-    // before the barrier and which must wait on the barrier
-
-    if(old_layout == vk::ImageLayout::eUndefined && new_layout == vk::ImageLayout::eTransferDstOptimal)
-    {
-        barrier.srcAccessMask = vk::AccessFlagBits::eNone;
-        barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
-
-        source_stage = vk::PipelineStageFlagBits::eTopOfPipe;
-
-        // this is not actually a real stage in a graphics or compute pipeline
-        // it's more of a pseudo-stage where transfers can happen
-        destination_stage = vk::PipelineStageFlagBits::eTransfer;
-    }
-    else if(old_layout == vk::ImageLayout::eTransferDstOptimal && new_layout == vk::ImageLayout::eShaderReadOnlyOptimal)
-    {
-        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
-
-        source_stage = vk::PipelineStageFlagBits::eTransfer;
-        destination_stage = vk::PipelineStageFlagBits::eFragmentShader;
-    }
-    else
-    {
-        throw std::invalid_argument("unsupported layout transition!");
-    }
-
-    // all types of pipeline barriers are submitted with this command
-    // first two params are the stages that should happen before the barrier and stages that have to wait on the barrier
-    command_buffer.pipelineBarrier(
-            source_stage, destination_stage,
-            vk::DependencyFlags(),
-            nullptr,
-            nullptr,
-            barrier
-    );
-
-    end_single_time_commands(command_buffer);
-}
-
 size_t Renderer::pad_uniform_buffer(size_t original_size) const
 {
     size_t alignment = m_device_properties.limits.minUniformBufferOffsetAlignment;
@@ -1948,7 +3353,7 @@ vk::CommandBuffer Renderer::begin_single_time_commands()
     vk::CommandBufferAllocateInfo alloc_info{};
     alloc_info.sType = vk::StructureType::eCommandBufferAllocateInfo;
     alloc_info.level = vk::CommandBufferLevel::ePrimary;
-    alloc_info.commandPool = m_command_pools[0];
+    alloc_info.commandPool = get_upload_command_pool();
     alloc_info.commandBufferCount = 1;
 
     vk::CommandBuffer command_buffer;
@@ -1980,13 +3385,43 @@ void Renderer::end_single_time_commands(vk::CommandBuffer command_buffer)
     submit_info.commandBufferCount = 1;
     submit_info.pCommandBuffers = &command_buffer;
 
-    if(m_graphics_queue.submit(1, &submit_info, nullptr) != vk::Result::eSuccess)
+    // wait on a fence rather than the whole queue so other threads can keep submitting
+    vk::FenceCreateInfo fence_info{};
+    fence_info.sType = vk::StructureType::eFenceCreateInfo;
+
+    vk::Fence upload_fence;
+    if(logical_device.createFence(&fence_info, nullptr, &upload_fence) != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("Failed to create upload fence!");
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_queue_mutex);
+        if(m_graphics_queue.submit(1, &submit_info, upload_fence) != vk::Result::eSuccess)
+        {
+            throw std::runtime_error("Failed to submit to graphics queue!");
+        }
+    }
+
+    if(logical_device.waitForFences(1, &upload_fence, true, UINT64_MAX) != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("Failed to wait for upload fence!");
+    }
+
+    logical_device.destroyFence(upload_fence, nullptr);
+    logical_device.freeCommandBuffers(get_upload_command_pool(), 1, & command_buffer);
+}
+
+vk::CommandPool Renderer::get_upload_command_pool()
+{
+    // the main thread is thread 0, enkiTS workers come after it
+    u32 thread_num = m_scheduler->GetThreadNum();
+    if(thread_num >= m_upload_command_pools.size())
     {
-        throw std::runtime_error("Failed to submit to graphics queue!");
+        throw std::runtime_error("resources can only be created from the main thread or an enkiTS task!");
     }
-    m_graphics_queue.waitIdle();
 
-    logical_device.freeCommandBuffers(m_command_pools[0], 1, & command_buffer);
+    return m_upload_command_pools[thread_num];
 }
 
 bool Renderer::check_validation_layer_support()
@@ -2029,11 +3464,17 @@ bool Renderer::check_validation_layer_support()
 
 [[nodiscard]] std::vector<const char*> Renderer::get_required_extensions() const
 {
-    uint32_t extension_count = 0;
-    const char** glfw_extensions;
-    glfw_extensions = glfwGetRequiredInstanceExtensions(&extension_count);
+    std::vector<const char*> extensions;
+
+    // surface extensions are only needed when there is a window to present to
+    if(!is_headless())
+    {
+        uint32_t extension_count = 0;
+        const char** glfw_extensions;
+        glfw_extensions = glfwGetRequiredInstanceExtensions(&extension_count);
 
-    std::vector<const char*> extensions(glfw_extensions, glfw_extensions + extension_count);
+        extensions.assign(glfw_extensions, glfw_extensions + extension_count);
+    }
 
     if(m_enable_validation_layers)
     {
@@ -5,21 +5,114 @@
 #include "Memory.hpp"
 #include "Components.hpp"
 #include "CommandBuffer.hpp"
+#include "CommandPoolRing.hpp"
+#include "Timer.hpp"
+#include "UploadQueue.hpp"
+#include "StagingRing.hpp"
+#include "GeometryArena.hpp"
+#include "Vertex.hpp"
+#include "Culling.hpp"
+#include "RenderQueue.hpp"
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <TaskScheduler.h>
 
+#include <future>
+#include <mutex>
+#include <unordered_map>
+
 struct LightingData
 {
     glm::vec3 direct_light_colour;
     glm::vec3 direct_light_position;
 };
 
+// CPU time spent in each part of the last frame in ms
+struct FrameTimings
+{
+    f32 fence_wait = 0.f;   // waiting for the frame's previous submission to finish
+    f32 acquire = 0.f;      // waiting on the swapchain for the next image
+    f32 record = 0.f;       // recording the draw command buffers
+    f32 submit = 0.f;
+    f32 present = 0.f;
+};
+
+// GPU side of a frame, read back from queries once the frame's fence has signalled
+// so these lag the frame being recorded by s_max_frames_in_flight
+struct GPUFrameStats
+{
+    bool valid = false;
+
+    // timestamps in ms
+    f32 render_pass = 0.f;
+    f32 scene_draws = 0.f;                      // sum of all the draw secondary command buffers
+    f32 imgui = 0.f;
+    std::vector<f32> draw_command_buffers;
+
+    // pipeline statistics, zero if the device can't inherit queries into secondary command buffers
+    u64 vertex_invocations = 0;
+    u64 clipping_primitives = 0;
+    u64 fragment_invocations = 0;
+};
+
+// models placed from the same asset share their meshes, so each mesh becomes one instanced draw for all of them
+// the transforms of the visible ones are consecutive in the frame's instance buffer starting at first_instance
+// with GPU culling first_instance and instance_count are the batch's range of indirect commands instead,
+// one per placement, and the cull pass decides how many of them are drawn
+struct DrawBatch
+{
+    const ModelAsset* asset;
+    u32 mesh_index;
+    u32 first_instance;
+    u32 instance_count;
+
+    // where the asset's models are listed in the renderer's batch model indices
+    u32 first_model;
+    u32 model_count;
+
+    // distance of the nearest visible instance in front of the camera, the last part of the batch's sort key
+    f32 depth = 0.f;
+};
+
+// a contiguous run of the render queue that one thread records in one go
+struct RecordChunk
+{
+    u32 start;
+    u32 end;
+};
+
+// one per mesh of every model for the GPU culling pass, laid out like Object in shaders/cull.comp
+struct GPUObject
+{
+    glm::vec4 sphere;       // object space centre and radius
+    u32 transform_index;    // into the instance buffer, also the draw's first instance
+    u32 first_index;
+    u32 index_count;
+    i32 vertex_offset;
+    u32 draw_group;         // index of the object's batch, which is also its draw count
+    u32 first_command;      // where the batch's indirect commands start
+    u32 padding[2];
+};
+
+static_assert(sizeof(GPUObject) == 48, "GPUObject has to match the std430 layout in cull.comp");
+
+struct DrawStats
+{
+    u32 draws = 0;
+    u32 instances = 0;
+    u32 culled_models = 0;      // rejected by the scene's BVH
+    u32 culled_instances = 0;   // meshes of the remaining models rejected by their own bounds
+    u32 recorded_draws = 0;     // zero when the draw secondaries from last time were executed again
+};
+
 class Renderer
 {
 public:
     explicit Renderer(GLFWwindow* window, enki::TaskScheduler* scheduler);
+
+    // headless mode, there is no window or swapchain and frames are rendered into offscreen images
+    Renderer(u32 width, u32 height, enki::TaskScheduler* scheduler);
     ~Renderer();
 
     void render(Scene* scene);
@@ -28,31 +121,61 @@ public:
     void recreate_swapchain();
 
     // resource creation
-    u32 create_buffer(const BufferCreationInfo& buffer_creation);
-    u32 create_texture(const TextureCreationInfo& texture_creation);
-    u32 create_sampler(const SamplerCreationInfo& sampler_creation);
-    u32 create_descriptor_set(const DescriptorSetCreationInfo& descriptor_set_creation);
+    // these can be called from the main thread or any enkiTS task, e.g. the parallel model loaders
+    BufferHandle create_buffer(const BufferCreationInfo& buffer_creation);
+    TextureHandle create_texture(const TextureCreationInfo& texture_creation);
+
+    // decodes the images on enkiTS workers and uploads them from the calling thread as each one finishes
+    // the handles line up with the creation infos, textures already loaded or loading elsewhere are shared like create_texture
+    void create_textures(const TextureCreationInfo* texture_creations, u32 count, TextureHandle* texture_handles);
+    SamplerHandle create_sampler(const SamplerCreationInfo& sampler_creation);
+    DescriptorSetHandle create_descriptor_set(const DescriptorSetCreationInfo& descriptor_set_creation);
     void create_image(u32 width, u32 height, vk::Format format, vk::ImageTiling tiling, vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Image& image, vk::DeviceMemory& image_memory);
-    void create_image(u32 width, u32 height, vk::Format format, vk::ImageTiling tiling, vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Image& image, VmaAllocation& image_vma);
-    vk::ImageView create_image_view(const vk::Image& image, vk::Format format, vk::ImageAspectFlags image_aspect);
+    void create_image(u32 width, u32 height, vk::Format format, vk::ImageTiling tiling, vk::ImageUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Image& image, VmaAllocation& image_vma, u32 mip_levels = 1);
+    vk::ImageView create_image_view(const vk::Image& image, vk::Format format, vk::ImageAspectFlags image_aspect, u32 mip_levels = 1);
     vk::ShaderModule create_shader_module(const std::vector<char>& code);
 
-    Buffer* get_buffer(u32 buffer_handle) { return static_cast<Buffer*>(m_buffer_pool.access(buffer_handle)); }
-    DescriptorSet* get_descriptor_set(u32 descriptor_set_handle) { return static_cast<DescriptorSet*>(m_descriptor_set_pool.access(descriptor_set_handle)); }
+    Buffer* get_buffer(BufferHandle buffer_handle) { return m_buffer_pool.access(buffer_handle); }
+    DescriptorSet* get_descriptor_set(DescriptorSetHandle descriptor_set_handle) { return m_descriptor_set_pool.access(descriptor_set_handle); }
 
-    void update_texture_set(u32* texture_handles, u32 num_textures);
+    void update_texture_set(const TextureHandle* texture_handles, u32 num_textures);
 
-    void destroy_buffer(u32 buffer_handle);
-	void destroy_texture(u32 texture_handle);
-	void destroy_sampler(u32 sampler_handle);
+    // copies into an existing buffer, in place if it is mapped and through the upload queue otherwise
+    void write_buffer(BufferHandle buffer_handle, vk::DeviceSize offset, const void* data, vk::DeviceSize size);
+
+    // meshes share the large vertex/index buffers of the geometry arena instead of owning their own
+    void create_mesh(const Vertex* vertices, u32 vertex_count, const u32* indices, u32 index_count, Mesh& mesh);
+    void create_mesh(const std::vector<Vertex>& vertices, const std::vector<u32>& indices, Mesh& mesh) { create_mesh(vertices.data(), static_cast<u32>(vertices.size()), indices.data(), static_cast<u32>(indices.size()), mesh); }
+    void destroy_mesh(const Mesh& mesh);
+    [[nodiscard]] const GeometryArena& get_geometry_arena() const { return m_geometry_arena; }
+
+    [[nodiscard]] bool has_resizable_bar() const { return m_rebar_supported; }
+
+    // uploads are batched, loaders flush once they are done recording and can wait on the ticket if they need the data
+    UploadQueue::Ticket flush_uploads() { return m_upload_queue.flush(); }
+    void wait_for_upload(UploadQueue::Ticket ticket) { m_upload_queue.wait(ticket); }
+
+    void destroy_buffer(BufferHandle buffer_handle);
+	void destroy_texture(TextureHandle texture_handle);
+	void destroy_sampler(SamplerHandle sampler_handle);
     void configure_lighting(LightingData data);
 
 	[[nodiscard]] LightingData get_light_data() const { return m_light_data; }
+	[[nodiscard]] const FrameTimings& get_frame_timings() const { return m_frame_timings; }
+	[[nodiscard]] const GPUFrameStats& get_gpu_stats() const { return m_gpu_stats; }
+	[[nodiscard]] const DrawStats& get_draw_stats() const { return m_draw_stats; }
+	[[nodiscard]] bool is_culling_enabled() const { return m_culling_enabled; }
+	void set_culling_enabled(bool enabled) { m_culling_enabled = enabled; }
+	[[nodiscard]] bool is_gpu_culling_supported() const { return m_gpu_culling_supported; }
+	[[nodiscard]] bool is_gpu_culling_enabled() const { return m_gpu_culling_enabled; }
+	void set_gpu_culling_enabled(bool enabled) { m_gpu_culling_enabled = enabled && m_gpu_culling_supported; }
+	[[nodiscard]] vk::QueryPool get_timestamp_pool() const { return m_timestamp_pool; }
     void wait_for_device_idle() const { logical_device.waitIdle(); }
 
     [[nodiscard]] const vk::DescriptorSetLayout& get_texture_layout() const { return m_texture_set_layout; }
-	[[nodiscard]] u32 get_null_texture_handle() const { return m_null_texture; }
+	[[nodiscard]] TextureHandle get_null_texture_handle() const { return m_null_texture; }
 	const vk::PipelineLayout& get_pipeline_layout() { return m_pipeline_layout; }
+	[[nodiscard]] bool is_headless() const { return m_window == nullptr; }
 
     // allow multiple frames to be in-flight
     // this means we allow a new frame to start being rendered without interfering with one being presented
@@ -71,7 +194,6 @@ private:
     vk::PhysicalDevice m_physical_device;
     vk::PhysicalDeviceProperties m_device_properties;
     VmaAllocator m_allocator;
-    PoolAllocator m_pool_allocator;
 
     // swapchain related things
     vk::SwapchainKHR m_swapchain;
@@ -80,6 +202,10 @@ private:
     std::vector<vk::Image> m_swapchain_images;
     std::vector<vk::ImageView> m_swapchain_image_views;
     std::vector<vk::Framebuffer> m_swapchain_framebuffers;
+
+    // only used in headless mode, backs the images in m_swapchain_images
+    std::vector<VmaAllocation> m_offscreen_allocations;
+
     vk::RenderPass m_render_pass;
     vk::DescriptorSetLayout m_descriptor_set_layout;
     vk::DescriptorSetLayout m_camera_data_layout;
@@ -87,23 +213,23 @@ private:
     vk::DescriptorPool m_descriptor_pool;
     vk::DescriptorPool m_imgui_pool;
     std::vector<vk::DescriptorSet> m_descriptor_sets;
-    std::vector<u32> m_camera_sets;
-    u32 m_texture_set;
+    std::vector<DescriptorSetHandle> m_camera_sets;
+    DescriptorSetHandle m_texture_set;
     vk::PipelineLayout m_pipeline_layout;
     vk::Pipeline m_graphics_pipeline;
 
     u32 m_image_index;
 
     // command pools manage the memory that is used to store the buffers and command buffers are allocated to them
-    vk::CommandPool m_main_command_pool;
-    vk::CommandPool m_extra_command_pool;
-    std::vector<vk::CommandPool> m_command_pools;
+    // everything recorded for a frame comes from the ring, each scheduler thread has its own pool in every frame slot
+    CommandPoolRing m_command_pool_ring;
+
+    // one per scheduler thread for resource uploads, so loaders never share a pool with each other or with recording
+    std::vector<vk::CommandPool> m_upload_command_pools;
 
     // each frame need its own command buffer, semaphores and fence
-    std::array<CommandBuffer, s_max_frames_in_flight> m_primary_command_buffers;
-    std::vector<CommandBuffer> m_command_buffers;
-    std::array<CommandBuffer, s_max_frames_in_flight> m_extra_draw_commands;
-    std::array<CommandBuffer, s_max_frames_in_flight> m_imgui_commands;
+    // the primary is handed out by the main thread's pool of the current frame slot in begin_frame
+    CommandBuffer* m_primary_command_buffer = nullptr;
 
     // we want to use semaphores for swapchain operations since they happen on the GPU
     std::array<vk::Semaphore, s_max_frames_in_flight> m_image_available_semaphores;
@@ -119,60 +245,237 @@ private:
     vk::Queue m_present_queue;
     vk::Queue m_transfer_queue;
 
+    // queue submission has to be externally synchronized and uploads can come from any thread
+    // present is covered too since the present queue is usually the graphics queue
+    std::mutex m_queue_mutex;
+
+    // guards m_descriptor_pool and writes into shared sets like the bindless texture set
+    std::mutex m_descriptor_mutex;
+
+    // texture and buffer copies go through here on the transfer queue
+    UploadQueue m_upload_queue;
+
+    // source memory for those copies, big enough for a few 4k textures in flight at once
+    static const vk::DeviceSize k_staging_ring_size = 128 * 1024 * 1024;
+    StagingRing m_staging_ring;
+
+    GeometryArena m_geometry_arena;
+
+    // a host visible device local heap bigger than the legacy 256MB window, device local buffers are written in place when set
+    bool m_rebar_supported = false;
+
     // depth buffer
     vk::Image m_depth_image;
     vk::DeviceMemory m_depth_image_memory;
     vk::ImageView m_depth_image_view;
 
-    ResourcePool m_buffer_pool;
-    ResourcePool m_texture_pool;
-    ResourcePool m_sampler_pool;
-    ResourcePool m_descriptor_set_pool;
+    ResourcePool<Buffer> m_buffer_pool;
+    ResourcePool<Texture> m_texture_pool;
+    ResourcePool<Sampler> m_sampler_pool;
+    ResourcePool<DescriptorSet> m_descriptor_set_pool;
 
     // uniform buffers
-    std::array<u32, s_max_frames_in_flight> m_camera_buffers;
-    std::array<u32, s_max_frames_in_flight> m_light_buffers;
+    std::array<BufferHandle, s_max_frames_in_flight> m_camera_buffers;
+    std::array<BufferHandle, s_max_frames_in_flight> m_light_buffers;
+
+    // per instance transforms read by the vertex shader with gl_InstanceIndex, rebuilt from the scene every frame
+    // grows when the scene needs more, each frame slot resizes its own buffer once its fence has signalled
+    static const u32 k_initial_instance_capacity = 1024;
+    std::array<BufferHandle, s_max_frames_in_flight> m_instance_buffers;
+    std::array<u32, s_max_frames_in_flight> m_instance_capacity{};
+
+    std::vector<DrawBatch> m_draw_batches;
+
+    // the batches in the order they are recorded, see RenderQueue for the key layout
+    RenderQueue m_render_queue;
+
+    // the render queue cut into runs of roughly equal recording cost, a few per thread so idle threads have chunks to steal
+    // a batch costs a fixed amount for its binds and draw call plus its indices times its instances
+    static constexpr u32 k_chunks_per_thread = 4;
+    static constexpr u64 k_draw_cost = 4096;
+    std::vector<RecordChunk> m_record_chunks;
+
+    // the draw secondaries of each frame slot are kept and executed again until something they recorded changes:
+    // a draw's parameters and textures, the queue's order, direct or indirect draws, or anything they bind being replaced
+    // transforms are read from the instance buffer, so moving models never needs a new recording
+    struct RecordedDraw
+    {
+        u32 first_instance;
+        u32 instance_count;
+        u32 geometry_block;
+        u32 first_index;
+        u32 index_count;
+        u32 vertex_offset;
+        u32 textures[4];
+
+        bool operator==(const RecordedDraw& other) const = default;
+    };
+
+    struct RecordCache
+    {
+        std::vector<vk::CommandBuffer> command_buffers;
+
+        // by draw index, the values as they were baked into the commands
+        // assets can be freed and others loaded at the same address, so nothing here points back into them
+        std::vector<RecordedDraw> draws;
+        std::vector<DrawKey> keys;
+        bool indirect = false;
+        bool valid = false;
+    };
+    std::array<RecordCache, s_max_frames_in_flight> m_record_caches;
+
+    // assets of models removed from the scene, held by the first frame slot recorded after the removal
+    // and released once that slot's fence has signalled, when no frame that could still draw them is in flight
+    std::array<std::vector<std::shared_ptr<const ModelAsset>>, s_max_frames_in_flight> m_retired_assets;
+
+    // where the kept secondaries come from, a slot's pools are only reset when its secondaries are recorded again
+    CommandPoolRing m_cached_command_pool_ring;
+
+    // models that survived the BVH query, then the same indices grouped by asset for the batches to point into
+    std::vector<u32> m_visible_models;
+    std::vector<u32> m_batch_models;
+
+    // kept around so the buckets are reused between frames
+    struct AssetBatches
+    {
+        u32 num_models = 0;
+        u32 cursor = 0;
+        u32 first_batch = 0;
+    };
+    std::unordered_map<const ModelAsset*, AssetBatches> m_asset_batches;
+
+    DrawStats m_draw_stats;
+    bool m_culling_enabled = true;
+
+    // GPU culling, a compute pass tests every mesh of every model and writes the indirect draws of each batch
+    // the batches and objects are only rebuilt when the scene changes, so recording costs the same however many models there are
+    // needs drawIndirectCount and drawIndirectFirstInstance, otherwise everything stays on the CPU path above
+    static const u32 k_cull_group_size = 64;
+    static const u32 k_initial_draw_capacity = 256;
+    static const u64 k_stale_version = UINT64_MAX;
+    bool m_gpu_culling_supported = false;
+    bool m_gpu_culling_enabled = false;
+
+    vk::DescriptorSetLayout m_cull_set_layout;
+    vk::PipelineLayout m_cull_pipeline_layout;
+    vk::Pipeline m_cull_pipeline;
+
+    // the scene version the objects were built from and how many times they have been, frame slots compare against the latter
+    std::vector<GPUObject> m_gpu_objects;
+    std::vector<glm::mat4> m_gpu_transforms;
+    u64 m_gpu_scene_version = k_stale_version;
+    u64 m_gpu_objects_generation = 0;
+
+    // each frame slot has its own copy of the objects and its own commands and counts, written once its fence has signalled
+    // the transforms go into the slot's instance buffer, where the vertex shader finds them through the draw's first instance
+    struct GPUCullFrame
+    {
+        DescriptorSetHandle descriptor_set;
+        BufferHandle objects;
+        BufferHandle commands;
+        BufferHandle counts;
+        u32 object_capacity = 0;
+        u32 draw_capacity = 0;
+
+        // what the last dispatch was given, so its counts can be read back
+        u32 num_objects = 0;
+        u32 num_draws = 0;
+        u64 generation = k_stale_version;
+    };
+    std::array<GPUCullFrame, s_max_frames_in_flight> m_cull_frames;
 
     LightingData m_light_data;
+    FrameTimings m_frame_timings;
+
+    // queries for GPU timings, each frame in flight has its own range in the pools
+    // timestamp layout per frame: render pass begin/end, imgui begin/end, then begin/end for each draw secondary
+    vk::QueryPool m_timestamp_pool;
+    vk::QueryPool m_statistics_pool;
+    u32 m_timestamps_per_frame = 0;
+    bool m_timestamps_supported = false;
+    bool m_statistics_supported = false;
+    std::array<u32, s_max_frames_in_flight> m_num_draw_timestamps{};
+    std::array<bool, s_max_frames_in_flight> m_queries_written{};
+    GPUFrameStats m_gpu_stats;
 
     // texture used when loader can't find one
-    u32 m_null_texture;
+    TextureHandle m_null_texture;
 
     // for most texture use
-    u32 m_default_sampler;
+    SamplerHandle m_default_sampler;
 
+    void init();
     void init_instance();
     void init_surface();
     void init_device();
     void init_swapchain();
+    void init_offscreen_targets();
     void init_render_pass();
     void init_graphics_pipeline();
+    void init_cull_pipeline();
     void init_command_pools();
     void init_depth_resources();
     void init_framebuffers();
     void init_descriptor_pools();
     void init_descriptor_sets();
-    void init_command_buffers();
     void init_sync_objects();
+    void init_query_pools();
     void init_imgui();
 
+    void read_gpu_stats();
+
+    // culls the scene against the camera on the scheduler's threads, first whole models through the BVH then each mesh,
+    // and groups what is left into instanced draws
+    void build_draw_batches(const Scene* scene, const culling::Frustum& frustum);
+    void reserve_instances(u32 count);
+
+    // sorts the batches by state and then front to back into the render queue
+    void queue_draw_batches();
+
+    // cuts the render queue into chunks of about the same cost, without ever reordering it
+    void build_record_chunks();
+
+    static RecordedDraw get_recorded_draw(const DrawBatch& batch);
+    [[nodiscard]] bool is_record_cache_valid(const RecordCache& cache, bool indirect) const;
+    void store_record_cache(RecordCache& cache, const vk::CommandBuffer* command_buffers, u32 count, bool indirect);
+    void invalidate_record_caches();
+
+    // one batch per mesh of every asset in the scene and one object per mesh of every model, rebuilt when the scene changes
+    void build_gpu_objects(const Scene* scene);
+    void upload_gpu_objects();
+
+    // reads back the counts of the slot's previous frame and dispatches the cull shader, has to be outside the render pass
+    void record_cull_pass(vk::CommandBuffer command_buffer, const culling::Frustum& frustum);
+    [[nodiscard]] u32 get_timestamp_index(u32 slot) const { return m_current_frame * m_timestamps_per_frame + slot; }
+
     void cleanup_swapchain();
-    void copy_buffer(vk::Buffer src_buffer, vk::Buffer dst_buffer, vk::DeviceSize size);
-    void copy_buffer_to_image(vk::Buffer buffer, vk::Image image, u32 width, u32 height);
-    void transition_image_layout(vk::Image image, vk::Format format, vk::ImageLayout old_layout, vk::ImageLayout new_layout);
     [[nodiscard]] size_t pad_uniform_buffer(size_t original_size) const;
 
     vk::CommandBuffer begin_single_time_commands();
     void end_single_time_commands(vk::CommandBuffer command_buffer);
+    vk::CommandPool get_upload_command_pool();
+
+    // true if the caller is now the one loading path and has to fulfil promise, or call fail_texture_claim from a catch block
+    // otherwise future is the texture somebody else loaded or is loading
+    bool claim_texture(const char* path, std::promise<TextureHandle>& promise, std::shared_future<TextureHandle>& future);
+    void fail_texture_claim(const char* path, std::promise<TextureHandle>& promise);
 
-    std::map<std::string, u32> m_texture_map;
+    TextureHandle load_texture(const TextureCreationInfo& texture_creation);
+    TextureHandle upload_texture(const TextureCreationInfo& texture_creation, unsigned char* pixels, i32 width, i32 height);
+    TextureHandle load_ktx2_texture(const TextureCreationInfo& texture_creation);
+    BufferHandle create_device_local_buffer(const BufferCreationInfo& buffer_creation);
+
+    // copies data into the staging ring, or a dedicated buffer if it is too big for the ring
+    StagingRing::Allocation stage_data(const void* data, vk::DeviceSize size, BufferHandle& dedicated_staging);
+    void release_staging(const StagingRing::Allocation& staging, BufferHandle dedicated_staging, UploadQueue::Ticket ticket);
+
+    // textures that are loaded or still being loaded by some thread, anyone asking for the same file waits on the future
+    std::map<std::string, std::shared_future<TextureHandle>> m_texture_map;
+    std::mutex m_texture_map_mutex;
 
     // keeps track of the current frame index
     u32 m_current_frame = 0;
 
-    // index of command buffer that is currently being written to
-    u32 m_current_cb_index = 0;
-
 #ifdef NDEBUG
     const bool m_enable_validation_layers = false;
 #else
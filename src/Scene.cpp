@@ -1,16 +1,319 @@
 #include "Scene.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace
+{
+    AABB get_world_bounds(const ModelAsset& asset, const glm::mat4& transform)
+    {
+        if(asset.meshes.empty())
+        {
+            return { glm::vec3(transform[3]), glm::vec3(transform[3]) };
+        }
+
+        AABB bounds = culling::transform_aabb(asset.meshes[0].aabb, transform * asset.transforms[0]);
+        for(u32 i = 1; i < asset.meshes.size(); ++i)
+        {
+            AABB mesh_bounds = culling::transform_aabb(asset.meshes[i].aabb, transform * asset.transforms[i]);
+            bounds.min = glm::min(bounds.min, mesh_bounds.min);
+            bounds.max = glm::max(bounds.max, mesh_bounds.max);
+        }
+
+        return bounds;
+    }
+
+    // the subtree of a moved model, models from start up to end
+    struct SubtreeRange
+    {
+        u32 start;
+        u32 end;
+    };
+
+    // each subtree belongs to one worker, which goes through it in order so parents are always done before their children
+    // the parent of a subtree's root is outside every range being updated, so nothing a worker reads is being written
+    struct UpdateTransformsTask : enki::ITaskSet
+    {
+        void init(const glm::mat4* _local_transforms, const u32* _parents, const ModelAsset* const* _assets, glm::mat4* _transforms, AABB* _bounds, const SubtreeRange* _ranges, u32 _num_ranges)
+        {
+            local_transforms = _local_transforms;
+            parents = _parents;
+            assets = _assets;
+            transforms = _transforms;
+            bounds = _bounds;
+            ranges = _ranges;
+
+            m_SetSize = _num_ranges;
+            m_MinRange = 1;
+        }
+
+        void ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum) override
+        {
+            PROFILE_SCOPE("UpdateTransformsTask");
+
+            for(u32 i = range.start; i < range.end; ++i)
+            {
+                for(u32 model = ranges[i].start; model < ranges[i].end; ++model)
+                {
+                    u32 parent = parents[model];
+                    transforms[model] = parent == Scene::k_no_parent ? local_transforms[model] : transforms[parent] * local_transforms[model];
+                    bounds[model] = get_world_bounds(*assets[model], transforms[model]);
+                }
+            }
+        }
+
+        const glm::mat4* local_transforms;
+        const u32* parents;
+        const ModelAsset* const* assets;
+        glm::mat4* transforms;
+        AABB* bounds;
+        const SubtreeRange* ranges;
+    };
+
+    // below this many models one thread gets through them quicker than handing out the subtrees takes
+    constexpr u32 k_min_parallel_models = 1024;
+
+    // how much worse than freshly built the refitted BVH may get before it's rebuilt, as a ratio of surface area heuristic costs
+    constexpr f32 k_max_bvh_degradation = 1.5f;
+}
+
+Scene::Scene(enki::TaskScheduler* scheduler) :
+    m_scheduler(scheduler),
+    m_dense_indices(1024)
+{
+}
 
 void Scene::update(float delta_time)
 {
     camera.update(delta_time);
+    update_transforms();
+    update_bvh();
 }
 
-void Scene::add_model(const Model& model)
+ModelHandle Scene::add_model(const Model& model, ModelHandle parent)
 {
-    models.push_back(model);
+    std::lock_guard<std::mutex> lock(m_models_mutex);
+    return insert(model.asset, model.transform, parent);
 }
 
-void Scene::add_model(Model&& model)
+ModelHandle Scene::add_model(Model&& model, ModelHandle parent)
 {
-    models.emplace_back(model);
-}
\ No newline at end of file
+    std::lock_guard<std::mutex> lock(m_models_mutex);
+    return insert(std::move(model.asset), model.transform, parent);
+}
+
+ModelHandle Scene::insert(std::shared_ptr<const ModelAsset> asset, const glm::mat4& transform, ModelHandle parent)
+{
+    // only the default handle means no parent, a removed parent would otherwise quietly put the model in the world
+    bool has_parent = parent != ModelHandle{};
+    if(has_parent && !is_valid(parent))
+    {
+        throw std::runtime_error("invalid parent model handle!");
+    }
+
+    ModelHandle handle = m_dense_indices.acquire();
+
+    // a child goes at the end of its parent's subtree, models without a parent at the end of everything
+    u32 parent_index = has_parent ? get_index(parent) : k_no_parent;
+    u32 index = parent_index == k_no_parent ? get_num_models() : parent_index + m_subtree_sizes[parent_index];
+
+    // if the parent has moved since the last update this is stale, but the update covers its whole subtree, this model included
+    glm::mat4 world_transform = parent_index == k_no_parent ? transform : m_transforms[parent_index] * transform;
+
+    m_transforms.insert(m_transforms.begin() + index, world_transform);
+    m_assets.insert(m_assets.begin() + index, asset.get());
+    m_bounds.insert(m_bounds.begin() + index, get_world_bounds(*asset, world_transform));
+    m_local_transforms.insert(m_local_transforms.begin() + index, transform);
+    m_parents.insert(m_parents.begin() + index, parent_index);
+    m_subtree_sizes.insert(m_subtree_sizes.begin() + index, 1);
+    m_asset_refs.insert(m_asset_refs.begin() + index, std::move(asset));
+    m_dense_handles.insert(m_dense_handles.begin() + index, handle);
+
+    for(u32 ancestor = parent_index; ancestor != k_no_parent; ancestor = m_parents[ancestor])
+    {
+        ++m_subtree_sizes[ancestor];
+    }
+
+    // appending leaves every other index where it was, anything else moves the models after this one up by one
+    if(index + 1 != get_num_models())
+    {
+        for(u32& model_parent : m_parents)
+        {
+            if(model_parent != k_no_parent && model_parent >= index)
+            {
+                ++model_parent;
+            }
+        }
+        m_parents[index] = parent_index;
+        m_bvh_stale = true;
+    }
+    update_indices(index);
+
+    ++m_version;
+    return handle;
+}
+
+void Scene::remove_model(ModelHandle handle)
+{
+    std::lock_guard<std::mutex> lock(m_models_mutex);
+    if(!is_valid(handle))
+    {
+        return;
+    }
+
+    u32 start = get_index(handle);
+    u32 count = m_subtree_sizes[start];
+    u32 end = start + count;
+
+    for(u32 ancestor = m_parents[start]; ancestor != k_no_parent; ancestor = m_parents[ancestor])
+    {
+        m_subtree_sizes[ancestor] -= count;
+    }
+
+    for(u32 i = start; i < end; ++i)
+    {
+        m_dense_indices.free(m_dense_handles[i]);
+    }
+
+    // erasing the range as a whole keeps the rest in depth first order
+    m_transforms.erase(m_transforms.begin() + start, m_transforms.begin() + end);
+    m_assets.erase(m_assets.begin() + start, m_assets.begin() + end);
+    m_bounds.erase(m_bounds.begin() + start, m_bounds.begin() + end);
+    m_local_transforms.erase(m_local_transforms.begin() + start, m_local_transforms.begin() + end);
+    m_parents.erase(m_parents.begin() + start, m_parents.begin() + end);
+    m_subtree_sizes.erase(m_subtree_sizes.begin() + start, m_subtree_sizes.begin() + end);
+    // frames already submitted may still draw the removed models, so their assets are handed to the renderer
+    // to let go of once those frames are done rather than dropped here
+    m_removed_assets.insert(m_removed_assets.end(), std::make_move_iterator(m_asset_refs.begin() + start), std::make_move_iterator(m_asset_refs.begin() + end));
+    m_asset_refs.erase(m_asset_refs.begin() + start, m_asset_refs.begin() + end);
+    m_dense_handles.erase(m_dense_handles.begin() + start, m_dense_handles.begin() + end);
+
+    for(u32& model_parent : m_parents)
+    {
+        if(model_parent != k_no_parent && model_parent >= end)
+        {
+            model_parent -= count;
+        }
+    }
+    update_indices(start);
+
+    // the BVH's items are dense indices, which just changed
+    m_bvh_stale = true;
+    ++m_version;
+}
+
+void Scene::take_removed_assets(std::vector<std::shared_ptr<const ModelAsset>>& assets)
+{
+    std::lock_guard<std::mutex> lock(m_models_mutex);
+    assets.insert(assets.end(), std::make_move_iterator(m_removed_assets.begin()), std::make_move_iterator(m_removed_assets.end()));
+    m_removed_assets.clear();
+}
+
+void Scene::update_indices(u32 first)
+{
+    for(u32 i = first; i < get_num_models(); ++i)
+    {
+        *m_dense_indices.access(m_dense_handles[i]) = i;
+    }
+}
+
+void Scene::set_transform(ModelHandle handle, const glm::mat4& transform)
+{
+    if(!is_valid(handle))
+    {
+        return;
+    }
+
+    m_local_transforms[get_index(handle)] = transform;
+    m_moved_handles.push_back(handle);
+}
+
+void Scene::update_transforms()
+{
+    if(m_moved_handles.empty())
+    {
+        return;
+    }
+
+    PROFILE_FUNCTION();
+
+    // in depth first order a subtree that starts inside another one also ends inside it, so after sorting
+    // every moved model either starts a new range or is already covered by the one before it
+    std::vector<u32> moved;
+    moved.reserve(m_moved_handles.size());
+    for(ModelHandle handle : m_moved_handles)
+    {
+        if(is_valid(handle))
+        {
+            moved.push_back(get_index(handle));
+        }
+    }
+    m_moved_handles.clear();
+    std::sort(moved.begin(), moved.end());
+
+    std::vector<SubtreeRange> ranges;
+    u32 num_models = 0;
+    for(u32 index : moved)
+    {
+        if(!ranges.empty() && index < ranges.back().end)
+        {
+            continue;
+        }
+
+        ranges.push_back({index, index + m_subtree_sizes[index]});
+        num_models += m_subtree_sizes[index];
+    }
+
+    UpdateTransformsTask task;
+    task.init(m_local_transforms.data(), m_parents.data(), m_assets.data(), m_transforms.data(), m_bounds.data(), ranges.data(), static_cast<u32>(ranges.size()));
+    if(num_models < k_min_parallel_models || ranges.size() == 1)
+    {
+        task.ExecuteRange({0, static_cast<u32>(ranges.size())}, 0);
+    }
+    else
+    {
+        m_scheduler->AddTaskSetToPipe(&task);
+        m_scheduler->WaitforTask(&task);
+    }
+
+    for(const SubtreeRange& range : ranges)
+    {
+        for(u32 i = range.start; i < range.end; ++i)
+        {
+            m_moved_models.push_back(i);
+        }
+    }
+    ++m_version;
+}
+
+bool Scene::is_valid(ModelHandle handle) const
+{
+    return m_dense_indices.valid_handle(handle);
+}
+
+void Scene::update_bvh()
+{
+    PROFILE_FUNCTION();
+
+    if(m_bvh_stale || m_bvh.get_num_items() != get_num_models())
+    {
+        m_bvh.build(m_bounds.data(), get_num_models());
+        m_moved_models.clear();
+        m_bvh_stale = false;
+        return;
+    }
+
+    for(u32 model_index : m_moved_models)
+    {
+        m_bvh.update(model_index, m_bounds[model_index]);
+    }
+    m_bvh.refit();
+    m_moved_models.clear();
+
+    // refitting keeps the tree's topology, so models that moved far from where they were built leave it with large overlapping nodes
+    if(m_bvh.get_degradation() > k_max_bvh_degradation)
+    {
+        m_bvh.build(m_bounds.data(), get_num_models());
+    }
+}
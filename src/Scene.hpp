@@ -2,16 +2,111 @@
 #include "config.hpp"
 #include "Components.hpp"
 #include "Camera.hpp"
+#include "BVH.hpp"
+#include "Memory.hpp"
 
+#include <TaskScheduler.h>
+
+#include <mutex>
+
+typedef Handle<Model> ModelHandle;
+
+// models are stored as parallel arrays indexed by a dense model index, so passes over the whole scene read each array front to back
+// models can be parented to other models, the arrays are kept in depth first order so a model's subtree is the range
+// of get_subtree_size() models starting at its own index and parents always come before their children
+// adding a child or removing a model shifts the models after it, handles stay valid through that and are the way to refer to a model over time
 class Scene
 {
 public:
-    Scene() = default;
+    explicit Scene(enki::TaskScheduler* scheduler);
     void update(float delta_time);
-    void add_model(const Model& model);
-    void add_model(Model&& model);
 
-    std::vector<Model> models;
+    // only add_model is safe to call from multiple threads, rendering reads the arrays without locking
+    // the model's transform is relative to its parent, or to the world for models without one
+    // a parent that isn't the default handle has to be valid, otherwise this throws
+    ModelHandle add_model(const Model& model, ModelHandle parent = {});
+    ModelHandle add_model(Model&& model, ModelHandle parent = {});
+
+    // the model's children go with it
+    // its asset isn't released until take_removed_assets() passes the reference on
+    void remove_model(ModelHandle handle);
+
+    // moves the references of the assets of every model removed since the last call to the end of assets
+    void take_removed_assets(std::vector<std::shared_ptr<const ModelAsset>>& assets);
+
+    // moves a model relative to its parent, it and its children get new world transforms on the next update
+    // ignored for models that have been removed
+    void set_transform(ModelHandle handle, const glm::mat4& transform);
+
+    // recomputes the world transforms and bounds of the subtrees of every model moved since the last call,
+    // separate subtrees are spread over the scheduler's threads
+    void update_transforms();
+
+    [[nodiscard]] bool is_valid(ModelHandle handle) const;
+
+    // dense index of the model in the arrays below, it changes when models before it are added or removed
+    // the handle has to be valid, a removed model's slot may already belong to another
+    [[nodiscard]] u32 get_index(ModelHandle handle) const { return *m_dense_indices.access(handle); }
+
+    [[nodiscard]] u32 get_num_models() const { return static_cast<u32>(m_transforms.size()); }
+
+    // world transforms, only current for models that haven't moved since the last update
+    [[nodiscard]] const glm::mat4* get_transforms() const { return m_transforms.data(); }
+    [[nodiscard]] const glm::mat4* get_local_transforms() const { return m_local_transforms.data(); }
+    [[nodiscard]] const ModelAsset* const* get_assets() const { return m_assets.data(); }
+
+    // k_no_parent for models placed directly in the world
+    static constexpr u32 k_no_parent = UINT32_MAX;
+    [[nodiscard]] const u32* get_parents() const { return m_parents.data(); }
+
+    // the model itself and all of its descendants
+    [[nodiscard]] const u32* get_subtree_sizes() const { return m_subtree_sizes.data(); }
+
+    // world space, covering every mesh of the model
+    [[nodiscard]] const AABB* get_bounds() const { return m_bounds.data(); }
+
+    // item i is the model at dense index i
+    // rebuilt when models were added or removed since the last update and refitted when any of them moved
+    [[nodiscard]] const BVH& get_bvh() const { return m_bvh; }
+    void update_bvh();
+
+    // bumped whenever a model is added, removed or moved, so copies of the scene like the renderer's GPU objects know when to rebuild
+    [[nodiscard]] u64 get_version() const { return m_version; }
 
     Camera camera;
+
+private:
+    enki::TaskScheduler* m_scheduler;
+    std::mutex m_models_mutex;
+
+    // hot data, read by culling, batching and the GPU object build
+    AlignedVector<glm::mat4> m_transforms;
+    AlignedVector<const ModelAsset*> m_assets;
+    AlignedVector<AABB> m_bounds;
+
+    // the hierarchy, read by the transform update
+    AlignedVector<glm::mat4> m_local_transforms;
+    AlignedVector<u32> m_parents;
+    AlignedVector<u32> m_subtree_sizes;
+
+    // cold data, keeps the assets alive and maps dense indices back to their handles
+    std::vector<std::shared_ptr<const ModelAsset>> m_asset_refs;
+    std::vector<ModelHandle> m_dense_handles;
+
+    // of models removed since the last take_removed_assets()
+    std::vector<std::shared_ptr<const ModelAsset>> m_removed_assets;
+
+    // each handle's slot holds the model's dense index, slots of removed models are reused with the next generation
+    ResourcePool<u32, Model> m_dense_indices;
+
+    // handles rather than indices, since models can shift between the move and the update
+    std::vector<ModelHandle> m_moved_handles;
+
+    BVH m_bvh;
+    std::vector<u32> m_moved_models;
+    bool m_bvh_stale = false;
+    u64 m_version = 0;
+
+    ModelHandle insert(std::shared_ptr<const ModelAsset> asset, const glm::mat4& transform, ModelHandle parent);
+    void update_indices(u32 first);
 };
@@ -0,0 +1,166 @@
+#include "StagingRing.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+
+void StagingRing::init(VmaAllocator allocator, vk::DeviceSize size, UploadQueue* upload_queue)
+{
+    m_allocator = allocator;
+    m_capacity = size;
+    m_upload_queue = upload_queue;
+
+    vk::BufferCreateInfo buffer_info{};
+    buffer_info.sType = vk::StructureType::eBufferCreateInfo;
+    buffer_info.size = size;
+    buffer_info.usage = vk::BufferUsageFlagBits::eTransferSrc;
+    buffer_info.sharingMode = vk::SharingMode::eExclusive;
+
+    // only ever written sequentially by the CPU, CPU_ONLY is always host coherent so writes never need flushing
+    VmaAllocationCreateInfo memory_info{};
+    memory_info.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+    memory_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VmaAllocationInfo allocation_info{};
+    if(vmaCreateBuffer(m_allocator, reinterpret_cast<const VkBufferCreateInfo*>(&buffer_info), &memory_info, &m_buffer, &m_allocation, &allocation_info) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create staging ring!");
+    }
+
+    m_mapped_data = static_cast<u8*>(allocation_info.pMappedData);
+}
+
+void StagingRing::destroy()
+{
+    vmaDestroyBuffer(m_allocator, m_buffer, m_allocation);
+    m_regions.clear();
+}
+
+StagingRing::Allocation StagingRing::allocate(vk::DeviceSize size, vk::DeviceSize alignment)
+{
+    if(size == 0 || size >= m_capacity)
+    {
+        return {};
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    vk::DeviceSize offset;
+    while(true)
+    {
+        reclaim();
+        if(try_place(size, alignment, offset))
+        {
+            break;
+        }
+
+        // out of space, the oldest region is what frees up room next
+        PROFILE_SCOPE("Wait for staging space");
+        const Region& oldest = m_regions.front();
+        if(oldest.retired)
+        {
+            UploadQueue::Ticket ticket = oldest.ticket;
+            lock.unlock();
+            m_upload_queue->wait(ticket);
+            lock.lock();
+        }
+        else
+        {
+            // still being filled by another thread
+            m_retired.wait(lock);
+        }
+    }
+
+    m_regions.push_back({ offset, size });
+    m_head = offset + size;
+
+    Allocation allocation;
+    allocation.buffer = m_buffer;
+    allocation.offset = offset;
+    allocation.size = size;
+    allocation.data = m_mapped_data + offset;
+    return allocation;
+}
+
+void StagingRing::retire(const Allocation& allocation, UploadQueue::Ticket ticket)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_regions.empty())
+        {
+            return;
+        }
+
+        // regions mostly retire in the order they were handed out, so the oldest one is the usual hit
+        // otherwise the distance from the oldest region around the ring grows along the deque and can be binary searched
+        vk::DeviceSize tail = m_regions.front().offset;
+        auto ring_distance = [this, tail](vk::DeviceSize offset) { return offset >= tail ? offset - tail : offset + m_capacity - tail; };
+
+        auto region = m_regions.begin();
+        if(region->offset != allocation.offset)
+        {
+            region = std::lower_bound(m_regions.begin(), m_regions.end(), ring_distance(allocation.offset),
+                                      [&](const Region& r, vk::DeviceSize distance) { return ring_distance(r.offset) < distance; });
+        }
+
+        if(region != m_regions.end() && region->offset == allocation.offset)
+        {
+            region->ticket = ticket;
+            region->retired = true;
+        }
+    }
+
+    m_retired.notify_all();
+}
+
+bool StagingRing::try_place(vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize& offset) const
+{
+    if(m_regions.empty())
+    {
+        offset = 0;
+        return true;
+    }
+
+    vk::DeviceSize tail = m_regions.front().offset;
+    vk::DeviceSize aligned_head = (m_head + alignment - 1) & ~(alignment - 1);
+
+    // the head never catches up to the tail exactly, otherwise a full ring would look empty
+    if(m_head >= tail)
+    {
+        // used space is one block in the middle, try after it and then wrap around to the start
+        if(aligned_head + size <= m_capacity)
+        {
+            offset = aligned_head;
+            return true;
+        }
+
+        if(size < tail)
+        {
+            offset = 0;
+            return true;
+        }
+
+        return false;
+    }
+
+    // already wrapped, the free space is between head and tail
+    if(aligned_head + size < tail)
+    {
+        offset = aligned_head;
+        return true;
+    }
+
+    return false;
+}
+
+void StagingRing::reclaim()
+{
+    while(!m_regions.empty() && m_regions.front().retired && m_upload_queue->is_complete(m_regions.front().ticket))
+    {
+        m_regions.pop_front();
+    }
+
+    if(m_regions.empty())
+    {
+        m_head = 0;
+    }
+}
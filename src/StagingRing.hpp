@@ -0,0 +1,58 @@
+#pragma once
+
+#include "config.hpp"
+#include "UploadQueue.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <vk_mem_alloc.h>
+
+// one big persistently mapped buffer that all uploads are staged through
+// space is handed out in order, and each region comes back once the upload batch that reads it has finished
+class StagingRing
+{
+public:
+    struct Allocation
+    {
+        vk::Buffer buffer;
+        vk::DeviceSize offset = 0;
+        vk::DeviceSize size = 0;
+        u8* data = nullptr;         // null if the request can never fit in the ring
+    };
+
+    void init(VmaAllocator allocator, vk::DeviceSize size, UploadQueue* upload_queue);
+    void destroy();
+
+    // blocks until enough of the ring has been reclaimed, safe to call from any thread
+    Allocation allocate(vk::DeviceSize size, vk::DeviceSize alignment = 16);
+
+    // call once the copies reading from the allocation have been recorded, the region is reused after the ticket completes
+    void retire(const Allocation& allocation, UploadQueue::Ticket ticket);
+
+    [[nodiscard]] vk::DeviceSize get_capacity() const { return m_capacity; }
+
+private:
+    struct Region
+    {
+        vk::DeviceSize offset;
+        vk::DeviceSize size;
+        UploadQueue::Ticket ticket = 0;
+        bool retired = false;
+    };
+
+    VmaAllocator m_allocator = nullptr;
+    VkBuffer m_buffer = VK_NULL_HANDLE;
+    VmaAllocation m_allocation = nullptr;
+    u8* m_mapped_data = nullptr;
+    vk::DeviceSize m_capacity = 0;
+    UploadQueue* m_upload_queue = nullptr;
+
+    // regions in the order they were handed out, the front one is always the oldest
+    std::mutex m_mutex;
+    std::condition_variable m_retired;
+    std::deque<Region> m_regions;
+    vk::DeviceSize m_head = 0;
+
+    bool try_place(vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize& offset) const;
+    void reclaim();
+};
@@ -0,0 +1,533 @@
+#include "UploadQueue.hpp"
+#include "Profiler.hpp"
+
+void UploadQueue::init(vk::Device device, u32 transfer_family, u32 graphics_family, vk::Queue transfer_queue, vk::Queue graphics_queue, std::mutex* queue_mutex)
+{
+    m_device = device;
+    m_transfer_family = transfer_family;
+    m_graphics_family = graphics_family;
+    m_transfer_queue = transfer_queue;
+    m_graphics_queue = graphics_queue;
+    m_queue_mutex = queue_mutex;
+
+    // exclusive resources written on one family and read on another need their ownership handed over
+    m_ownership_transfer = transfer_family != graphics_family;
+
+    vk::CommandPoolCreateInfo pool_info{};
+    pool_info.sType = vk::StructureType::eCommandPoolCreateInfo;
+    pool_info.flags = vk::CommandPoolCreateFlagBits::eTransient;
+    pool_info.queueFamilyIndex = transfer_family;
+
+    if(m_device.createCommandPool(&pool_info, nullptr, &m_transfer_pool) != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("failed to create transfer command pool!");
+    }
+
+    pool_info.queueFamilyIndex = graphics_family;
+    if(m_device.createCommandPool(&pool_info, nullptr, &m_acquire_pool) != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("failed to create acquire command pool!");
+    }
+
+    vk::SemaphoreTypeCreateInfo timeline_info{};
+    timeline_info.sType = vk::StructureType::eSemaphoreTypeCreateInfo;
+    timeline_info.semaphoreType = vk::SemaphoreType::eTimeline;
+    timeline_info.initialValue = 0;
+
+    vk::SemaphoreCreateInfo semaphore_info{};
+    semaphore_info.sType = vk::StructureType::eSemaphoreCreateInfo;
+    semaphore_info.pNext = &timeline_info;
+
+    if(m_device.createSemaphore(&semaphore_info, nullptr, &m_timeline) != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("failed to create upload timeline semaphore!");
+    }
+
+    if(m_ownership_transfer && m_device.createSemaphore(&semaphore_info, nullptr, &m_transfer_timeline) != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("failed to create upload transfer timeline semaphore!");
+    }
+}
+
+void UploadQueue::destroy()
+{
+    wait(flush());
+
+    m_device.destroyCommandPool(m_transfer_pool, nullptr);
+    m_device.destroyCommandPool(m_acquire_pool, nullptr);
+    m_device.destroySemaphore(m_timeline, nullptr);
+    if(m_transfer_timeline)
+    {
+        m_device.destroySemaphore(m_transfer_timeline, nullptr);
+    }
+}
+
+UploadQueue::Ticket UploadQueue::upload_buffer(vk::Buffer src, vk::DeviceSize src_offset, vk::Buffer dst, vk::DeviceSize dst_offset, vk::DeviceSize size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(!m_open_batch.transfer_commands)
+    {
+        begin_batch();
+    }
+
+    vk::BufferCopy copy_region{};
+    copy_region.srcOffset = src_offset;
+    copy_region.dstOffset = dst_offset;
+    copy_region.size = size;
+    m_open_batch.transfer_commands.copyBuffer(src, dst, 1, &copy_region);
+
+    if(m_ownership_transfer)
+    {
+        // the release half, access on the destination side is ignored
+        vk::BufferMemoryBarrier barrier{};
+        barrier.sType = vk::StructureType::eBufferMemoryBarrier;
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.srcQueueFamilyIndex = m_transfer_family;
+        barrier.dstQueueFamilyIndex = m_graphics_family;
+        barrier.buffer = dst;
+        barrier.offset = dst_offset;
+        barrier.size = size;
+
+        m_open_batch.transfer_commands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(), nullptr, barrier, nullptr);
+
+        // and the matching acquire, which has to describe the exact same transfer
+        barrier.srcAccessMask = vk::AccessFlagBits::eNone;
+        barrier.dstAccessMask = vk::AccessFlagBits::eMemoryRead;
+
+        m_open_batch.acquire_commands.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags(), nullptr, barrier, nullptr);
+    }
+
+    Ticket ticket = m_open_batch.ticket;
+    if(++m_open_batch.num_copies >= k_max_batch_copies)
+    {
+        submit_batch();
+    }
+
+    return ticket;
+}
+
+UploadQueue::Ticket UploadQueue::upload_image(vk::Buffer src, vk::DeviceSize src_offset, vk::Image dst, u32 width, u32 height, u32 mip_levels)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(!m_open_batch.transfer_commands)
+    {
+        begin_batch();
+    }
+
+    vk::BufferImageCopy region{};
+    region.bufferOffset = src_offset;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = vk::Offset3D{0, 0, 0};
+    region.imageExtent = vk::Extent3D{width, height, 1};
+
+    record_image_copy(src, dst, &region, 1, mip_levels);
+
+    if(mip_levels > 1)
+    {
+        record_mip_chain(dst, width, height, mip_levels);
+    }
+    else
+    {
+        release_to_shader_read(dst, 1);
+    }
+
+    Ticket ticket = m_open_batch.ticket;
+    if(++m_open_batch.num_copies >= k_max_batch_copies)
+    {
+        submit_batch();
+    }
+
+    return ticket;
+}
+
+UploadQueue::Ticket UploadQueue::upload_image_levels(vk::Buffer src, vk::Image dst, const vk::BufferImageCopy* regions, u32 mip_levels)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(!m_open_batch.transfer_commands)
+    {
+        begin_batch();
+    }
+
+    record_image_copy(src, dst, regions, mip_levels, mip_levels);
+    release_to_shader_read(dst, mip_levels);
+
+    Ticket ticket = m_open_batch.ticket;
+    if(++m_open_batch.num_copies >= k_max_batch_copies)
+    {
+        submit_batch();
+    }
+
+    return ticket;
+}
+
+void UploadQueue::record_image_copy(vk::Buffer src, vk::Image dst, const vk::BufferImageCopy* regions, u32 region_count, u32 mip_levels)
+{
+    // a barrier like this is normally used to sync access to resources,
+    // but it can also be used to transition image layouts and transfer queue family ownership
+    vk::ImageMemoryBarrier barrier{};
+    barrier.sType = vk::StructureType::eImageMemoryBarrier;
+    barrier.oldLayout = vk::ImageLayout::eUndefined;
+    barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = dst;
+    barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mip_levels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = vk::AccessFlagBits::eNone;
+    barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+
+    m_open_batch.transfer_commands.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr, nullptr, barrier);
+
+    m_open_batch.transfer_commands.copyBufferToImage(src, dst, vk::ImageLayout::eTransferDstOptimal, region_count, regions);
+}
+
+void UploadQueue::release_to_shader_read(vk::Image image, u32 mip_levels)
+{
+    vk::ImageMemoryBarrier barrier{};
+    barrier.sType = vk::StructureType::eImageMemoryBarrier;
+    barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+    barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mip_levels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eNone;
+
+    // the transition to shader read happens as part of the ownership transfer if there is one
+    if(m_ownership_transfer)
+    {
+        barrier.srcQueueFamilyIndex = m_transfer_family;
+        barrier.dstQueueFamilyIndex = m_graphics_family;
+    }
+
+    m_open_batch.transfer_commands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(), nullptr, nullptr, barrier);
+
+    if(m_ownership_transfer)
+    {
+        barrier.srcAccessMask = vk::AccessFlagBits::eNone;
+        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+        m_open_batch.acquire_commands.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags(), nullptr, nullptr, barrier);
+    }
+}
+
+void UploadQueue::record_mip_chain(vk::Image image, u32 width, u32 height, u32 mip_levels)
+{
+    // blits need a graphics queue, a dedicated transfer queue can't do them
+    // so with an ownership transfer the whole image is handed over still in transfer dst and the chain is built in the acquire
+    vk::CommandBuffer commands = m_open_batch.transfer_commands;
+
+    vk::ImageMemoryBarrier barrier{};
+    barrier.sType = vk::StructureType::eImageMemoryBarrier;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    if(m_ownership_transfer)
+    {
+        barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+        barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
+        barrier.srcQueueFamilyIndex = m_transfer_family;
+        barrier.dstQueueFamilyIndex = m_graphics_family;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = mip_levels;
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.dstAccessMask = vk::AccessFlagBits::eNone;
+
+        m_open_batch.transfer_commands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(), nullptr, nullptr, barrier);
+
+        barrier.srcAccessMask = vk::AccessFlagBits::eNone;
+        barrier.dstAccessMask = vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite;
+
+        m_open_batch.acquire_commands.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr, nullptr, barrier);
+
+        commands = m_open_batch.acquire_commands;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    }
+
+    barrier.subresourceRange.levelCount = 1;
+
+    i32 mip_width = static_cast<i32>(width);
+    i32 mip_height = static_cast<i32>(height);
+
+    for(u32 i = 1; i < mip_levels; ++i)
+    {
+        // the previous level has been written, by the copy or the last blit, and is now read from
+        barrier.subresourceRange.baseMipLevel = i - 1;
+        barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+        barrier.newLayout = vk::ImageLayout::eTransferSrcOptimal;
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
+
+        commands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr, nullptr, barrier);
+
+        i32 next_width = std::max(mip_width / 2, 1);
+        i32 next_height = std::max(mip_height / 2, 1);
+
+        vk::ImageBlit blit{};
+        blit.srcOffsets[0] = vk::Offset3D{0, 0, 0};
+        blit.srcOffsets[1] = vk::Offset3D{mip_width, mip_height, 1};
+        blit.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+        blit.srcSubresource.mipLevel = i - 1;
+        blit.srcSubresource.baseArrayLayer = 0;
+        blit.srcSubresource.layerCount = 1;
+        blit.dstOffsets[0] = vk::Offset3D{0, 0, 0};
+        blit.dstOffsets[1] = vk::Offset3D{next_width, next_height, 1};
+        blit.dstSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+        blit.dstSubresource.mipLevel = i;
+        blit.dstSubresource.baseArrayLayer = 0;
+        blit.dstSubresource.layerCount = 1;
+
+        commands.blitImage(image, vk::ImageLayout::eTransferSrcOptimal, image, vk::ImageLayout::eTransferDstOptimal, 1, &blit, vk::Filter::eLinear);
+
+        // done with the previous level for good
+        barrier.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
+        barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferRead;
+        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+        commands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags(), nullptr, nullptr, barrier);
+
+        mip_width = next_width;
+        mip_height = next_height;
+    }
+
+    // the smallest level is only ever blitted to
+    barrier.subresourceRange.baseMipLevel = mip_levels - 1;
+    barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+    barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+    commands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags(), nullptr, nullptr, barrier);
+}
+
+UploadQueue::Ticket UploadQueue::on_complete(std::function<void()> callback)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(!m_open_batch.transfer_commands)
+    {
+        begin_batch();
+    }
+
+    m_open_batch.callbacks.push_back(std::move(callback));
+    return m_open_batch.ticket;
+}
+
+UploadQueue::Ticket UploadQueue::flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_open_batch.transfer_commands)
+    {
+        submit_batch();
+    }
+
+    return m_submitted_ticket;
+}
+
+bool UploadQueue::is_complete(Ticket ticket)
+{
+    u64 completed = 0;
+    if(m_device.getSemaphoreCounterValue(m_timeline, &completed) != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("failed to read upload timeline!");
+    }
+
+    return completed >= ticket;
+}
+
+void UploadQueue::wait(Ticket ticket)
+{
+    PROFILE_FUNCTION();
+
+    // waiting on the open batch would never finish, so push it out first
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_open_batch.transfer_commands && ticket >= m_open_batch.ticket)
+        {
+            submit_batch();
+        }
+    }
+
+    vk::SemaphoreWaitInfo wait_info{};
+    wait_info.sType = vk::StructureType::eSemaphoreWaitInfo;
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &m_timeline;
+    wait_info.pValues = &ticket;
+
+    if(m_device.waitSemaphores(&wait_info, UINT64_MAX) != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("failed to wait for upload!");
+    }
+
+    collect();
+}
+
+void UploadQueue::collect()
+{
+    u64 completed = 0;
+    if(m_device.getSemaphoreCounterValue(m_timeline, &completed) != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("failed to read upload timeline!");
+    }
+
+    // callbacks are run without the lock since they usually go back into the renderer
+    std::vector<std::function<void()>> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for(auto it = m_in_flight.begin(); it != m_in_flight.end();)
+        {
+            if(it->ticket > completed)
+            {
+                ++it;
+                continue;
+            }
+
+            m_device.freeCommandBuffers(m_transfer_pool, 1, &it->transfer_commands);
+            if(it->acquire_commands)
+            {
+                m_device.freeCommandBuffers(m_acquire_pool, 1, &it->acquire_commands);
+            }
+
+            for(auto& callback : it->callbacks)
+            {
+                callbacks.push_back(std::move(callback));
+            }
+
+            it = m_in_flight.erase(it);
+        }
+    }
+
+    for(auto& callback : callbacks)
+    {
+        callback();
+    }
+}
+
+UploadQueue::Ticket UploadQueue::get_submitted_ticket()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_submitted_ticket;
+}
+
+void UploadQueue::begin_batch()
+{
+    m_open_batch = {};
+    m_open_batch.ticket = m_next_ticket;
+    ++m_next_ticket;
+
+    vk::CommandBufferAllocateInfo alloc_info{};
+    alloc_info.sType = vk::StructureType::eCommandBufferAllocateInfo;
+    alloc_info.level = vk::CommandBufferLevel::ePrimary;
+    alloc_info.commandBufferCount = 1;
+
+    vk::CommandBufferBeginInfo begin_info{};
+    begin_info.sType = vk::StructureType::eCommandBufferBeginInfo;
+    begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+
+    alloc_info.commandPool = m_transfer_pool;
+    if(m_device.allocateCommandBuffers(&alloc_info, &m_open_batch.transfer_commands) != vk::Result::eSuccess ||
+       m_open_batch.transfer_commands.begin(&begin_info) != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("failed to begin upload command buffer!");
+    }
+
+    if(m_ownership_transfer)
+    {
+        alloc_info.commandPool = m_acquire_pool;
+        if(m_device.allocateCommandBuffers(&alloc_info, &m_open_batch.acquire_commands) != vk::Result::eSuccess ||
+           m_open_batch.acquire_commands.begin(&begin_info) != vk::Result::eSuccess)
+        {
+            throw std::runtime_error("failed to begin acquire command buffer!");
+        }
+    }
+}
+
+void UploadQueue::submit_batch()
+{
+    PROFILE_FUNCTION();
+
+    Batch& batch = m_open_batch;
+    batch.transfer_commands.end();
+
+    // without an ownership transfer the transfer submit is the last step and signals the ticket itself,
+    // otherwise it signals the transfer timeline at the same value and the acquire signals the ticket
+    vk::Semaphore transfer_semaphore = m_ownership_transfer ? m_transfer_timeline : m_timeline;
+
+    vk::TimelineSemaphoreSubmitInfo transfer_timeline{};
+    transfer_timeline.sType = vk::StructureType::eTimelineSemaphoreSubmitInfo;
+    transfer_timeline.signalSemaphoreValueCount = 1;
+    transfer_timeline.pSignalSemaphoreValues = &batch.ticket;
+
+    vk::SubmitInfo transfer_submit{};
+    transfer_submit.sType = vk::StructureType::eSubmitInfo;
+    transfer_submit.pNext = &transfer_timeline;
+    transfer_submit.commandBufferCount = 1;
+    transfer_submit.pCommandBuffers = &batch.transfer_commands;
+    transfer_submit.signalSemaphoreCount = 1;
+    transfer_submit.pSignalSemaphores = &transfer_semaphore;
+
+    std::lock_guard<std::mutex> lock(*m_queue_mutex);
+
+    if(m_transfer_queue.submit(1, &transfer_submit, nullptr) != vk::Result::eSuccess)
+    {
+        throw std::runtime_error("failed to submit upload batch!");
+    }
+
+    if(m_ownership_transfer)
+    {
+        batch.acquire_commands.end();
+
+        vk::PipelineStageFlags wait_stage = vk::PipelineStageFlagBits::eAllCommands;
+
+        vk::TimelineSemaphoreSubmitInfo acquire_timeline{};
+        acquire_timeline.sType = vk::StructureType::eTimelineSemaphoreSubmitInfo;
+        acquire_timeline.waitSemaphoreValueCount = 1;
+        acquire_timeline.pWaitSemaphoreValues = &batch.ticket;
+        acquire_timeline.signalSemaphoreValueCount = 1;
+        acquire_timeline.pSignalSemaphoreValues = &batch.ticket;
+
+        vk::SubmitInfo acquire_submit{};
+        acquire_submit.sType = vk::StructureType::eSubmitInfo;
+        acquire_submit.pNext = &acquire_timeline;
+        acquire_submit.waitSemaphoreCount = 1;
+        acquire_submit.pWaitSemaphores = &m_transfer_timeline;
+        acquire_submit.pWaitDstStageMask = &wait_stage;
+        acquire_submit.commandBufferCount = 1;
+        acquire_submit.pCommandBuffers = &batch.acquire_commands;
+        acquire_submit.signalSemaphoreCount = 1;
+        acquire_submit.pSignalSemaphores = &m_timeline;
+
+        if(m_graphics_queue.submit(1, &acquire_submit, nullptr) != vk::Result::eSuccess)
+        {
+            throw std::runtime_error("failed to submit upload acquire!");
+        }
+    }
+
+    m_submitted_ticket = batch.ticket;
+    m_in_flight.push_back(std::move(batch));
+    m_open_batch = {};
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "config.hpp"
+
+#include <functional>
+#include <mutex>
+
+// batches buffer and image copies into command buffers on the transfer queue
+// completion is tracked with a timeline semaphore, every batch signals its ticket value once the graphics queue owns the resources
+// when the transfer and graphics families differ the resources are released on the transfer queue and acquired on the graphics queue,
+// the release signals a second timeline only the acquire waits on, so the public one is only ever signalled from the graphics queue
+class UploadQueue
+{
+public:
+    typedef u64 Ticket;
+
+    void init(vk::Device device, u32 transfer_family, u32 graphics_family, vk::Queue transfer_queue, vk::Queue graphics_queue, std::mutex* queue_mutex);
+    void destroy();
+
+    // all of these can be called from any thread, src has to stay alive until the returned ticket completes
+    Ticket upload_buffer(vk::Buffer src, vk::DeviceSize src_offset, vk::Buffer dst, vk::DeviceSize dst_offset, vk::DeviceSize size);
+    // levels past the first are generated with linear blits, so the format has to support linear filtered blits when mip_levels > 1
+    Ticket upload_image(vk::Buffer src, vk::DeviceSize src_offset, vk::Image dst, u32 width, u32 height, u32 mip_levels = 1);
+
+    // for files that already contain their mip chain, one region per level
+    Ticket upload_image_levels(vk::Buffer src, vk::Image dst, const vk::BufferImageCopy* regions, u32 mip_levels);
+
+    // runs once the batch that is currently open has finished on the GPU, e.g. freeing a staging buffer
+    Ticket on_complete(std::function<void()> callback);
+
+    // submits the open batch, returns the ticket of the last submitted batch if there was nothing to do
+    Ticket flush();
+
+    [[nodiscard]] bool is_complete(Ticket ticket);
+    void wait(Ticket ticket);
+
+    // frees finished batches and runs their callbacks
+    void collect();
+
+    // the graphics queue waits on this at get_submitted_ticket() so nothing is drawn before its upload finished
+    [[nodiscard]] vk::Semaphore get_timeline() const { return m_timeline; }
+    [[nodiscard]] Ticket get_submitted_ticket();
+
+private:
+    struct Batch
+    {
+        Ticket ticket = 0;
+        vk::CommandBuffer transfer_commands;
+        vk::CommandBuffer acquire_commands;
+        u32 num_copies = 0;
+        std::vector<std::function<void()>> callbacks;
+    };
+
+    // past this many copies the batch is submitted without waiting for a flush
+    static const u32 k_max_batch_copies = 256;
+
+    vk::Device m_device;
+    vk::Queue m_transfer_queue;
+    vk::Queue m_graphics_queue;
+    u32 m_transfer_family = 0;
+    u32 m_graphics_family = 0;
+    bool m_ownership_transfer = false;
+
+    vk::CommandPool m_transfer_pool;
+    vk::CommandPool m_acquire_pool;
+    vk::Semaphore m_timeline;
+
+    // only with an ownership transfer, signalled by the release at the batch's ticket for its acquire to wait on
+    // the two queues can run a batch apart, so sharing one timeline could see a later release signal before an earlier acquire
+    vk::Semaphore m_transfer_timeline;
+
+    // shared with the renderer, queue access has to be externally synchronized
+    std::mutex* m_queue_mutex = nullptr;
+
+    // guards everything below, recording into the open batch is only a few commands so one lock is fine
+    std::mutex m_mutex;
+    Batch m_open_batch;
+    std::vector<Batch> m_in_flight;
+
+    Ticket m_next_ticket = 1;
+    Ticket m_submitted_ticket = 0;
+
+    void begin_batch();
+    void record_image_copy(vk::Buffer src, vk::Image dst, const vk::BufferImageCopy* regions, u32 region_count, u32 mip_levels);
+    void record_mip_chain(vk::Image image, u32 width, u32 height, u32 mip_levels);
+    void release_to_shader_read(vk::Image image, u32 mip_levels);
+    void submit_batch();
+};
@@ -4,15 +4,41 @@
 
 int main(int argc, char** argv)
 {
-    std::string scene_name = (argc > 1 ) ? argv[1] : "../scene.txt";
+    std::string scene_name = "../scene.txt";
+
+    // --headless <frames> renders that many frames offscreen and exits
+    bool headless = false;
+    u32 num_headless_frames = 0;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "--headless" && i + 1 < argc)
+        {
+            headless = true;
+            num_headless_frames = std::stoul(argv[++i]);
+        }
+        else
+        {
+            scene_name = arg;
+        }
+    }
+
     std::vector<std::string> scene = util::read_file_to_vector(scene_name);
 
-    Application app(1300, 1000);
+    Application app(1300, 1000, headless);
     app.load_scene(scene);
 
     try
     {
-        app.run();
+        if(headless)
+        {
+            app.run_headless(num_headless_frames);
+        }
+        else
+        {
+            app.run();
+        }
     }
     catch (const std::exception& e)
     {
@@ -0,0 +1,376 @@
+#include "BlockCompression.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace bc
+{
+    namespace
+    {
+        // finds the line through the block's colours that the endpoints are placed on
+        // the principal axis of the covariance matrix, found with a few rounds of power iteration
+        void find_endpoints(const uint8_t* rgba, int channels, float start[4], float end[4])
+        {
+            float mean[4] = {};
+            float min[4] = { 255.f, 255.f, 255.f, 255.f };
+            float max[4] = {};
+            for(int i = 0; i < 16; ++i)
+            {
+                for(int c = 0; c < channels; ++c)
+                {
+                    float value = rgba[i * 4 + c];
+                    mean[c] += value / 16.f;
+                    min[c] = std::min(min[c], value);
+                    max[c] = std::max(max[c], value);
+                }
+            }
+
+            float covariance[4][4] = {};
+            for(int i = 0; i < 16; ++i)
+            {
+                for(int a = 0; a < channels; ++a)
+                {
+                    for(int b = 0; b < channels; ++b)
+                    {
+                        covariance[a][b] += (rgba[i * 4 + a] - mean[a]) * (rgba[i * 4 + b] - mean[b]);
+                    }
+                }
+            }
+
+            // the bounding box diagonal is a decent first guess and the fallback for flat blocks
+            float axis[4] = {};
+            for(int c = 0; c < channels; ++c)
+            {
+                axis[c] = max[c] - min[c];
+            }
+
+            for(int iteration = 0; iteration < 8; ++iteration)
+            {
+                float next[4] = {};
+                float length = 0.f;
+                for(int a = 0; a < channels; ++a)
+                {
+                    for(int b = 0; b < channels; ++b)
+                    {
+                        next[a] += covariance[a][b] * axis[b];
+                    }
+                    length += next[a] * next[a];
+                }
+
+                if(length < 1e-6f)
+                {
+                    break;
+                }
+
+                length = std::sqrt(length);
+                for(int c = 0; c < channels; ++c)
+                {
+                    axis[c] = next[c] / length;
+                }
+            }
+
+            float length = 0.f;
+            for(int c = 0; c < channels; ++c)
+            {
+                length += axis[c] * axis[c];
+            }
+
+            if(length < 1e-6f)
+            {
+                // every texel is the same colour
+                for(int c = 0; c < 4; ++c)
+                {
+                    start[c] = end[c] = (c < channels) ? mean[c] : 255.f;
+                }
+                return;
+            }
+
+            length = std::sqrt(length);
+            float min_t = 1e9f;
+            float max_t = -1e9f;
+            for(int i = 0; i < 16; ++i)
+            {
+                float t = 0.f;
+                for(int c = 0; c < channels; ++c)
+                {
+                    t += (rgba[i * 4 + c] - mean[c]) * axis[c] / length;
+                }
+                min_t = std::min(min_t, t);
+                max_t = std::max(max_t, t);
+            }
+
+            for(int c = 0; c < 4; ++c)
+            {
+                if(c < channels)
+                {
+                    start[c] = std::clamp(mean[c] + min_t * axis[c] / length, 0.f, 255.f);
+                    end[c] = std::clamp(mean[c] + max_t * axis[c] / length, 0.f, 255.f);
+                }
+                else
+                {
+                    start[c] = end[c] = 255.f;
+                }
+            }
+        }
+
+        uint16_t to_565(const float colour[4])
+        {
+            uint16_t r = static_cast<uint16_t>(std::lround(colour[0] * 31.f / 255.f));
+            uint16_t g = static_cast<uint16_t>(std::lround(colour[1] * 63.f / 255.f));
+            uint16_t b = static_cast<uint16_t>(std::lround(colour[2] * 31.f / 255.f));
+            return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+        }
+
+        void from_565(uint16_t value, int colour[3])
+        {
+            int r = (value >> 11) & 31;
+            int g = (value >> 5) & 63;
+            int b = value & 31;
+            colour[0] = (r << 3) | (r >> 2);
+            colour[1] = (g << 2) | (g >> 4);
+            colour[2] = (b << 3) | (b >> 2);
+        }
+
+        void compress_bc4(const uint8_t* rgba, int channel, uint8_t* out)
+        {
+            int min = 255;
+            int max = 0;
+            for(int i = 0; i < 16; ++i)
+            {
+                min = std::min(min, static_cast<int>(rgba[i * 4 + channel]));
+                max = std::max(max, static_cast<int>(rgba[i * 4 + channel]));
+            }
+
+            // max first selects the 8 value mode
+            out[0] = static_cast<uint8_t>(max);
+            out[1] = static_cast<uint8_t>(min);
+            memset(out + 2, 0, 6);
+
+            if(max == min)
+            {
+                return;
+            }
+
+            int palette[8];
+            palette[0] = max;
+            palette[1] = min;
+            for(int i = 2; i < 8; ++i)
+            {
+                palette[i] = ((8 - i) * max + (i - 1) * min + 3) / 7;
+            }
+
+            uint64_t indices = 0;
+            for(int i = 0; i < 16; ++i)
+            {
+                int value = rgba[i * 4 + channel];
+                int best = 0;
+                int best_error = 256;
+                for(int j = 0; j < 8; ++j)
+                {
+                    int error = std::abs(palette[j] - value);
+                    if(error < best_error)
+                    {
+                        best = j;
+                        best_error = error;
+                    }
+                }
+                indices |= static_cast<uint64_t>(best) << (3 * i);
+            }
+
+            for(int i = 0; i < 6; ++i)
+            {
+                out[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+            }
+        }
+
+        struct BitWriter
+        {
+            uint8_t* out;
+            uint32_t position = 0;
+
+            void write(uint32_t value, uint32_t bits)
+            {
+                for(uint32_t i = 0; i < bits; ++i, ++position)
+                {
+                    if((value >> i) & 1)
+                    {
+                        out[position >> 3] |= static_cast<uint8_t>(1 << (position & 7));
+                    }
+                }
+            }
+        };
+
+        // 7 bit endpoint plus a shared lowest bit, picks whichever p-bit gets closer over all channels
+        void quantize_bc7_endpoint(const float endpoint[4], int quantized[4], int& p_bit)
+        {
+            int best_error = INT32_MAX;
+            for(int p = 0; p < 2; ++p)
+            {
+                int candidate[4];
+                int error = 0;
+                for(int c = 0; c < 4; ++c)
+                {
+                    candidate[c] = std::clamp(static_cast<int>(std::lround((endpoint[c] - p) / 2.f)), 0, 127);
+                    int difference = ((candidate[c] << 1) | p) - static_cast<int>(std::lround(endpoint[c]));
+                    error += difference * difference;
+                }
+
+                if(error < best_error)
+                {
+                    best_error = error;
+                    p_bit = p;
+                    memcpy(quantized, candidate, sizeof(candidate));
+                }
+            }
+        }
+    }
+
+    void compress_bc1(const uint8_t* rgba, uint8_t* out)
+    {
+        float start[4], end[4];
+        find_endpoints(rgba, 3, start, end);
+
+        uint16_t colour0 = to_565(end);
+        uint16_t colour1 = to_565(start);
+
+        // colour0 > colour1 selects the 4 colour mode, the 3 colour mode would turn one index into black or transparent
+        if(colour0 < colour1)
+        {
+            std::swap(colour0, colour1);
+        }
+
+        out[0] = static_cast<uint8_t>(colour0);
+        out[1] = static_cast<uint8_t>(colour0 >> 8);
+        out[2] = static_cast<uint8_t>(colour1);
+        out[3] = static_cast<uint8_t>(colour1 >> 8);
+        memset(out + 4, 0, 4);
+
+        if(colour0 == colour1)
+        {
+            return;
+        }
+
+        int palette[4][3];
+        from_565(colour0, palette[0]);
+        from_565(colour1, palette[1]);
+        for(int c = 0; c < 3; ++c)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+        }
+
+        uint32_t indices = 0;
+        for(int i = 0; i < 16; ++i)
+        {
+            int best = 0;
+            int best_error = INT32_MAX;
+            for(int j = 0; j < 4; ++j)
+            {
+                int error = 0;
+                for(int c = 0; c < 3; ++c)
+                {
+                    int difference = palette[j][c] - rgba[i * 4 + c];
+                    error += difference * difference;
+                }
+
+                if(error < best_error)
+                {
+                    best = j;
+                    best_error = error;
+                }
+            }
+            indices |= static_cast<uint32_t>(best) << (2 * i);
+        }
+
+        for(int i = 0; i < 4; ++i)
+        {
+            out[4 + i] = static_cast<uint8_t>(indices >> (8 * i));
+        }
+    }
+
+    void compress_bc5(const uint8_t* rgba, uint8_t* out)
+    {
+        compress_bc4(rgba, 0, out);
+        compress_bc4(rgba, 1, out + 8);
+    }
+
+    void compress_bc7(const uint8_t* rgba, uint8_t* out)
+    {
+        static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+        float start[4], end[4];
+        find_endpoints(rgba, 4, start, end);
+
+        int endpoints[2][4];
+        int p_bits[2];
+        quantize_bc7_endpoint(start, endpoints[0], p_bits[0]);
+        quantize_bc7_endpoint(end, endpoints[1], p_bits[1]);
+
+        int palette[16][4];
+        for(int c = 0; c < 4; ++c)
+        {
+            int e0 = (endpoints[0][c] << 1) | p_bits[0];
+            int e1 = (endpoints[1][c] << 1) | p_bits[1];
+            for(int i = 0; i < 16; ++i)
+            {
+                palette[i][c] = ((64 - weights[i]) * e0 + weights[i] * e1 + 32) >> 6;
+            }
+        }
+
+        int indices[16];
+        for(int i = 0; i < 16; ++i)
+        {
+            int best = 0;
+            int best_error = INT32_MAX;
+            for(int j = 0; j < 16; ++j)
+            {
+                int error = 0;
+                for(int c = 0; c < 4; ++c)
+                {
+                    int difference = palette[j][c] - rgba[i * 4 + c];
+                    error += difference * difference;
+                }
+
+                if(error < best_error)
+                {
+                    best = j;
+                    best_error = error;
+                }
+            }
+            indices[i] = best;
+        }
+
+        // the first index only has 3 bits stored, its top bit is implied to be 0 so flip the block around if needed
+        if(indices[0] & 8)
+        {
+            std::swap(endpoints[0], endpoints[1]);
+            std::swap(p_bits[0], p_bits[1]);
+            for(int& index : indices)
+            {
+                index = 15 - index;
+            }
+        }
+
+        memset(out, 0, 16);
+        BitWriter writer{ out };
+
+        // mode 6 is a single set bit after six zeros
+        writer.write(1 << 6, 7);
+
+        for(int c = 0; c < 4; ++c)
+        {
+            writer.write(endpoints[0][c], 7);
+            writer.write(endpoints[1][c], 7);
+        }
+
+        writer.write(p_bits[0], 1);
+        writer.write(p_bits[1], 1);
+
+        writer.write(indices[0], 3);
+        for(int i = 1; i < 16; ++i)
+        {
+            writer.write(indices[i], 4);
+        }
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+// encoders for a single 4x4 block, the input is always 16 RGBA8 texels in row order
+// these favour speed and simplicity over quality, endpoints come from the principal axis of the block
+namespace bc
+{
+    // 8 bytes, RGB 565 endpoints with 2 bit indices, alpha is ignored
+    void compress_bc1(const uint8_t* rgba, uint8_t* out);
+
+    // 16 bytes, two BC4 blocks for the red and green channels, meant for tangent space normal maps
+    void compress_bc5(const uint8_t* rgba, uint8_t* out);
+
+    // 16 bytes, mode 6 only: a single subset with RGBA 7.7.7.7 endpoints plus p-bits and 4 bit indices
+    void compress_bc7(const uint8_t* rgba, uint8_t* out);
+}
@@ -0,0 +1,336 @@
+// offline texture converter, turns PNG/JPEG sources into block compressed KTX2 files with a full mip chain
+// usage: TextureConverter <input> <output.ktx2> [--format bc1|bc5|bc7] [--linear]
+//
+// bc7 (the default) for colour textures with alpha, bc1 for opaque colour, bc5 for normal maps
+// colour textures are treated as sRGB unless --linear is passed, bc5 is always linear
+
+#include "BlockCompression.hpp"
+#include "KTX2.hpp"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+enum class BlockFormat
+{
+    BC1,
+    BC5,
+    BC7
+};
+
+struct Level
+{
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> pixels;
+};
+
+static float srgb_to_linear(float value)
+{
+    return (value <= 0.04045f) ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linear_to_srgb(float value)
+{
+    return (value <= 0.0031308f) ? value * 12.92f : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+}
+
+// 2x2 box filter, odd sizes clamp to the last row/column
+// sRGB data is averaged in linear space, otherwise distant mips get darker
+static Level downsample(const Level& source, bool srgb)
+{
+    Level level;
+    level.width = std::max(source.width / 2, 1u);
+    level.height = std::max(source.height / 2, 1u);
+    level.pixels.resize(level.width * level.height * 4);
+
+    for(uint32_t y = 0; y < level.height; ++y)
+    {
+        for(uint32_t x = 0; x < level.width; ++x)
+        {
+            float sum[4] = {};
+            for(uint32_t i = 0; i < 4; ++i)
+            {
+                uint32_t source_x = std::min(x * 2 + (i & 1), source.width - 1);
+                uint32_t source_y = std::min(y * 2 + (i >> 1), source.height - 1);
+                const uint8_t* texel = &source.pixels[(source_y * source.width + source_x) * 4];
+
+                for(uint32_t c = 0; c < 4; ++c)
+                {
+                    float value = texel[c] / 255.f;
+                    sum[c] += (srgb && c < 3) ? srgb_to_linear(value) : value;
+                }
+            }
+
+            uint8_t* texel = &level.pixels[(y * level.width + x) * 4];
+            for(uint32_t c = 0; c < 4; ++c)
+            {
+                float value = sum[c] / 4.f;
+                value = (srgb && c < 3) ? linear_to_srgb(value) : value;
+                texel[c] = static_cast<uint8_t>(std::lround(std::clamp(value, 0.f, 1.f) * 255.f));
+            }
+        }
+    }
+
+    return level;
+}
+
+static std::vector<uint8_t> compress_level(const Level& level, BlockFormat format, uint32_t block_size)
+{
+    uint32_t blocks_x = (level.width + 3) / 4;
+    uint32_t blocks_y = (level.height + 3) / 4;
+    std::vector<uint8_t> blocks(blocks_x * blocks_y * block_size);
+
+    for(uint32_t block_y = 0; block_y < blocks_y; ++block_y)
+    {
+        for(uint32_t block_x = 0; block_x < blocks_x; ++block_x)
+        {
+            // levels smaller than a block repeat their edge texels
+            uint8_t texels[16 * 4];
+            for(uint32_t i = 0; i < 16; ++i)
+            {
+                uint32_t x = std::min(block_x * 4 + (i & 3), level.width - 1);
+                uint32_t y = std::min(block_y * 4 + (i >> 2), level.height - 1);
+                memcpy(&texels[i * 4], &level.pixels[(y * level.width + x) * 4], 4);
+            }
+
+            uint8_t* out = &blocks[(block_y * blocks_x + block_x) * block_size];
+            switch(format)
+            {
+                case BlockFormat::BC1: bc::compress_bc1(texels, out); break;
+                case BlockFormat::BC5: bc::compress_bc5(texels, out); break;
+                case BlockFormat::BC7: bc::compress_bc7(texels, out); break;
+            }
+        }
+    }
+
+    return blocks;
+}
+
+template<typename T>
+static void append(std::vector<uint8_t>& data, T value)
+{
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    data.insert(data.end(), bytes, bytes + sizeof(T));
+}
+
+// the basic data format descriptor, compressed formats describe their channels in terms of whole blocks
+static std::vector<uint8_t> build_dfd(BlockFormat format, bool srgb, uint32_t block_size)
+{
+    struct Sample
+    {
+        uint16_t bit_offset;
+        uint8_t bit_length;
+        uint8_t channel;
+    };
+
+    uint8_t model = ktx2::k_df_model_bc7;
+    std::vector<Sample> samples;
+    switch(format)
+    {
+        case BlockFormat::BC1:
+            model = ktx2::k_df_model_bc1a;
+            samples.push_back({ 0, 63, 0 });
+            break;
+        case BlockFormat::BC5:
+            model = ktx2::k_df_model_bc5;
+            samples.push_back({ 0, 63, 0 });
+            samples.push_back({ 64, 63, 1 });
+            break;
+        case BlockFormat::BC7:
+            model = ktx2::k_df_model_bc7;
+            samples.push_back({ 0, 127, 0 });
+            break;
+    }
+
+    uint16_t block_length = static_cast<uint16_t>(24 + 16 * samples.size());
+
+    std::vector<uint8_t> dfd;
+    append<uint32_t>(dfd, 4 + block_length);
+    append<uint32_t>(dfd, 0);                    // vendor id and descriptor type, both khronos basic
+    append<uint16_t>(dfd, 2);                    // version
+    append<uint16_t>(dfd, block_length);
+    append<uint8_t>(dfd, model);
+    append<uint8_t>(dfd, ktx2::k_df_primaries_bt709);
+    append<uint8_t>(dfd, srgb ? ktx2::k_df_transfer_srgb : ktx2::k_df_transfer_linear);
+    append<uint8_t>(dfd, 0);                     // straight alpha
+
+    // block dimensions are stored minus one
+    append<uint8_t>(dfd, 3);
+    append<uint8_t>(dfd, 3);
+    append<uint8_t>(dfd, 0);
+    append<uint8_t>(dfd, 0);
+
+    append<uint8_t>(dfd, static_cast<uint8_t>(block_size));
+    for(int i = 0; i < 7; ++i)
+    {
+        append<uint8_t>(dfd, 0);
+    }
+
+    for(const Sample& sample : samples)
+    {
+        append<uint16_t>(dfd, sample.bit_offset);
+        append<uint8_t>(dfd, sample.bit_length);
+        append<uint8_t>(dfd, sample.channel);
+        append<uint32_t>(dfd, 0);               // sample position
+        append<uint32_t>(dfd, 0);               // lower
+        append<uint32_t>(dfd, UINT32_MAX);      // upper
+    }
+
+    return dfd;
+}
+
+static bool write_ktx2(const char* path, const std::vector<std::vector<uint8_t>>& levels, uint32_t width, uint32_t height, uint32_t vk_format, const std::vector<uint8_t>& dfd, uint32_t block_size)
+{
+    uint32_t level_count = static_cast<uint32_t>(levels.size());
+
+    ktx2::Header header{};
+    memcpy(header.identifier, ktx2::k_identifier, sizeof(ktx2::k_identifier));
+    header.vk_format = vk_format;
+    header.type_size = 1;
+    header.pixel_width = width;
+    header.pixel_height = height;
+    header.pixel_depth = 0;
+    header.layer_count = 0;
+    header.face_count = 1;
+    header.level_count = level_count;
+    header.supercompression_scheme = 0;
+    header.dfd_byte_offset = static_cast<uint32_t>(sizeof(ktx2::Header) + level_count * sizeof(ktx2::LevelIndex));
+    header.dfd_byte_length = static_cast<uint32_t>(dfd.size());
+
+    // level data is stored smallest first, each level aligned to the block size
+    std::vector<ktx2::LevelIndex> level_index(level_count);
+    uint64_t offset = header.dfd_byte_offset + dfd.size();
+    for(uint32_t i = level_count; i-- > 0;)
+    {
+        offset = (offset + block_size - 1) / block_size * block_size;
+        level_index[i].byte_offset = offset;
+        level_index[i].byte_length = levels[i].size();
+        level_index[i].uncompressed_byte_length = levels[i].size();
+        offset += levels[i].size();
+    }
+
+    std::vector<uint8_t> file;
+    file.reserve(offset);
+    file.insert(file.end(), reinterpret_cast<const uint8_t*>(&header), reinterpret_cast<const uint8_t*>(&header) + sizeof(header));
+    file.insert(file.end(), reinterpret_cast<const uint8_t*>(level_index.data()), reinterpret_cast<const uint8_t*>(level_index.data() + level_count));
+    file.insert(file.end(), dfd.begin(), dfd.end());
+
+    for(uint32_t i = level_count; i-- > 0;)
+    {
+        file.resize(level_index[i].byte_offset, 0);
+        file.insert(file.end(), levels[i].begin(), levels[i].end());
+    }
+
+    std::ofstream stream(path, std::ios::binary);
+    if(!stream)
+    {
+        return false;
+    }
+
+    stream.write(reinterpret_cast<const char*>(file.data()), static_cast<std::streamsize>(file.size()));
+    return stream.good();
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 3)
+    {
+        printf("usage: TextureConverter <input> <output.ktx2> [--format bc1|bc5|bc7] [--linear]\n");
+        return 1;
+    }
+
+    const char* input = argv[1];
+    const char* output = argv[2];
+    BlockFormat format = BlockFormat::BC7;
+    bool srgb = true;
+
+    for(int i = 3; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "--format" && i + 1 < argc)
+        {
+            std::string name = argv[++i];
+            if(name == "bc1")
+            {
+                format = BlockFormat::BC1;
+            }
+            else if(name == "bc5")
+            {
+                format = BlockFormat::BC5;
+            }
+            else if(name == "bc7")
+            {
+                format = BlockFormat::BC7;
+            }
+            else
+            {
+                printf("unknown format %s\n", name.c_str());
+                return 1;
+            }
+        }
+        else if(arg == "--linear")
+        {
+            srgb = false;
+        }
+        else
+        {
+            printf("unknown argument %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    // two channel normal data has no sRGB variant
+    if(format == BlockFormat::BC5)
+    {
+        srgb = false;
+    }
+
+    uint32_t vk_format = ktx2::k_format_bc7_srgb;
+    switch(format)
+    {
+        case BlockFormat::BC1: vk_format = srgb ? ktx2::k_format_bc1_rgb_srgb : ktx2::k_format_bc1_rgb_unorm; break;
+        case BlockFormat::BC5: vk_format = ktx2::k_format_bc5_unorm; break;
+        case BlockFormat::BC7: vk_format = srgb ? ktx2::k_format_bc7_srgb : ktx2::k_format_bc7_unorm; break;
+    }
+    uint32_t block_size = ktx2::get_block_size(vk_format);
+
+    // flipped the same way the renderer flips images it decodes itself
+    stbi_set_flip_vertically_on_load(1);
+
+    int width, height, channels;
+    stbi_uc* pixels = stbi_load(input, &width, &height, &channels, STBI_rgb_alpha);
+    if(!pixels)
+    {
+        printf("failed to load %s: %s\n", input, stbi_failure_reason());
+        return 1;
+    }
+
+    Level level;
+    level.width = static_cast<uint32_t>(width);
+    level.height = static_cast<uint32_t>(height);
+    level.pixels.assign(pixels, pixels + width * height * 4);
+    stbi_image_free(pixels);
+
+    std::vector<std::vector<uint8_t>> levels;
+    levels.push_back(compress_level(level, format, block_size));
+    while(level.width > 1 || level.height > 1)
+    {
+        level = downsample(level, srgb);
+        levels.push_back(compress_level(level, format, block_size));
+    }
+
+    if(!write_ktx2(output, levels, static_cast<uint32_t>(width), static_cast<uint32_t>(height), vk_format, build_dfd(format, srgb, block_size), block_size))
+    {
+        printf("failed to write %s\n", output);
+        return 1;
+    }
+
+    printf("%s -> %s, %ux%u with %zu levels\n", input, output, width, height, levels.size());
+    return 0;
+}